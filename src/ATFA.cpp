@@ -26,11 +26,6 @@
  *       funções de querying do PorAudio, sobre os devices disponíveis, etc.
  */
 
-/* TODO: detectar quando o filtro explodiu, e parar a simulação imediatamente
- *       (usar a função de "abort stream" do portaudio, ao invés da função de
- *       "stop stream")
- */
-
 // TODO: quando a RIR selecionada for o "None", o botão de "show rir
 //       coefficients" tem que estar HABILITADO, e mostrar "rir = [ 1 ]".
 
@@ -51,6 +46,8 @@ extern "C" {
 #include <QRegExp>
 
 #include "ATFA.h"
+#include "AudioDevice.h"
+#include "LatencyCalibrator.h"
 #include "Stream.h"
 #include "dialogs/ShowTextDialog.h"
 #include "dialogs/ChangeAlgorithmDialog.h"
@@ -61,7 +58,9 @@ extern "C" {
 
 ATFA::ATFA(QWidget *parent) :
     QMainWindow(parent), stream(), pastream(NULL),
-    muted(false), scene_filename("")
+    muted(false), scene_filename(""),
+    rir_cache(Stream::samplerate, Stream::fft_size,
+              Stream::fft_size - Stream::blk_size - 1)
 {
 
     delay_min = stream.scene.system_latency + stream.min_delay;
@@ -112,10 +111,52 @@ ATFA::ATFA(QWidget *parent) :
     connect(syslatency_act, SIGNAL(triggered()),
             this, SLOT(change_syslatency()));
 
+    // measure system latency
+    calibrate_act = new QAction("&Calibrate system latency", this);
+    connect(calibrate_act, SIGNAL(triggered()),
+            this, SLOT(calibrate_syslatency()));
+
     // benchmark DSO times
     benchmark_act = new QAction("&Benchmark DSO", this);
     connect(benchmark_act, SIGNAL(triggered()), this, SLOT(benchmark_dso()));
 
+    // save adaptive filter state
+    savestate_act = new QAction("Save adaptive filter &state", this);
+    savestate_act->setStatusTip(
+      "Save the state reached by the adaptive filter in the last simulation,"
+      " so that the next simulations start from it."
+    );
+    connect(savestate_act, SIGNAL(triggered()),
+            this, SLOT(save_filter_state()));
+
+    // load VAD from DSO
+    loadvad_act = new QAction("Load &VAD DSO...", this);
+    loadvad_act->setStatusTip(
+      "Load a voice activity detector from a shared object, which will be"
+      " added to the VAD choices."
+    );
+    connect(loadvad_act, SIGNAL(triggered()), this, SLOT(load_vad_dso()));
+
+    // divergence watchdog
+    {
+        const char *labels[4] = {
+            "&Off", "&Restart the filter", "&Freeze learning",
+            "&Abort the simulation"
+        };
+        watchdog_group = new QActionGroup(this);
+        for (int a = Watchdog::Off; a <= Watchdog::Abort; ++a) {
+            watchdog_acts[a] = new QAction(labels[a], this);
+            watchdog_acts[a]->setCheckable(true);
+            watchdog_group->addAction(watchdog_acts[a]);
+        }
+        watchdog_acts[stream.scene.watchdog_action]->setChecked(true);
+        connect(watchdog_group, SIGNAL(triggered(QAction*)),
+                this, SLOT(watchdog_action_triggered(QAction*)));
+        watchdog_timer = new QTimer(this);
+        connect(watchdog_timer, SIGNAL(timeout()),
+                this, SLOT(check_watchdog()));
+    }
+
     // help
     show_help_act = new QAction(QIcon::fromTheme("help-contents"),
                                 "&Manual", this);
@@ -146,7 +187,13 @@ ATFA::ATFA(QWidget *parent) :
 
     tools_menu = menuBar()->addMenu("&Tools");
     tools_menu->addAction(syslatency_act);
+    tools_menu->addAction(calibrate_act);
     tools_menu->addAction(benchmark_act);
+    tools_menu->addAction(savestate_act);
+    tools_menu->addAction(loadvad_act);
+    watchdog_menu = tools_menu->addMenu("Divergence &watchdog");
+    for (QAction *act : watchdog_acts)
+        watchdog_menu->addAction(act);
 
     help_menu = menuBar()->addMenu("&Help");
     help_menu->addAction(show_help_act);
@@ -176,6 +223,12 @@ ATFA::ATFA(QWidget *parent) :
 
     statusBar()->showMessage(QString("ATFA"));
 
+    engine_label = new QLabel(this);
+    statusBar()->addPermanentWidget(engine_label);
+
+    status_timer = new QTimer(this);
+    connect(status_timer, SIGNAL(timeout()), this, SLOT(update_status()));
+
     /*
      * MAIN VIEW
      *
@@ -205,6 +258,9 @@ ATFA::ATFA(QWidget *parent) :
             flearn_layout->addWidget(flearn_on_radio);
             flearn_layout->addWidget(flearn_off_radio);
             flearn_layout->addWidget(flearn_vad_radio);
+            flearn_dtd_check = new QCheckBox(
+                "&Paused during double-talk", flearn_group);
+            flearn_layout->addWidget(flearn_dtd_check);
             flearn_layout->addStretch(1); // TODO: do we need this?
         flearn_group->setLayout(flearn_layout);
         left_layout->addWidget(flearn_group);
@@ -232,11 +288,11 @@ ATFA::ATFA(QWidget *parent) :
 
             vad_indicator_led = new LEDIndicatorWidget(first_row_widget);
             first_row_layout->addWidget(vad_indicator_led);
-            stream.setLED(vad_indicator_led);
 
             vad_algorithm_combo = new QComboBox;
             vad_algorithm_combo->addItem("Hard");
             vad_algorithm_combo->addItem("Soft");
+            vad_algorithm_combo->addItem("Spectral");
             first_row_layout->addWidget(vad_algorithm_combo);
 
             first_row_div = new QFrame(first_row_widget);
@@ -373,6 +429,8 @@ ATFA::ATFA(QWidget *parent) :
             this, SLOT(flearn_off_toggled(bool)));
     connect(flearn_vad_radio, SIGNAL(toggled(bool)),
             this, SLOT(flearn_vad_toggled(bool)));
+    connect(flearn_dtd_check, SIGNAL(toggled(bool)),
+            this, SLOT(flearn_dtd_toggled(bool)));
 
     connect(zero_button, SIGNAL(clicked()), this, SLOT(zero_filter_clicked()));
 
@@ -432,6 +490,8 @@ int ATFA::get_delay() {
 
 void ATFA::update_widgets() {
 
+    watchdog_acts[stream.scene.watchdog_action]->setChecked(true);
+
     switch (stream.scene.filter_learning) {
     case Stream::Scenario::On:
         flearn_on_radio->setChecked(true);
@@ -446,6 +506,7 @@ void ATFA::update_widgets() {
         throw std::runtime_error(
                     "stream.scene.filter_learning has wrong value");
     }
+    flearn_dtd_check->setChecked(stream.scene.dtd_enabled);
 
     // TODO: o que fazer em relação ao filter_output?
 
@@ -485,8 +546,9 @@ void ATFA::update_widgets() {
         rir_show_button->setDisabled(false);
     }
 
-    stream.setAdapfAlgorithm(
-                new AdaptiveFilter<Stream::sample_t>(stream.scene.adapf_file));
+    stream.setAdapfAlgorithm(new AdaptiveFilter<Stream::sample_t>(
+                                 stream.scene.adapf_file,
+                                 stream.scene.adapf_isolated));
     if (stream.adapf_is_dummy()) {
         adapf_file_label->setText("None");
         adapf_show_button->setDisabled(true);
@@ -495,6 +557,7 @@ void ATFA::update_widgets() {
         adapf_file_label->setText(stream.get_adapf_title());
         adapf_show_button->setDisabled(false);
     }
+    warn_if_adapf_not_realtime_safe();
 
 }
 
@@ -601,7 +664,69 @@ void ATFA::change_syslatency() {
     if (!choose_dialog->run())
         return;
 
-    stream.scene.system_latency = choose_dialog->chosen_num;
+    set_system_latency(choose_dialog->chosen_num);
+    statusBar()->showMessage("System latency set.");
+
+}
+
+/**
+  * Plays a probe through the sound card (see `LatencyCalibrator`), which the
+  * microphone must hear, and sets the system latency to the measured
+  * round-trip delay.
+  */
+void ATFA::calibrate_syslatency() {
+
+    QMessageBox ask_box(this);
+    ask_box.setText("A noise-like probe will be played for about a second."
+                    " Place the microphone near the speakers (or connect the"
+                    " output to the input with a cable), set a reasonable"
+                    " volume, and keep the room quiet.");
+    ask_box.setWindowTitle("ATFA - Calibrate system latency");
+    ask_box.setIcon(QMessageBox::Information);
+    ask_box.setStandardButtons(QMessageBox::Ok | QMessageBox::Cancel);
+    if (ask_box.exec() != QMessageBox::Ok)
+        return;
+
+    LatencyCalibrator::Result r;
+    try {
+        QApplication::setOverrideCursor(Qt::WaitCursor);
+        PortAudioDevice dev{Stream::samplerate*4};
+        r = LatencyCalibrator{}.measure(dev);
+        QApplication::restoreOverrideCursor();
+    } catch (const std::exception& e) {
+        QApplication::restoreOverrideCursor();
+        QMessageBox msg_box(this);
+        msg_box.setText(QString("Could not measure the system latency. ") +
+                        e.what());
+        msg_box.setWindowTitle("ATFA [error]");
+        msg_box.setIcon(QMessageBox::Warning);
+        msg_box.exec();
+        return;
+    }
+
+    int ms = static_cast<int>(std::lround(1000 * r.latency));
+    int max = delay_max - stream.min_delay - 1; // as in change_syslatency
+    if (ms > max) {
+        QMessageBox msg_box(this);
+        msg_box.setText("The measured system latency, " +
+                        QString::number(ms) + " ms, is above the maximum"
+                        " of " + QString::number(max) + " ms.");
+        msg_box.setWindowTitle("ATFA [error]");
+        msg_box.setIcon(QMessageBox::Warning);
+        msg_box.exec();
+        return;
+    }
+
+    set_system_latency(ms);
+    statusBar()->showMessage("System latency measured: " +
+                             QString::number(1000 * r.latency, 'f', 1) +
+                             " ms.");
+
+}
+
+void ATFA::set_system_latency(int ms) {
+
+    stream.scene.system_latency = ms;
     int stream_delay = stream.scene.delay - stream.scene.system_latency;
     if (stream_delay < stream.min_delay) {
         stream.scene.delay = stream.scene.system_latency + stream.min_delay;
@@ -619,8 +744,6 @@ void ATFA::change_syslatency() {
     delay_slider->setMinimum(delay_min);
     delay_spin->setMinimum(delay_min);
 
-    statusBar()->showMessage("System latency set.");
-
 }
 
 void ATFA::benchmark_dso() {
@@ -628,6 +751,118 @@ void ATFA::benchmark_dso() {
     bm_dialog->exec();
 }
 
+void ATFA::load_vad_dso() {
+    QString filename = QFileDialog::getOpenFileName(
+                this, "Load VAD DSO", QDir::currentPath(),
+                "Shared objects (*.so)");
+    if (filename == "")
+        return;
+    VADPlugin *plugin;
+    try {
+        plugin = new VADPlugin(filename.toUtf8().constData());
+    } catch (const VADPluginException& e) {
+        QMessageBox msg_box(this);
+        msg_box.setText(QString("Error loading the VAD DSO: ") + e.what());
+        msg_box.setWindowTitle("ATFA [error]");
+        msg_box.setIcon(QMessageBox::Warning);
+        msg_box.exec();
+        return;
+    }
+    stream.setVADPlugin(plugin);
+    QString title = QString("DSO: ") + plugin->get_title();
+    // the built-in VADs take the first three entries
+    if (vad_algorithm_combo->count() > 3)
+        vad_algorithm_combo->setItemText(3, title);
+    else
+        vad_algorithm_combo->addItem(title);
+    vad_algorithm_combo->setCurrentIndex(3);
+    stream.setVADAlgorithm(3); // in case the index was 3 already
+    statusBar()->showMessage("VAD DSO loaded.");
+}
+
+void ATFA::watchdog_action_triggered(QAction *act) {
+    for (int a = Watchdog::Off; a <= Watchdog::Abort; ++a)
+        if (act == watchdog_acts[a])
+            stream.scene.watchdog_action = static_cast<Watchdog::Action>(a);
+    if (stream.running())
+        statusBar()->showMessage("The divergence watchdog setting will take"
+                                 " effect in the next simulation.");
+    else
+        statusBar()->showMessage("Divergence watchdog updated.");
+}
+
+void ATFA::check_watchdog() {
+    if (!stream.running())
+        return;
+    if (stream.recover_adapf_helper())
+        statusBar()->showMessage(stream.adapf_helper_failed() ?
+            "The adaptive filter DSO stalled, and was bypassed." :
+            "The adaptive filter DSO stalled, and was restarted from"
+            " scratch.");
+    if (!stream.watchdog_aborted())
+        return;
+    play_clicked(); // stops the simulation
+    QMessageBox msg_box(this);
+    msg_box.setText("The adaptive filter diverged, and the simulation was"
+                    " aborted. The terminal output has the details.");
+    msg_box.setWindowTitle("ATFA [warning]");
+    msg_box.setIcon(QMessageBox::Warning);
+    msg_box.exec();
+}
+
+void ATFA::update_status() {
+    Stream::Status st = stream.status();
+    vad_indicator_led->setLEDStatus(st.voice);
+    auto dbfs = [](float peak) {
+        return peak > 0 ? QString::number(20*std::log10(peak), 'f', 1)
+                        : QString("-inf");
+    };
+    int updates_per_s = (st.filter_updates - last_filter_updates) *
+                        1000 / status_interval;
+    last_filter_updates = st.filter_updates;
+    engine_label->setText(
+        QString("far %1 dBFS | echo %2 dBFS | learning %3% | %4 updates/s"
+                " | backlog %5 | worst latency %6 ms%7")
+            .arg(dbfs(st.far_peak)).arg(dbfs(st.echo_peak))
+            .arg(int(100*st.learning + .5f)).arg(updates_per_s)
+            .arg(st.backlog)
+            .arg(QString::number(1e3*st.max_block_latency, 'f', 1))
+            .arg(st.double_talk ? " | double-talk" : ""));
+}
+
+void ATFA::save_filter_state() {
+    if (!stream.has_adapf_state()) {
+        QMessageBox msg_box(this);
+        msg_box.setText("There is no adaptive filter state to save. Run a"
+                        " simulation first, with an adaptive filter whose DSO"
+                        " exports the adapf_save_state and adapf_load_state"
+                        " functions.");
+        msg_box.setWindowTitle("ATFA [info]");
+        msg_box.setIcon(QMessageBox::Information);
+        msg_box.exec();
+        return;
+    }
+    QString filename = QFileDialog::getSaveFileName(
+                this, "Save Adaptive Filter State", QDir::currentPath(),
+                "ATFA filter state files (*.atfastate)");
+    if (filename == "")
+        return;
+    try {
+        stream.save_adapf_state(filename.toUtf8().constData());
+    } catch (const AdapfException& e) {
+        QMessageBox msg_box(this);
+        msg_box.setText(QString("Error saving the adaptive filter state: ") +
+                        e.what());
+        msg_box.setWindowTitle("ATFA [error]");
+        msg_box.setIcon(QMessageBox::Warning);
+        msg_box.exec();
+        return;
+    }
+    stream.scene.adapf_state_file = filename;
+    statusBar()->showMessage("Adaptive filter state saved. The next"
+                             " simulations will start from it.");
+}
+
 void ATFA::show_help() {
     QDialog *help_dialog = new QDialog{this};
     QVBoxLayout *layout = new QVBoxLayout{help_dialog};
@@ -649,18 +884,22 @@ void ATFA::show_help() {
                         input sample. When set to 'Disabled', the coefficients\
                         will never be updated. When set to 'VAD', the\
                         coefficients will be updated only on the frames for\
-                        which the Voice Activity Detector triggers. This\
-                        setting can be changed online (while the simulation is\
-                        running), and its effect is instantaneous.</li>\
+                        which the Voice Activity Detector triggers. When\
+                        'Paused during double-talk' is checked, the\
+                        coefficients are also frozen while the microphone\
+                        picks up something other than the echo. These\
+                        settings can be changed online (while the simulation\
+                        is running), and their effect is instantaneous.</li>\
                     <li><b>Reset filter state:</b> While the simulation is\
                         running, you can click this button to reset all filter\
                         coefficients back to their initial value (usually\
                         zero).</li>\
                     <li><b>Voice activity:</b> during simulation, this will\
                         glow in green when a voice signal has been detected in\
-                        the input. You can choose between the <i>Soft</i> and\
-                        the <i>Hard</i> detectors (the <i>Hard</i> detector is\
-                        suggested if you're working in a noisy\
+                        the input. You can choose between the <i>Soft</i>,\
+                        the <i>Hard</i> and the <i>Spectral</i> detectors (the\
+                        <i>Spectral</i> detector tracks the background noise,\
+                        and is suggested if you're working in a noisy\
                         environment).</li>\
                     <li><b>Play button:</b> Click to start the simulation.</li>\
                     <li><b>Round trip delay:</b> The delay introduced by the\
@@ -753,6 +992,11 @@ void ATFA::flearn_vad_toggled(bool t) {
     stream.scene.filter_learning = Stream::Scenario::VAD;
     statusBar()->showMessage("Filter learning is controlled by the VAD.");
 }
+void ATFA::flearn_dtd_toggled(bool t) {
+    stream.scene.dtd_enabled = t;
+    statusBar()->showMessage(t ? "Filter learning pauses during double-talk."
+                               : "Double-talk detection is disabled.");
+}
 
 void ATFA::zero_filter_clicked() {
     stream.reset_adapf_state();
@@ -765,7 +1009,12 @@ void ATFA::play_clicked() {
         stream.stop(pastream);
         pastream = NULL;
 
-        statusBar()->showMessage("Simulation stopped.");
+        if (stream.adapf_helper_failed())
+            statusBar()->showMessage("Simulation stopped. The adaptive filter"
+                                     " DSO stalled or crashed, and was"
+                                     " bypassed.");
+        else
+            statusBar()->showMessage("Simulation stopped.");
         play_button->setIcon(QIcon(QPixmap("../../imgs/play.png")));
 
         rir_change_button->setDisabled(false);
@@ -776,9 +1025,15 @@ void ATFA::play_clicked() {
         open_act->setDisabled(false);
         save_as_act->setDisabled(false);
         benchmark_act->setDisabled(false);
+        savestate_act->setDisabled(false);
+        loadvad_act->setDisabled(false);
         syslatency_act->setDisabled(false);
+        calibrate_act->setDisabled(false);
 
+        watchdog_timer->stop();
+        status_timer->stop();
         vad_indicator_led->setLEDStatus(false);
+        engine_label->clear();
 
     }
     else {
@@ -791,10 +1046,17 @@ void ATFA::play_clicked() {
         open_act->setDisabled(true);
         save_as_act->setDisabled(true);
         benchmark_act->setDisabled(true);
+        savestate_act->setDisabled(true);
+        loadvad_act->setDisabled(true);
         syslatency_act->setDisabled(true);
+        calibrate_act->setDisabled(true);
 
         pastream = stream.echo();
 
+        watchdog_timer->start(200);
+        last_filter_updates = 0;
+        status_timer->start(status_interval);
+
         statusBar()->showMessage("Simulation running...");
         play_button->setIcon(QIcon(QPixmap("../../imgs/pause.png")));
 
@@ -861,10 +1123,11 @@ void ATFA::set_stream_rir(const Stream::container_t &h) {
     }
 }
 
-void ATFA::set_stream_rir(Signal h) {
-    h.set_samplerate(stream.samplerate);
+void ATFA::set_stream_rir(const RIRCache::Entry& rir) {
     try {
-        stream.set_filter(h.array(), h.array() + h.samples());
+        stream.set_filter(Stream::container_t(rir.taps(),
+                                              rir.taps() + rir.size()),
+                          rir.freq_re(), rir.freq_im());
     }
     catch (const std::length_error& e) {
         throw RIRSizeException(e.what());
@@ -879,7 +1142,12 @@ void ATFA::set_new_rir(Scene::RIR_source_t source, QString txt,
         stream.scene.set_rir<Scene::NoRIR>(); // set RIR metadata
         break;
     case Scene::Literal:
-        set_stream_rir(ChangeRIRDialog::parse_txt(txt)); // set RIR samples
+        {
+            QByteArray utf8 = txt.toUtf8();
+            set_stream_rir(parse_rir_text( // set RIR samples
+                               utf8.constData(),
+                               utf8.constData() + utf8.size()));
+        }
         stream.scene.set_rir<Scene::Literal>(); // set RIR metadata
         break;
     case Scene::File:
@@ -901,24 +1169,9 @@ void ATFA::set_new_rir(Scene::RIR_source_t source, QString txt,
                 filetype = Scene::WAV;
             else
                 throw RIRInvalidException("RIR file must be *.m or *.wav.");
-            if (filetype == Scene::MAT) {
-                QFile file(filename);
-                if (!file.open(QIODevice::ReadOnly))
-                    throw RIRInvalidException("Error opening RIR file.");
-                set_stream_rir(ChangeRIRDialog::parse_txt( // set RIR samples
-                                   file.readAll().constData()));
-            }
-            else {
-                Signal s;
-                try {
-                    Signal sig_from_file(filename.toUtf8().constData());
-                    s = sig_from_file;
-                }
-                catch (const FileError&) {
-                    throw RIRInvalidException("Error opening file.");
-                }
-                set_stream_rir(s); // set RIR samples
-            }
+            // set RIR samples (and spectrum), parsed, resampled and
+            // transformed only the first time this file is seen
+            set_stream_rir(*rir_cache.get(filename.toUtf8().constData()));
             stream.scene.set_rir<Scene::File>(filetype, filename);
         }
         break;
@@ -995,5 +1248,23 @@ void ATFA::change_adapf() {
     }
 
     statusBar()->showMessage("Adaptive filter algorithm updated.");
+    warn_if_adapf_not_realtime_safe();
+
+}
 
+/**
+  * A DSO that allocates memory or locks a mutex inside `adapf_run` may make
+  * the audio glitch at any time; better to know before starting a session.
+  */
+void ATFA::warn_if_adapf_not_realtime_safe() {
+    if (stream.adapf_is_realtime_safe())
+        return;
+    QMessageBox msg_box(this);
+    msg_box.setText("The adaptive filter allocated or freed memory, or locked"
+                    " a mutex, inside its adapf_run function while it was"
+                    " tested. It is not real-time safe, and may make the"
+                    " audio glitch. Run the benchmark for the details.");
+    msg_box.setWindowTitle("ATFA [warning]");
+    msg_box.setIcon(QMessageBox::Warning);
+    msg_box.exec();
 }
@@ -14,6 +14,7 @@
 #include <QtWidgets>
 #include <QMainWindow>
 
+#include "RIRCache.h"
 #include "Signal.h"
 #include "Stream.h"
 #include "widgets/LEDIndicatorWidget.h"
@@ -24,8 +25,7 @@
     TODO: refatorar o código, obedecendo:
     (1) adhere strictly à regra de que "cada classe representa uma e somente uma
         abstração"; em particular, as classes de implementação devem estar
-        completamente separadas das classes de GUI. (e.g., nada de classe
-        Stream tendo pointer pra LED)
+        completamente separadas das classes de GUI.
     (2) Evita naked-new/delete (usa unique_ptr, shared_ptr, etc) -> dá inclusive
         pra usar os smart pointers pra QObjects, mesmo que as funções do Qt
         recebam em geral raw pointers pros QObjects, pq a gente pode
@@ -122,7 +122,13 @@ private slots:
 
     // tools
     void change_syslatency();
+    void calibrate_syslatency();
     void benchmark_dso();
+    void save_filter_state();
+    void load_vad_dso();
+    void watchdog_action_triggered(QAction *act);
+    void check_watchdog();
+    void update_status();
 
     // help
     void show_help();
@@ -133,6 +139,7 @@ private slots:
     void flearn_on_toggled(bool t);
     void flearn_off_toggled(bool t);
     void flearn_vad_toggled(bool t);
+    void flearn_dtd_toggled(bool t);
 
     void zero_filter_clicked();
 
@@ -158,24 +165,39 @@ private:
     QAction *save_as_act;
     QAction *quit_act;
     QAction *syslatency_act;
+    QAction *calibrate_act;
     QAction *benchmark_act;
+    QAction *savestate_act;
+    QAction *loadvad_act;
+    QActionGroup *watchdog_group;
+    QAction *watchdog_acts[4]; // indexed by Watchdog::Action
     QAction *show_help_act;
     QAction *about_atfa_act;
     QAction *about_qt_act;
 
     QMenu *file_menu;
     QMenu *tools_menu;
+    QMenu *watchdog_menu;
     QMenu *help_menu;
 
     QToolBar *toolbar;
 
     QWidget *main_widget;
 
+    QTimer *watchdog_timer; // polls the stream for an aborted session, or a
+                            // stalled DSO
+    QTimer *status_timer; // polls the stream for the VAD LED and engine_label
+    static constexpr int status_interval = 50; // ms
+    int last_filter_updates;
+
+    QLabel *engine_label; // permanent widget in the status bar
+
     // left layout
     QGroupBox *flearn_group;
         QRadioButton *flearn_on_radio;
         QRadioButton *flearn_off_radio;
         QRadioButton *flearn_vad_radio;
+        QCheckBox *flearn_dtd_check;
     QPushButton *zero_button;
     QGroupBox *fout_group;
         QRadioButton *fout_on_radio;
@@ -214,11 +236,18 @@ private:
 
     QString scene_filename;
 
+    RIRCache rir_cache;
+
     void set_stream_rir(const Stream::container_t &h);
-    void set_stream_rir(Signal h);
+    void set_stream_rir(const RIRCache::Entry& rir);
     void set_new_rir(Scene::RIR_source_t source, QString txt, QString filename);
 
+    void warn_if_adapf_not_realtime_safe();
+
+    void set_system_latency(int ms);
+
     friend class ChangeAlgorithmDialog;
+    friend class BenchmarkAdapfDialog;
 
     void save_to_file(QString filename);
 
@@ -10,12 +10,21 @@
 #ifndef ADAPFBENCHMARKER_H
 #define ADAPFBENCHMARKER_H
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <memory>
 #include <random>
+#include <string>
 #include <utility>
+#include <vector>
 
 #include "AdaptiveFilter.h"
+#include "AllocTrace.h"
+#include "EchoQuality.h"
+#include "PerfCounters.h"
 #include "Signal.h"
+#include "Timing.h"
 
 template <typename SAMPLE_T>
 class AdapfBenchmarker
@@ -32,72 +41,321 @@ public:
 
     void set_margins(int margins) { prologue_ = epilogue_ = margins; }
 
+    /// Sets how many times, and for how long, the input is run
+    void set_harness(const Timing::Harness& h) { harness_ = h; }
+
+    /// Also counts hardware events around the timed calls
+    /**
+      * See `PerfCounters`. If the counters can't be opened, the benchmark
+      * runs anyway, and `Result::counters_error` says why. They can't count
+      * an isolated filter, which runs in its helper process.
+      */
+    void set_counters(bool enable) { counters_ = enable; }
+
+    /// ERLE above which the filter is considered converged
+    void set_target_erle(double db) { target_erle_ = db; }
+
+    typedef typename EchoQuality<SAMPLE_T>::Summary Quality;
+
+    struct Result {
+        Timing::Stats time_per_sample;
+        int updates; ///< number of updates in one pass over the input
+        PerfCounters::Counts counters_per_sample; ///< if `set_counters`
+        std::string counters_error;
+        Quality quality; ///< how well the echo was cancelled, in the last pass
+        /// Allocations and locks made by the filter in the last pass; not
+        /// available in isolated mode
+        AllocTrace::Report allocations;
+    };
+
+    /// Seed of the noise added to the echo, unless told otherwise
+    constexpr static unsigned DEFAULT_SEED = std::mt19937::default_seed;
+
     AdapfBenchmarker(AdaptiveFilter<SAMPLE_T>& af,
                      const Signal& input, const Signal& imp_resp, int noise,
                      int pro=DEFAULT_PROLOGUE, int epi=DEFAULT_EPILOGUE)
+        : AdapfBenchmarker(af, input, make_echo(input, imp_resp, noise),
+                           imp_resp, pro, epi)
+    {}
+
+    /// Same, but with the echo already made by `make_echo()`
+    /**
+      * So that many benchmarkers of the same input, RIR and noise (e.g. one
+      * for each DSO) don't have to filter the input again.
+      *
+      * The input and the echo are kept by the benchmarker: pass temporaries
+      * (or `std::move` them) to spare copying them.
+      */
+    AdapfBenchmarker(AdaptiveFilter<SAMPLE_T>& af,
+                     Signal input, Signal echo,
+                     const Signal& imp_resp,
+                     int pro=DEFAULT_PROLOGUE, int epi=DEFAULT_EPILOGUE)
+        : AdapfBenchmarker(af,
+                           std::make_shared<const Signal>(std::move(input)),
+                           std::make_shared<const Signal>(std::move(echo)),
+                           imp_resp, pro, epi)
+    {}
+
+    /// Same, but sharing the input and the echo with their owner
+    /**
+      * So that benchmarkers running at the same time (e.g. in a pool of
+      * threads) don't each keep a copy of them. The signals aren't modified.
+      */
+    AdapfBenchmarker(AdaptiveFilter<SAMPLE_T>& af,
+                     std::shared_ptr<const Signal> input,
+                     std::shared_ptr<const Signal> echo,
+                     const Signal& imp_resp,
+                     int pro=DEFAULT_PROLOGUE, int epi=DEFAULT_EPILOGUE)
         : adapf_(af), prologue_(pro), epilogue_(epi),
-          input_(input), N(input_.samples()), output_{input_}
+          input_(std::move(input)), N(input_->samples()),
+          output_(std::move(echo))
     {
-        output_.filter(imp_resp);
-        Signal::container_t awgn(output_.samples()); // deveria ser Signal
-        std::mt19937 rng;
-        std::normal_distribution<> gauss{0, std::pow(10,noise/20)};
-        for (auto& x : awgn) x = gauss(rng);
-        output_ = output_ + Signal{awgn}; // TODO operator+= para o Signal
-        if (prologue_ > static_cast<int>(input_.samples()))
-            prologue_ = static_cast<int>(input_.samples());
-        if (epilogue_ > static_cast<int>(input_.samples()))
-            epilogue_ = static_cast<int>(input_.samples());
+        {
+            Signal h{imp_resp}; // at the same samplerate as the echo
+            h.set_samplerate(input_->samplerate());
+            echo_path_.assign(h.array(), h.array() + h.samples());
+        }
+        if (prologue_ > static_cast<int>(input_->samples()))
+            prologue_ = static_cast<int>(input_->samples());
+        if (epilogue_ > static_cast<int>(input_->samples()))
+            epilogue_ = static_cast<int>(input_->samples());
     }
 
+    /// The signal at the microphone: `input` through the RIR, plus white
+    /// noise of `noise` dB
+    static Signal make_echo(const Signal& input, const Signal& imp_resp,
+                            int noise, unsigned seed = DEFAULT_SEED) {
+        Signal echo{input};
+        echo.filter(imp_resp);
+        std::mt19937 rng{seed};
+        std::normal_distribution<> gauss{0, std::pow(10, noise/20.0)};
+        for (Signal::index_t i = 0; i != echo.samples(); ++i)
+            echo[i] += static_cast<Signal::sample_t>(gauss(rng));
+        return echo;
+    }
+
+    /// Makes every run start from `state`, instead of from scratch.
+    void set_initial_state(
+            const typename AdaptiveFilter<SAMPLE_T>::state_t& state) {
+        initial_state_ = state;
+    }
+
+    /// Times the `adapf_run` calls, over repeated passes over the input
+    /**
+      * Each pass starts from scratch (or from the initial state), and runs
+      * the prologue, the timed calls and the epilogue, so all passes do the
+      * exact same work.
+      *
+      * The errors returned by the filter are kept, and, between the timed
+      * chunks of each pass, compared with the echo to measure its quality
+      * (see `EchoQuality`); the echo path, used in the misalignment, is the
+      * RIR given to the constructor. The allocations and locks made by the
+      * filter are traced too (see `AllocTrace`), outside of the stopwatch.
+      */
+    template <int learn>
+    Result benchmark() { return benchmark<learn>(adapf_); }
+
+    /// Same, but runs `af` instead of the filter given to the constructor
+    /**
+      * The benchmarker itself is not modified, so many threads may call this
+      * at the same time, each with its own filter, as long as the filters
+      * are reentrant (see `AdaptiveFilter::is_reentrant()`).
+      *
+      * \throws Timing::Cancelled if `progress` gets cancelled.
+      */
     template <int learn>
-    std::pair<std::chrono::duration<double>, int> benchmark();
+    Result benchmark(AdaptiveFilter<SAMPLE_T>& af,
+                     Timing::Progress *progress = nullptr) const;
+
+    /// Estimates how long (in seconds) `benchmark<learn>()` would take
+    /**
+      * Times single passes over a growing prefix of the input, à la Python's
+      * timeit, until one of them takes at least `CALIBRATION_TIME`, and
+      * extrapolates to the harness' number of repetitions.
+      */
+    template <int learn>
+    double estimate_time(AdaptiveFilter<SAMPLE_T>& af) const;
+
+    constexpr static double CALIBRATION_TIME = .02; // seconds
+
+    /// Samples between two checks for cancellation, inside a pass; also the
+    /// window of the quality measures
+    constexpr static int CHECK_INTERVAL = EchoQuality<SAMPLE_T>::DEFAULT_WINDOW;
 
 private:
 
     AdaptiveFilter<SAMPLE_T>& adapf_;
     int prologue_, epilogue_;
 
-    Signal input_;
+    std::shared_ptr<const Signal> input_;
 
     int N;
-    Signal output_;
+    std::shared_ptr<const Signal> output_;
+    std::vector<SAMPLE_T> echo_path_;
+
+    typename AdaptiveFilter<SAMPLE_T>::state_t initial_state_;
+
+    Timing::Harness harness_;
+    bool counters_ = false;
+    double target_erle_ = EchoQuality<SAMPLE_T>::DEFAULT_TARGET_ERLE;
 
 };
 
 template <typename SAMPLE_T>
 template <int learn>
-std::pair<std::chrono::duration<double>, int>
-AdapfBenchmarker<SAMPLE_T>::benchmark() {
+typename AdapfBenchmarker<SAMPLE_T>::Result
+AdapfBenchmarker<SAMPLE_T>::benchmark(AdaptiveFilter<SAMPLE_T>& af,
+                                      Timing::Progress *progress) const {
+
+    int updates = 0;
+
+    // opened here, since they count the thread that opens them (and so
+    // they would only see the wait for the helper of an isolated filter)
+    std::unique_ptr<PerfCounters> counters;
+    if (counters_ && !af.is_isolated())
+        counters.reset(new PerfCounters);
+    PerfCounters *pc = counters && counters->available() ? counters.get()
+                                                         : nullptr;
+
+    EchoQuality<SAMPLE_T> quality{echo_path_, input_->samplerate(),
+                                  static_cast<unsigned>(N), CHECK_INTERVAL};
+    quality.set_target_erle(target_erle_);
+    std::vector<SAMPLE_T> err(CHECK_INTERVAL);
+
+    // the helper process of an isolated filter can't be traced from here
+    AllocTrace trace;
+    AllocTrace *tr = af.is_isolated() ? nullptr : &trace;
+
+    auto pass = [this, &af, &updates, progress, pc, &quality, &err, tr](
+            Timing::Stopwatch& sw) {
+
+        if (tr)
+            tr->clear();
+        AllocTrace::Scope cold(tr, false);
+        af.initialize_data_structures();
+        try {
+
+            if (!initial_state_.empty())
+                af.load_state(initial_state_);
+
+            auto input_ptr = input_->array();
+            auto output_ptr = output_->array();
+
+            {
+                AllocTrace::Scope hot(tr, true);
+                for (int i = 0; i < prologue_; ++i)
+                    af.get_sample(*input_ptr++, *output_ptr++, learn);
+            }
+
+            input_ptr = input_->array();
+            output_ptr = output_->array();
+            af.reset_nup();
+            quality.start();
 
-    adapf_.initialize_data_structures();
+            // the stopwatch is paused while we look for a cancellation and
+            // measure the quality; the counters go around it, so their
+            // ioctl's aren't timed
+            for (int i = 0; i < N; ) {
+                int chunk_end = std::min(N, i + CHECK_INTERVAL);
+                auto chunk_first = output_ptr;
+                auto e = err.begin();
+                {
+                    AllocTrace::Scope hot(tr, true);
+                    if (pc)
+                        pc->start();
+                    sw.start();
+                    for (; i < chunk_end; ++i)
+                        *e++ = af.get_sample(*input_ptr++, *output_ptr++,
+                                             learn);
+                    sw.stop();
+                    if (pc)
+                        pc->stop();
+                }
+                const SAMPLE_T *w; unsigned nw;
+                af.get_impresp(&w, &nw);
+                quality.add_window(chunk_first, err.data(),
+                                   static_cast<unsigned>(e - err.begin()),
+                                   w, nw);
+                if (progress)
+                    progress->check();
+            }
+            updates = af.number_of_updates();
 
-    auto input_ptr = input_.array();
-    auto output_ptr = output_.array();
+            input_ptr = input_->array();
+            output_ptr = output_->array();
 
-    for (int i = 0; i < prologue_; ++i)
-        adapf_.get_sample(*input_ptr++, *output_ptr++, learn);
+            {
+                AllocTrace::Scope hot(tr, true);
+                for (int i = 0; i < epilogue_; ++i)
+                    af.get_sample(*input_ptr++, *output_ptr++, learn);
+            }
 
-    input_ptr = input_.array();
-    output_ptr = output_.array();
-    adapf_.reset_nup();
+        } catch (...) {
+            af.destroy_data_structures();
+            throw;
+        }
+        af.destroy_data_structures();
 
-    auto start_time = std::chrono::steady_clock::now();
-    for (int i = 0; i < N; ++i)
-        adapf_.get_sample(*input_ptr++, *output_ptr++, learn);
-    auto end_time = std::chrono::steady_clock::now();
+    };
 
-    input_ptr = input_.array();
-    output_ptr = output_.array();
+    Result result{harness_.run(pass, N, progress), updates, {}, "", {}, {}};
+    result.quality = quality.summary();
+    result.allocations = trace.report();
+    result.allocations.available = result.allocations.available && tr;
+    if (counters) {
+        // the harness' warmup pass was counted too
+        double calls = std::max(1.0,
+                (result.time_per_sample.repetitions + 1.0) * N);
+        result.counters_per_sample = counters->read().per(calls);
+        result.counters_error = counters->error();
+    }
+    else {
+        for (auto& v : result.counters_per_sample.value)
+            v = -1;
+        if (counters_)
+            result.counters_error = "Performance counters can't measure an"
+                                    " isolated filter.";
+    }
+    return result;
+
+}
 
-    for (int i = 0; i < epilogue_; ++i)
-        adapf_.get_sample(*input_ptr++, *output_ptr++, learn);
+template <typename SAMPLE_T>
+template <int learn>
+double AdapfBenchmarker<SAMPLE_T>::estimate_time(
+        AdaptiveFilter<SAMPLE_T>& af) const {
 
-    adapf_.destroy_data_structures();
+    if (N == 0)
+        return 0;
 
-    std::chrono::duration<double> total_time = end_time - start_time;
+    int n = 1;
+    std::chrono::duration<double> elapsed{0};
+
+    af.initialize_data_structures();
+    try {
+
+        if (!initial_state_.empty())
+            af.load_state(initial_state_);
+
+        for (; ; n = std::min(N, 2*n)) {
+            auto input_ptr = input_->array();
+            auto output_ptr = output_->array();
+            auto start_time = std::chrono::steady_clock::now();
+            for (int i = 0; i < n; ++i)
+                af.get_sample(*input_ptr++, *output_ptr++, learn);
+            elapsed = std::chrono::steady_clock::now() - start_time;
+            if (n == N || elapsed.count() >= CALIBRATION_TIME)
+                break;
+        }
+
+    } catch (...) {
+        af.destroy_data_structures();
+        throw;
+    }
+    af.destroy_data_structures();
 
-    return {total_time / double(N), adapf_.number_of_updates()};
+    double pass_time = elapsed.count() / n * (N + prologue_ + epilogue_);
+    return harness_.estimate(pass_time);
 
 }
 
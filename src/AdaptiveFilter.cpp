@@ -18,19 +18,27 @@
  * \author Pedro Angelo Medeiros Fonini
  */
 
+#include <cstdint>
+#include <cstring>
+
 #include <stdexcept>
+#include <fstream>
 #include <iostream>
 
 #include "AdaptiveFilter.h"
 
-#ifdef ATFA_LOG_MATLAB
 template <typename SAMPLE_T>
 SAMPLE_T AdaptiveFilter<SAMPLE_T>::placeholder = 0;
-#endif
 
+/**
+  * If `isolated` is true, the DSO is not loaded into this process; instead,
+  * an `IsolatedRunner` spawns a helper process that loads (and tests) it.
+  */
 template <typename SAMPLE_T>
-AdaptiveFilter<SAMPLE_T>::AdaptiveFilter(std::string dso_path)
-  : path(dso_path), data(nullptr), num_of_updates{}
+AdaptiveFilter<SAMPLE_T>::AdaptiveFilter(std::string dso_path, bool isolated)
+  : path(dso_path), save_state_fn(nullptr), load_state_fn(nullptr),
+    reentrant_fn(nullptr), data(nullptr), runner(nullptr), test_allocs(),
+    num_of_updates{}
 {
 
     dummy = dso_path.length()==0;
@@ -40,6 +48,18 @@ AdaptiveFilter<SAMPLE_T>::AdaptiveFilter(std::string dso_path)
         return;
     }
 
+    if (isolated) {
+        lib = nullptr;
+        try {
+            runner = new IsolatedRunner(path);
+        } catch (const IsolatedRunnerException& e) {
+            throw AdapfException(e.what(), path);
+        }
+        title_str = runner->title();
+        listing_str = runner->listing();
+        return;
+    }
+
     lib = dlopen(path.c_str(), RTLD_NOW);
     if (!lib)
         throw AdapfException(
@@ -52,12 +72,18 @@ AdaptiveFilter<SAMPLE_T>::AdaptiveFilter(std::string dso_path)
     close = api->close;
     run = api->run;
     restart = api->restart;
-#ifdef ATFA_LOG_MATLAB
     getw = api->getw;
-#endif
     title = api->title;
     listing = api->listing;
 
+    // optional; both must be present for checkpoints to be supported
+    save_state_fn = reinterpret_cast<adapf_save_state_t *>(
+                dlsym(lib, "adapf_save_state"));
+    load_state_fn = reinterpret_cast<adapf_load_state_t *>(
+                dlsym(lib, "adapf_load_state"));
+    reentrant_fn = reinterpret_cast<adapf_reentrant_t *>(
+                dlsym(lib, "adapf_reentrant"));
+
     test();
 
     title_str = (*title)();
@@ -70,20 +96,42 @@ AdaptiveFilter<SAMPLE_T>::~AdaptiveFilter()
 {
     if (dummy)
         return;
+    if (runner) {
+        if (data)
+            destroy_data_structures();
+        delete runner;
+        return;
+    }
+    if (data) // must be closed while the DSO is still loaded
+        destroy_data_structures();
     if (dlclose(lib) != 0)
         std::cerr << "[Adaptive Filter DSO] Warning: could not close dynamic "
                   << "shared object." << std::endl
                   << "[Adaptive Filter DSO] DSO path: " << path << std::endl
                   << "[Adaptive Filter DSO] DL error: " << dlerror()
                   << std::endl;
-    if (data)
-        destroy_data_structures();
 }
 
 template <typename SAMPLE_T>
 void AdaptiveFilter<SAMPLE_T>::initialize_data_structures() {
     if (dummy)
         return;
+    if (runner) {
+        try {
+            if (runner->failed()) { // start over with a fresh helper
+                IsolatedRunner *fresh = new IsolatedRunner(path);
+                delete runner;
+                runner = fresh;
+            }
+            runner->control(RunnerShm::OP_INIT);
+        } catch (const IsolatedRunnerException& e) {
+            throw AdapfException(e.what(), path);
+        }
+        // `data' is never dereferenced in isolated mode; it just marks the
+        // helper as holding initialized data structures
+        data = reinterpret_cast<AdapfData *>(runner);
+        return;
+    }
     data = (*init)();
     if (!data)
         throw AdapfException(
@@ -98,6 +146,17 @@ template <typename SAMPLE_T>
 void AdaptiveFilter<SAMPLE_T>::destroy_data_structures() {
     if (dummy)
         return;
+    if (runner) {
+        try {
+            runner->control(RunnerShm::OP_CLOSE);
+        } catch (const IsolatedRunnerException& e) {
+            std::cerr << "[Adaptive Filter] Warning: " << e.what()
+                      << std::endl
+                      << "[Adaptive Filter] DSO path: " << path << std::endl;
+        }
+        data = nullptr;
+        return;
+    }
     if (!(*close)(data))
         std::cerr << "[Adaptive Filter] Warning: could not close adaptive "
                   << "filter data structures." << std::endl
@@ -105,32 +164,220 @@ void AdaptiveFilter<SAMPLE_T>::destroy_data_structures() {
     data = nullptr;
 }
 
+/**
+  * Also traces the allocations and locks made by the DSO (see `AllocTrace`),
+  * and warns if `adapf_run` makes any, since it then can't be trusted in the
+  * audio callback.
+  */
 template <typename SAMPLE_T>
 void AdaptiveFilter<SAMPLE_T>::test() {
-    if (dummy)
+    if (dummy || runner) // the helper process tests the DSO when it starts
         return;
-    AdapfData *dat = (*init)();
+    AllocTrace trace;
+    AdapfData *dat;
+    {
+        AllocTrace::Scope cold(&trace, false);
+        dat = (*init)();
+    }
     if (!dat)
         throw AdapfException(
                 "Could not initialize adaptive filter data structures,"
                 " during testing",
                 path, dlerror());
     int placeholder;
-    (*run)(dat, SAMPLE_T(0.1), SAMPLE_T(0.2), 0, &placeholder);
-    (*run)(dat, SAMPLE_T(0.3), SAMPLE_T(0.4), 0, &placeholder);
-    (*run)(dat, SAMPLE_T(0.5), SAMPLE_T(0.6), 1, &placeholder);
-    dat = (*restart)(dat);
+    {
+        AllocTrace::Scope hot(&trace, true);
+        (*run)(dat, SAMPLE_T(0.1), SAMPLE_T(0.2), 0, &placeholder);
+        (*run)(dat, SAMPLE_T(0.3), SAMPLE_T(0.4), 0, &placeholder);
+        (*run)(dat, SAMPLE_T(0.5), SAMPLE_T(0.6), 1, &placeholder);
+    }
+    {
+        AllocTrace::Scope cold(&trace, false);
+        dat = (*restart)(dat);
+    }
     if (!dat)
         throw AdapfException(
                 "Could not restart adaptive filter data structures"
                 " during testing",
                 path, dlerror());
-    (*run)(dat, SAMPLE_T(0.7), SAMPLE_T(0.8), 1, &placeholder);
-    if (!(*close)(dat))
+    {
+        AllocTrace::Scope hot(&trace, true);
+        (*run)(dat, SAMPLE_T(0.7), SAMPLE_T(0.8), 1, &placeholder);
+    }
+    test_allocs = trace.report(); // before close() frees the data
+    int closed;
+    {
+        AllocTrace::Scope cold(&trace, false);
+        closed = (*close)(dat);
+    }
+    if (!closed)
         throw AdapfException(
                 "Error while closing adaptive filter data structures"
                 " during testing",
                 path, dlerror());
+    if (!is_realtime_safe())
+        std::cerr << "[Adaptive Filter DSO] Warning: adapf_run is not"
+                  << " real-time safe; during testing, it made "
+                  << test_allocs.count[AllocTrace::Alloc] << " allocations, "
+                  << test_allocs.count[AllocTrace::Free] << " frees and "
+                  << test_allocs.count[AllocTrace::Lock] << " locks."
+                  << std::endl
+                  << "[Adaptive Filter DSO] DSO path: " << path << std::endl;
+}
+
+/* STATE CHECKPOINTS */
+
+template <typename SAMPLE_T>
+bool AdaptiveFilter<SAMPLE_T>::has_state_io() const {
+    if (runner)
+        return runner->has_state_io();
+    return save_state_fn && load_state_fn;
+}
+
+template <typename SAMPLE_T>
+bool AdaptiveFilter<SAMPLE_T>::is_reentrant() const {
+    if (dummy || runner)
+        return true;
+    return reentrant_fn && (*reentrant_fn)();
+}
+
+/**
+  * \throws AdapfException if the DSO does not support checkpoints, or if the
+  *         data structures have not been initialized.
+  */
+template <typename SAMPLE_T>
+typename AdaptiveFilter<SAMPLE_T>::state_t
+AdaptiveFilter<SAMPLE_T>::save_state() const {
+    if (!has_state_io())
+        throw AdapfException("Adaptive filter does not support saving its"
+                             " state", path);
+    if (!data)
+        throw AdapfException("Adaptive filter data structures are not"
+                             " initialized", path);
+    if (runner) {
+        try {
+            return runner->save_state();
+        } catch (const IsolatedRunnerException& e) {
+            throw AdapfException(e.what(), path);
+        }
+    }
+    state_t state((*save_state_fn)(data, nullptr, 0));
+    if ((*save_state_fn)(data, state.data(), state.size()) != state.size())
+        throw AdapfException("Adaptive filter state changed size while being"
+                             " saved", path);
+    return state;
+}
+
+/**
+  * Must be called after `initialize_data_structures()`.
+  *
+  * \throws AdapfException if the DSO does not support checkpoints, or if it
+  *         rejects the state.
+  */
+template <typename SAMPLE_T>
+void AdaptiveFilter<SAMPLE_T>::load_state(const state_t& state) {
+    if (!has_state_io())
+        throw AdapfException("Adaptive filter does not support loading a"
+                             " saved state", path);
+    if (!data)
+        throw AdapfException("Adaptive filter data structures are not"
+                             " initialized", path);
+    if (runner) {
+        try {
+            runner->load_state(state);
+        } catch (const IsolatedRunnerException& e) {
+            throw AdapfException(e.what(), path);
+        }
+        return;
+    }
+    if (!(*load_state_fn)(data, state.data(), state.size()))
+        throw AdapfException("Adaptive filter rejected the saved state", path);
+}
+
+namespace {
+const char state_magic[8] = {'A','T','F','A','F','S','T','A'};
+constexpr uint32_t STATE_FILE_VERSION = 1;
+}
+
+/**
+  * The file starts with a 32-byte header:
+  *
+  *     char     magic[8];     // "ATFAFSTA"
+  *     uint32_t version;      // 1
+  *     uint32_t sample_size;  // sizeof(SAMPLE_T)
+  *     uint32_t title_size;   // length of the DSO title
+  *     uint32_t reserved;     // always zero
+  *     uint64_t state_size;
+  *
+  * which is followed by the title of the DSO (without the terminating null
+  * character) and then by the state itself. The title is used by
+  * `read_state_file()` to refuse states saved by a different filter.
+  *
+  * \throws AdapfException if the file cannot be written.
+  */
+template <typename SAMPLE_T>
+void AdaptiveFilter<SAMPLE_T>::write_state_file(const std::string& filename,
+                                                const state_t& state) const {
+    uint32_t fields[4] = {STATE_FILE_VERSION, sizeof(SAMPLE_T),
+                          static_cast<uint32_t>(title_str.size()), 0};
+    uint64_t state_size = state.size();
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    file.write(state_magic, sizeof state_magic);
+    file.write(reinterpret_cast<const char *>(fields), sizeof fields);
+    file.write(reinterpret_cast<const char *>(&state_size), sizeof state_size);
+    file.write(title_str.data(),
+               static_cast<std::streamsize>(title_str.size()));
+    file.write(state.data(), static_cast<std::streamsize>(state.size()));
+    file.close();
+    if (!file)
+        throw AdapfException("Could not write filter state to " + filename,
+                             path);
+}
+
+/**
+  * The sizes in the header are checked against the size of the file (and, in
+  * isolated mode, against the most the helper process can take) before
+  * anything is allocated, so that a corrupt file is just refused.
+  *
+  * \throws AdapfException if the file cannot be read, if it is not a state
+  *         file, or if it was saved by a different filter.
+  */
+template <typename SAMPLE_T>
+typename AdaptiveFilter<SAMPLE_T>::state_t
+AdaptiveFilter<SAMPLE_T>::read_state_file(const std::string& filename) const {
+    std::ifstream file(filename, std::ios::binary);
+    char magic[sizeof state_magic];
+    uint32_t fields[4];
+    uint64_t state_size;
+    file.read(magic, sizeof magic);
+    file.read(reinterpret_cast<char *>(fields), sizeof fields);
+    file.read(reinterpret_cast<char *>(&state_size), sizeof state_size);
+    if (!file || std::memcmp(magic, state_magic, sizeof magic) != 0
+              || fields[0] != STATE_FILE_VERSION)
+        throw AdapfException(filename + " is not a filter state file", path);
+    if (fields[1] != sizeof(SAMPLE_T))
+        throw AdapfException(filename + " was saved with a different sample"
+                             " type", path);
+    auto header_end = file.tellg();
+    file.seekg(0, std::ios::end);
+    auto left = static_cast<uint64_t>(file.tellg() - header_end);
+    file.seekg(header_end);
+    if (!file || fields[2] > left || state_size > left - fields[2])
+        throw AdapfException(filename + " is truncated or corrupt", path);
+    if (runner && state_size > RunnerShm::MAX_STATE)
+        throw AdapfException(filename + " holds a state too large for the"
+                             " isolated filter", path);
+    std::string file_title(fields[2], '\0');
+    file.read(&file_title[0], static_cast<std::streamsize>(file_title.size()));
+    if (file_title != title_str)
+        throw AdapfException(filename + " was saved by a different adaptive"
+                             " filter (" + file_title + ")", path);
+    state_t state(state_size);
+    file.read(state.data(), static_cast<std::streamsize>(state.size()));
+    if (!file)
+        throw AdapfException("Could not read filter state from " + filename,
+                             path);
+    return state;
 }
 
 /* DUMMY (NO OP) FILTER */
@@ -142,7 +389,6 @@ AdapfData *dummy_restart(AdapfData *) { return nullptr; }
 template <typename SAMPLE_T>
 SAMPLE_T dummy_run(AdapfData *, SAMPLE_T, SAMPLE_T y, int, int* updated)
 { *updated = 0; return y; }
-#ifdef ATFA_LOG_MATLAB
 template <typename SAMPLE_T>
 void dummy_getw(const AdapfData *, const SAMPLE_T **begin, unsigned *n) {
     // *begin will be used as source in a call to std::memcpy.
@@ -154,7 +400,6 @@ void dummy_getw(const AdapfData *, const SAMPLE_T **begin, unsigned *n) {
     *begin = &AdaptiveFilter<SAMPLE_T>::placeholder;
     *n = 0;
 }
-#endif
 
 template <typename SAMPLE_T>
 void AdaptiveFilter<SAMPLE_T>::make_dummy() {
@@ -163,14 +408,14 @@ void AdaptiveFilter<SAMPLE_T>::make_dummy() {
     close = &dummy_close;
     run = &dummy_run<SAMPLE_T>;
     restart = &dummy_restart;
-#ifdef ATFA_LOG_MATLAB
     getw = &dummy_getw<SAMPLE_T>;
-#endif
 }
 
 template <typename SAMPLE_T>
 AdaptiveFilter<SAMPLE_T>::AdaptiveFilter()
-  : dummy(true), path(""), data(nullptr), num_of_updates{}
+  : dummy(true), path(""), save_state_fn(nullptr), load_state_fn(nullptr),
+    reentrant_fn(nullptr), data(nullptr), runner(nullptr), test_allocs(),
+    num_of_updates{}
 {
     make_dummy();
 }
@@ -23,39 +23,162 @@ extern "C" {
 #include <dlfcn.h>
 }
 
+#include <cstddef>
+
 #include <string>
 #include <sstream>
 #include <stdexcept>
+#include <vector>
 
 #include "atfa_api.h"
 
+extern "C" {
+/// Optional DSO entry point for checkpointing the filter state
+/**
+  * This and `adapf_load_state_t` are not part of `ATFA_API_table_t`. A DSO
+  * that supports checkpoints exports functions named `adapf_save_state` and
+  * `adapf_load_state`, which are looked up with `dlsym`.
+  *
+  * Writes the state of `data` to `buf` if `size` is large enough, and returns
+  * the number of bytes needed. So, `adapf_save_state(data, NULL, 0)` just
+  * returns the size of the state. The format of the state is up to the DSO.
+  */
+typedef size_t (adapf_save_state_t)(const AdapfData *data,
+                                    void *buf, size_t size);
+/// Restores a state saved by `adapf_save_state`. Returns 0 on failure.
+typedef int (adapf_load_state_t)(AdapfData *data,
+                                 const void *buf, size_t size);
+/// Optional DSO entry point, looked up as `adapf_reentrant`
+/**
+  * Returns nonzero if the DSO keeps no state outside of its `AdapfData`, so
+  * that many instances, each created by its own `init` call, may run at the
+  * same time in different threads.
+  */
+typedef int (adapf_reentrant_t)(void);
+}
+
+#include "AllocTrace.h"
+#include "IsolatedRunner.h"
+
 template <typename SAMPLE_T>
 class AdaptiveFilter
 {
 
 public:
 
-    AdaptiveFilter(std::string dso_path);
+    AdaptiveFilter(std::string dso_path, bool isolated = false);
     AdaptiveFilter();
     ~AdaptiveFilter();
 
     void test();
 
+    /// The allocations and locks made by the DSO during `test()`
+    /**
+      * Not available (see `AllocTrace::Report::available`) for the dummy
+      * filter, in isolated mode, or if ATFA wasn't built with
+      * `ATFA_ALLOC_TRACE`.
+      */
+    const AllocTrace::Report& test_allocations() const {
+        return test_allocs;
+    }
+
+    /// Whether `adapf_run` made no allocations nor locks during `test()`;
+    /// true if that is unknown
+    bool is_realtime_safe() const {
+        return !test_allocs.available || test_allocs.realtime_safe();
+    }
+
     void initialize_data_structures();
     void destroy_data_structures();
 
+    /// An opaque snapshot of the filter state (see `adapf_save_state_t`)
+    typedef std::vector<char> state_t;
+
+    /// Whether the DSO exports `adapf_save_state` and `adapf_load_state`.
+    bool has_state_io() const;
+
+    /// Whether another `AdaptiveFilter` of the same DSO may run concurrently
+    /**
+      * True if the DSO says so (see `adapf_reentrant_t`), and also in
+      * isolated mode, where each instance has its own helper process.
+      */
+    bool is_reentrant() const;
+
+    state_t save_state() const;
+    void load_state(const state_t& state);
+
+    /// Writes a state to a file, tagged with the title of this filter.
+    void write_state_file(const std::string& filename,
+                          const state_t& state) const;
+    /// Reads a state written by `write_state_file()`.
+    state_t read_state_file(const std::string& filename) const;
+
+    void save_state_file(const std::string& filename) const {
+        write_state_file(filename, save_state());
+    }
+    void load_state_file(const std::string& filename) {
+        load_state(read_state_file(filename));
+    }
+
     SAMPLE_T get_sample(SAMPLE_T x, SAMPLE_T y, int learn) {
+        if (runner) {
+            SAMPLE_T err;
+            run_block(&x, &y, &learn, &err, 1);
+            return err;
+        }
         int updated;
         SAMPLE_T err = (*run)(data, x, y, learn, &updated);
         num_of_updates += (updated ? 1 : 0);
         return err;
     }
 
-#ifdef ATFA_LOG_MATLAB
+    /// Filters `n` samples at once.
+    /**
+      * Same as calling `get_sample()` `n` times, but in isolated mode the
+      * whole block costs a single round trip to the helper process.
+      */
+    void run_block(const SAMPLE_T *x, const SAMPLE_T *y, const int *learn,
+                   SAMPLE_T *e, unsigned n) {
+        if (runner) {
+            int updates;
+            runner->run(x, y, learn, e, n, &updates);
+            num_of_updates += updates;
+            return;
+        }
+        for (unsigned i = 0; i != n; ++i)
+            e[i] = get_sample(x[i], y[i], learn[i]);
+    }
+
     void get_impresp(const SAMPLE_T **begin, unsigned *n) {
-        (*getw)(data, begin, n);
+        if (runner)
+            *begin = runner->coefficients(n);
+        else
+            (*getw)(data, begin, n);
+    }
+
+    /// Whether the DSO runs inside a helper process (see `IsolatedRunner`).
+    bool is_isolated() const {
+        return runner != nullptr;
+    }
+
+    /// Whether the helper process has stalled or crashed.
+    bool helper_failed() const {
+        return runner && runner->failed();
+    }
+
+    /// Tells the helper process that `run_block()` is now called in real
+    /// time, at this sample rate (or not anymore, if zero); see
+    /// `IsolatedRunner::set_realtime()`
+    void set_realtime(int samplerate) {
+        if (runner)
+            runner->set_realtime(samplerate);
+    }
+
+    /// Brings back a helper process that was late in real time; true if it
+    /// had to be restarted (see `IsolatedRunner::recover()`)
+    bool recover_helper() {
+        return runner && runner->recover();
     }
-#endif
 
     bool is_dummy() const {
         return dummy;
@@ -76,7 +199,10 @@ public:
     static SAMPLE_T placeholder;
 
     void reset_state() {
-        data = (*restart)(data);
+        if (runner)
+            runner->request_restart();
+        else
+            data = (*restart)(data);
     }
 
     int number_of_updates() const { return num_of_updates; }
@@ -103,14 +229,20 @@ private:
     adapf_restart_t *restart;
     adapf_close_t *close;
     adapf_run_t *run;
-#ifdef ATFA_LOG_MATLAB
     adapf_getw_t *getw;
-#endif
     adapf_title_t *title;
     adapf_listing_t *listing;
 
+    adapf_save_state_t *save_state_fn; // these two may be null
+    adapf_load_state_t *load_state_fn;
+    adapf_reentrant_t *reentrant_fn; // may be null
+
     AdapfData *data;
 
+    IsolatedRunner *runner;
+
+    AllocTrace::Report test_allocs;
+
     void make_dummy();
 
     int num_of_updates;
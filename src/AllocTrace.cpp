@@ -0,0 +1,215 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file AllocTrace.cpp
+ *
+ * Holds the `AllocTrace` class and, if ATFA is built with
+ * `ATFA_ALLOC_TRACE`, the allocation and locking functions that replace the
+ * C library's ones.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#ifdef ATFA_ALLOC_TRACE
+#   include <atomic>
+#   include <cerrno>
+extern "C" {
+#   include <dlfcn.h>
+#   include <malloc.h>
+#   include <pthread.h>
+
+// the C library's own allocator (glibc)
+void *__libc_malloc(size_t size);
+void __libc_free(void *ptr);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+}
+#endif
+
+#include "AllocTrace.h"
+
+namespace {
+// the trace of the calling thread, if a Scope is active; these are
+// constant-initialized, so reading them never allocates
+thread_local AllocTrace *current_trace = nullptr;
+thread_local bool current_hot = false;
+}
+
+const char *AllocTrace::name(Kind k) {
+    switch (k) {
+    case Alloc: return "Allocations";
+    case Free:  return "Frees";
+    case Lock:  return "Locks";
+    default:    return "";
+    }
+}
+
+bool AllocTrace::available() {
+#ifdef ATFA_ALLOC_TRACE
+    return true;
+#else
+    return false;
+#endif
+}
+
+void AllocTrace::clear() {
+    for (auto& c : count)
+        c = 0;
+    num_events = 0;
+    live = peak = 0;
+    start = clock::now();
+}
+
+AllocTrace::Report AllocTrace::report() const {
+    Report r;
+    r.available = available();
+    for (int k = 0; k != NUM_KINDS; ++k)
+        r.count[k] = count[k];
+    r.events.assign(events, events + num_events);
+    r.peak_bytes = peak;
+    r.live_bytes = live;
+    return r;
+}
+
+/**
+  * The heap bytes are net: freeing memory allocated before the scope (or
+  * before `clear()`) makes them go down.
+  */
+void AllocTrace::record(Kind k, std::ptrdiff_t bytes, bool hot) {
+    live += bytes;
+    if (live > peak)
+        peak = live;
+    if (!hot)
+        return;
+    ++count[k];
+    if (num_events != MAX_EVENTS)
+        events[num_events++] = Event{
+                k, std::chrono::duration<double>(clock::now() - start).count(),
+                bytes};
+}
+
+AllocTrace::Scope::Scope(AllocTrace *trace, bool hot)
+  : prev_trace(current_trace), prev_hot(current_hot)
+{
+    current_trace = trace;
+    current_hot = hot;
+}
+
+AllocTrace::Scope::~Scope() {
+    current_trace = prev_trace;
+    current_hot = prev_hot;
+}
+
+#ifdef ATFA_ALLOC_TRACE
+
+namespace {
+
+thread_local bool in_record = false; // clock::now() must not recurse
+
+inline void note(AllocTrace::Kind k, std::ptrdiff_t bytes) {
+    if (!current_trace || in_record)
+        return;
+    in_record = true;
+    current_trace->record(k, bytes, current_hot);
+    in_record = false;
+}
+
+inline std::ptrdiff_t usable(void *ptr) {
+    return ptr ? static_cast<std::ptrdiff_t>(malloc_usable_size(ptr)) : 0;
+}
+
+typedef int (mutex_lock_t)(pthread_mutex_t *);
+
+// not a function-local static: its guard would lock a mutex
+std::atomic<mutex_lock_t *> real_mutex_lock{nullptr};
+
+mutex_lock_t *resolve_mutex_lock() {
+    auto fn = real_mutex_lock.load(std::memory_order_acquire);
+    if (!fn) {
+        fn = reinterpret_cast<mutex_lock_t *>(
+                    dlsym(RTLD_NEXT, "pthread_mutex_lock"));
+        real_mutex_lock.store(fn, std::memory_order_release);
+    }
+    return fn;
+}
+
+__attribute__((constructor)) void init_alloc_trace() {
+    resolve_mutex_lock();
+}
+
+}
+
+extern "C" {
+
+void *malloc(size_t size) noexcept {
+    void *ptr = __libc_malloc(size);
+    if (current_trace)
+        note(AllocTrace::Alloc, usable(ptr));
+    return ptr;
+}
+
+void free(void *ptr) noexcept {
+    if (ptr && current_trace)
+        note(AllocTrace::Free, -usable(ptr));
+    __libc_free(ptr);
+}
+
+void *calloc(size_t n, size_t size) noexcept {
+    void *ptr = __libc_calloc(n, size);
+    if (current_trace)
+        note(AllocTrace::Alloc, usable(ptr));
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size) noexcept {
+    std::ptrdiff_t before = current_trace ? usable(ptr) : 0;
+    void *new_ptr = __libc_realloc(ptr, size);
+    if (current_trace) {
+        if (size == 0 && ptr)
+            note(AllocTrace::Free, -before);
+        else
+            note(AllocTrace::Alloc, usable(new_ptr) - before);
+    }
+    return new_ptr;
+}
+
+void *memalign(size_t alignment, size_t size) noexcept {
+    void *ptr = __libc_memalign(alignment, size);
+    if (current_trace)
+        note(AllocTrace::Alloc, usable(ptr));
+    return ptr;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) noexcept {
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) noexcept {
+    if (alignment % sizeof(void *) != 0 ||
+            (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+    void *ptr = memalign(alignment, size);
+    if (!ptr)
+        return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex) noexcept {
+    if (current_trace)
+        note(AllocTrace::Lock, 0);
+    return (*resolve_mutex_lock())(mutex);
+}
+
+}
+
+#endif // ATFA_ALLOC_TRACE
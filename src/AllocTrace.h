@@ -0,0 +1,118 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file AllocTrace.h
+ *
+ * Holds the interface to the `AllocTrace` class.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#ifndef ALLOCTRACE_H
+#define ALLOCTRACE_H
+
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+/// Heap allocations and lock acquisitions made by an adaptive filter DSO
+/**
+  * When ATFA is built with `ATFA_ALLOC_TRACE`, the executable defines its
+  * own `malloc`, `free`, `calloc`, `realloc`, the aligned allocators and
+  * `pthread_mutex_lock`, which forward to the C library. DSOs loaded with
+  * `dlopen` resolve those symbols to the executable's, so every call they
+  * make goes through here. (Code compiled into the executable does too, but
+  * it is only recorded while a `Scope` is active in the calling thread.)
+  *
+  * Calls made inside a "hot" scope, i.e. from within `adapf_run`, are
+  * counted and the first `MAX_EVENTS` of them are timestamped: any of them
+  * may block the audio callback, so a DSO that makes them is not real-time
+  * safe. Calls inside any scope (hot or not, e.g. `adapf_init`) also track
+  * the heap bytes held by the filter, whose peak is the footprint of the
+  * `AdapfData` instance.
+  *
+  * Nothing is allocated by the tracing itself, and the counters belong to
+  * one thread at a time, so they need no locks.
+  */
+class AllocTrace
+{
+
+public:
+
+    enum Kind { Alloc, Free, Lock, NUM_KINDS };
+
+    static const char *name(Kind k);
+
+    constexpr static unsigned MAX_EVENTS = 32;
+
+    struct Event {
+        Kind kind;
+        double time;       ///< seconds since `clear()`
+        std::ptrdiff_t bytes; ///< negative for frees; zero for locks
+    };
+
+    struct Report {
+        bool available;                   ///< whether the hooks are built in
+        unsigned long count[NUM_KINDS];   ///< from within `adapf_run`
+        std::vector<Event> events;        ///< the first of those
+        long peak_bytes;                  ///< heap held by the filter
+        long live_bytes;                  ///< when the report was made
+        /// Whether `adapf_run` neither allocated, freed nor locked
+        bool realtime_safe() const {
+            return count[Alloc] == 0 && count[Free] == 0 && count[Lock] == 0;
+        }
+    };
+
+    /// Whether the interposed functions were built into this executable
+    static bool available();
+
+    AllocTrace() { clear(); }
+
+    AllocTrace(const AllocTrace&) = delete;
+    AllocTrace& operator=(const AllocTrace&) = delete;
+
+    /// Forgets everything recorded so far
+    void clear();
+
+    Report report() const;
+
+    /// While alive, the calls of the constructing thread are recorded in
+    /// `trace` (if not null), as coming from within `adapf_run` if `hot`
+    /**
+      * Scopes nest: the outer one is active again when the inner one dies.
+      */
+    class Scope {
+    public:
+        Scope(AllocTrace *trace, bool hot);
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    private:
+        AllocTrace *prev_trace;
+        bool prev_hot;
+    };
+
+    /// Called by the interposed functions
+    void record(Kind k, std::ptrdiff_t bytes, bool hot);
+
+private:
+
+    typedef std::chrono::steady_clock clock;
+
+    unsigned long count[NUM_KINDS];
+    Event events[MAX_EVENTS];
+    unsigned num_events;
+    long live, peak;
+    clock::time_point start;
+
+};
+
+#endif // ALLOCTRACE_H
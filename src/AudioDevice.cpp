@@ -0,0 +1,141 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file AudioDevice.cpp
+ *
+ * Holds the PortAudio and loopback implementations of `AudioDevice`.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#include <cmath>
+
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "AudioDevice.h"
+#include "utils.h"
+
+/* PortAudioDevice */
+
+PortAudioDevice::~PortAudioDevice() {
+    try {
+        stop();
+    } catch (const std::exception& e) {
+        std::cerr << "[Audio Device] Warning: " << e.what() << std::endl;
+    }
+}
+
+int PortAudioDevice::pa_callback(const void *in_buf, void *out_buf,
+                                 unsigned long frames,
+                                 const PaStreamCallbackTimeInfo *time_info,
+                                 PaStreamCallbackFlags status_flags,
+                                 void *user_data) {
+    (void) time_info;
+    (void) status_flags;
+    PortAudioDevice *dev = static_cast<PortAudioDevice *>(user_data);
+    return dev->callback(static_cast<const float *>(in_buf),
+                         static_cast<float *>(out_buf), frames) ?
+                paContinue : paComplete;
+}
+
+/**
+  * Opens the stream with the same parameters as `Stream::echo()`, so that
+  * the audio goes through the same path.
+  */
+void PortAudioDevice::start(Callback cb) {
+    stop();
+    callback = cb;
+    try {
+        portaudio_init();
+    } catch (const std::runtime_error& e) {
+        throw AudioDeviceException(e.what());
+    }
+    PaError err = Pa_OpenDefaultStream(
+                &stream,
+                1,  // num. input channels
+                1,  // num. output channels
+                paFloat32,
+                srate,
+                paFramesPerBufferUnspecified,
+                &pa_callback,
+                this
+    );
+    if (err == paNoError) {
+        err = Pa_StartStream(stream);
+        if (err != paNoError)
+            Pa_CloseStream(stream);
+    }
+    if (err != paNoError) {
+        stream = nullptr;
+        portaudio_end();
+        throw AudioDeviceException(
+                    std::string("Error opening stream for audio I/O: ") +
+                    Pa_GetErrorText(err));
+    }
+}
+
+void PortAudioDevice::stop() {
+    if (!stream)
+        return;
+    PaError err = Pa_StopStream(stream);
+    if (err == paNoError)
+        err = Pa_CloseStream(stream);
+    stream = nullptr;
+    try {
+        portaudio_end();
+    } catch (const std::runtime_error& e) {
+        throw AudioDeviceException(e.what());
+    }
+    if (err != paNoError)
+        throw AudioDeviceException(
+                    std::string("Error closing stream for audio I/O: ") +
+                    Pa_GetErrorText(err));
+}
+
+/* LoopbackDevice */
+
+void LoopbackDevice::start(Callback cb) {
+    stop();
+    running = true;
+    worker = std::thread(&LoopbackDevice::run, this, cb);
+}
+
+void LoopbackDevice::stop() {
+    running = false;
+    if (worker.joinable())
+        worker.join();
+}
+
+/**
+  * The wire is a ring buffer of `delay` samples: each callback reads its
+  * input from the oldest ones, and writes its output over them.
+  */
+void LoopbackDevice::run(Callback cb) {
+    std::vector<float> wire(delay_);
+    std::vector<float> in(frames_), out(frames_);
+    std::mt19937 rng;
+    std::normal_distribution<float> gauss{
+        0, static_cast<float>(std::pow(10, noise_db_/20))};
+    size_t pos = 0; // oldest sample in the wire
+    while (running) {
+        for (unsigned long i = 0; i != frames_; ++i)
+            in[i] = static_cast<float>(gain_) * wire[(pos + i) % delay_] +
+                    gauss(rng);
+        bool keep_going = cb(in.data(), out.data(), frames_);
+        for (unsigned long i = 0; i != frames_; ++i)
+            wire[(pos + i) % delay_] = out[i];
+        pos = (pos + frames_) % delay_;
+        if (!keep_going)
+            break;
+    }
+}
@@ -0,0 +1,138 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file AudioDevice.h
+ *
+ * Holds the `AudioDevice` interface, and its PortAudio and loopback
+ * implementations.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#ifndef AUDIODEVICE_H
+#define AUDIODEVICE_H
+
+#include <atomic>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <portaudio.h>
+
+/// Full-duplex, mono, `float` audio I/O
+/**
+  * Once started, the device calls the callback over and over, each time
+  * with a buffer of input samples and a buffer to be filled with the same
+  * number of output samples, until the callback returns false or `stop()`
+  * is called. The callback runs in a thread of the device.
+  */
+class AudioDevice
+{
+public:
+
+    typedef std::function<bool(const float *in, float *out,
+                               unsigned long frames)> Callback;
+
+    virtual ~AudioDevice() {}
+
+    virtual int samplerate() const = 0;
+
+    /// \throws AudioDeviceException if the device can't be started.
+    virtual void start(Callback cb) = 0;
+
+    /// Stops the callbacks (if they're still running) and releases the
+    /// device; it may be started again afterwards.
+    virtual void stop() = 0;
+
+};
+
+class AudioDeviceException : public std::runtime_error {
+public:
+    AudioDeviceException(const std::string& desc)
+        : runtime_error(std::string("Audio device error: ") + desc) {}
+};
+
+/// The default PortAudio input and output, as opened by `Stream::echo()`
+class PortAudioDevice : public AudioDevice
+{
+public:
+
+    explicit PortAudioDevice(int samplerate) : srate(samplerate),
+                                               stream(nullptr) {}
+    ~PortAudioDevice();
+
+    int samplerate() const override { return srate; }
+    void start(Callback cb) override;
+    void stop() override;
+
+private:
+
+    static int pa_callback(const void *in_buf, void *out_buf,
+                           unsigned long frames,
+                           const PaStreamCallbackTimeInfo *time_info,
+                           PaStreamCallbackFlags status_flags,
+                           void *user_data);
+
+    int srate;
+    PaStream *stream;
+    Callback callback;
+
+};
+
+/// A stand-in for a sound card whose output is wired to its input
+/**
+  * What the callback writes comes back to it, `delay` samples later,
+  * multiplied by `gain` and with white noise of `noise_db` dBFS added. So
+  * the round-trip latency of the device is known exactly, which is useful
+  * to check code that measures it (see `LatencyCalibrator`).
+  *
+  * The callbacks are made by a thread of the device, as fast as it can.
+  * Like on a real device, the output of a callback can't come back in that
+  * same callback, so the delay must be at least one buffer (`frames`).
+  */
+class LoopbackDevice : public AudioDevice
+{
+public:
+
+    constexpr static unsigned long DEFAULT_FRAMES = 256;
+
+    LoopbackDevice(int samplerate, unsigned long delay,
+                   double gain = 1, double noise_db = -200,
+                   unsigned long frames = DEFAULT_FRAMES)
+        : srate(samplerate), delay_(delay), gain_(gain), noise_db_(noise_db),
+          frames_(frames), running(false)
+    {
+        if (frames_ == 0 || delay_ < frames_)
+            throw AudioDeviceException("The loopback delay must be at least"
+                                       " one buffer.");
+    }
+    ~LoopbackDevice() { stop(); }
+
+    int samplerate() const override { return srate; }
+    unsigned long delay() const { return delay_; }
+    void start(Callback cb) override;
+    void stop() override;
+
+private:
+
+    void run(Callback cb);
+
+    int srate;
+    unsigned long delay_;
+    double gain_, noise_db_;
+    unsigned long frames_;
+    std::atomic<bool> running;
+    std::thread worker;
+
+};
+
+#endif // AUDIODEVICE_H
@@ -0,0 +1,138 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file CoefTrace.cpp
+ *
+ * Holds the implementation of the `CoefTrace` class.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#include <chrono>
+#include <iostream>
+
+#include "CoefTrace.h"
+
+void CoefTrace::configure(const std::string& filename, unsigned decimation,
+                          unsigned taps, unsigned ring_snapshots) {
+    if (writing)
+        throw CoefTraceException("cannot reconfigure a running trace.");
+    if (ring_snapshots < 2)
+        throw CoefTraceException("the ring must hold at least 2 snapshots.");
+    filename_ = filename;
+    decimation_ = decimation;
+    taps_ = taps;
+    ring_snapshots_ = ring_snapshots;
+}
+
+/**
+  * Called from `Stream::echo()`, before the audio stream starts. This is the
+  * only place where memory for the snapshots is allocated.
+  *
+  * If the trace is not `enabled()`, does nothing, and `tick()` will always
+  * return `false`.
+  *
+  * \param[in]  samplerate  Written to the file header.
+  *
+  * \throws CoefTraceException if the output file cannot be opened.
+  */
+void CoefTrace::start(unsigned samplerate) {
+    if (writing || !enabled())
+        return;
+    ring.assign(size_t(ring_snapshots_) * taps_, 0);
+    ring_index.assign(ring_snapshots_, 0);
+    ring_n.assign(ring_snapshots_, 0);
+    head = 0;
+    tail = 0;
+    dropped = 0;
+    snapshot_count = 0;
+    file = std::fopen(filename_.c_str(), "wb");
+    if (!file)
+        throw CoefTraceException("could not open " + filename_ + ".");
+    write_header(static_cast<uint32_t>(samplerate));
+    writing = true;
+    writer = std::thread(&CoefTrace::writer_loop, this);
+    countdown = decimation_;
+}
+
+/**
+  * Called from `Stream::stop()`, after the audio stream has stopped. Writes
+  * whatever is left in the ring, updates the number of dropped snapshots in
+  * the header, and closes the file.
+  */
+void CoefTrace::stop() {
+    countdown = 0;
+    if (!writing)
+        return;
+    {
+        std::lock_guard<std::mutex> lk(writer_mutex);
+        writing = false;
+    }
+    writer_cv.notify_one();
+    writer.join();
+    drain();
+    uint64_t drop_count = dropped.load();
+    if (std::fseek(file, 24, SEEK_SET) == 0)
+        std::fwrite(&drop_count, sizeof drop_count, 1, file);
+    if (std::fclose(file) != 0)
+        std::cerr << "[Coefficient trace] Warning: error while closing "
+                  << filename_ << std::endl;
+    file = nullptr;
+    if (drop_count)
+        std::cerr << "[Coefficient trace] Warning: " << drop_count
+                  << " snapshots were dropped (writer too slow)." << std::endl;
+    // give the memory back; the next start() allocates it again
+    std::vector<sample_t>().swap(ring);
+    std::vector<uint64_t>().swap(ring_index);
+    std::vector<uint32_t>().swap(ring_n);
+}
+
+void CoefTrace::write_header(uint32_t samplerate) {
+    const char magic[8] = {'A','T','F','A','W','T','R','C'};
+    uint32_t fields[4] = {FILE_VERSION, samplerate,
+                          static_cast<uint32_t>(decimation_),
+                          static_cast<uint32_t>(taps_)};
+    uint64_t drop_count = 0; // rewritten by stop()
+    std::fwrite(magic, sizeof magic, 1, file);
+    std::fwrite(fields, sizeof fields, 1, file);
+    std::fwrite(&drop_count, sizeof drop_count, 1, file);
+}
+
+/// Writes every snapshot between `tail` and `head` to the file.
+void CoefTrace::drain() {
+    const uint32_t reserved = 0;
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t h = head.load(std::memory_order_acquire);
+    while (t != h) {
+        std::fwrite(&ring_index[t], sizeof(uint64_t), 1, file);
+        std::fwrite(&ring_n[t], sizeof(uint32_t), 1, file);
+        std::fwrite(&reserved, sizeof(uint32_t), 1, file);
+        std::fwrite(&ring[t * taps_], sizeof(sample_t), taps_, file);
+        t = (t + 1 == ring_snapshots_) ? 0 : t + 1;
+        tail.store(t, std::memory_order_release);
+    }
+}
+
+/// The writer thread. Wakes up periodically and drains the ring.
+/**
+  * The audio callback never notifies this thread (that would mean touching a
+  * mutex from inside the callback); we just poll. The polling period is short
+  * enough for the default ring to never fill up.
+  */
+void CoefTrace::writer_loop() {
+    std::unique_lock<std::mutex> lk(writer_mutex);
+    while (writing) {
+        writer_cv.wait_for(lk, std::chrono::milliseconds(20));
+        lk.unlock();
+        drain();
+        lk.lock();
+    }
+}
@@ -0,0 +1,186 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file CoefTrace.h
+ *
+ * Holds the interface to the `CoefTrace` class.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#ifndef COEFTRACE_H
+#define COEFTRACE_H
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Records snapshots of the adaptive filter coefficient vector to disk
+/**
+  * The audio callback calls `tick()` once per sample. Every `decimation`
+  * samples, `tick()` returns `true`, and the callback hands the current
+  * coefficient vector to `push()`, which copies (at most `taps` of) the
+  * coefficients to a slot of a ring buffer that was preallocated by `start()`.
+  * Neither `tick()` nor `push()` allocate memory, lock mutexes or do I/O.
+  * (A DSO in isolated mode only reports its coefficients after each block it
+  * filters, so the stream ends its blocks at the snapshots: a small
+  * `decimation` then costs more round trips to the helper process.)
+  *
+  * A background writer thread drains the ring buffer and appends the
+  * snapshots to a binary file. If the writer falls behind and the ring is
+  * full, new snapshots are dropped (and counted) instead of blocking the
+  * audio callback.
+  *
+  * The file starts with a 32-byte header:
+  *
+  *     char     magic[8];     // "ATFAWTRC"
+  *     uint32_t version;      // FILE_VERSION
+  *     uint32_t samplerate;   // Stream::samplerate
+  *     uint32_t decimation;   // samples between consecutive snapshots
+  *     uint32_t taps;         // coefficients stored per snapshot
+  *     uint64_t dropped;      // snapshots lost because the ring was full
+  *
+  * which is followed by fixed-size records, one per snapshot:
+  *
+  *     uint64_t index;        // sample index at which it was taken
+  *     uint32_t n;            // number of valid coefficients (<= taps)
+  *     uint32_t reserved;     // always zero
+  *     float    w[taps];      // coefficients (zero-padded after `n`)
+  *
+  * All fields are written in the host byte order. In MATLAB, the records
+  * can be read with `fread(fid, [4+taps, Inf], '*single')` after skipping
+  * the header, and reinterpreting the first four rows (the 16-byte header of
+  * each record).
+  */
+class CoefTrace
+{
+
+public:
+    /// The type of each coefficient
+    typedef float sample_t;
+
+    static constexpr unsigned DEFAULT_DECIMATION = 64;
+    static constexpr unsigned DEFAULT_TAPS = 512;
+    static constexpr unsigned DEFAULT_RING_SNAPSHOTS = 4096;
+
+    static constexpr uint32_t FILE_VERSION = 1;
+
+    /// Constructs a disabled trace.
+    CoefTrace()
+      : decimation_(0), taps_(0), ring_snapshots_(0),
+        countdown(0), snapshot_count(0), head(0), tail(0), dropped(0),
+        writing(false), file(nullptr)
+    {}
+
+    CoefTrace(const CoefTrace&) = delete;
+    CoefTrace& operator=(const CoefTrace&) = delete;
+
+    ~CoefTrace() { stop(); }
+
+    /// Sets the trace parameters. Must not be called while running.
+    void configure(const std::string& filename, unsigned decimation,
+                   unsigned taps,
+                   unsigned ring_snapshots = DEFAULT_RING_SNAPSHOTS);
+
+    /// Whether `start()` will actually record anything.
+    bool enabled() const {
+        return decimation_ != 0 && taps_ != 0 && !filename_.empty();
+    }
+
+    /// Allocates the ring, opens the file and spawns the writer thread.
+    void start(unsigned samplerate);
+
+    /// Drains the ring, joins the writer thread and closes the file.
+    void stop();
+
+    /// Must be called once per sample. Returns true when a snapshot is due.
+    bool tick() {
+        if (countdown == 0) // disabled, or not running
+            return false;
+        if (--countdown != 0)
+            return false;
+        countdown = decimation_;
+        ++snapshot_count;
+        return true;
+    }
+
+    /// Samples until the next snapshot is due (the one whose `tick()` returns
+    /// true counts), or zero if not running
+    unsigned until_snapshot() const { return countdown; }
+
+    /// Stores a coefficient vector in the ring. Real-time safe.
+    void push(const sample_t *w, unsigned n) {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t next = (h + 1 == ring_snapshots_) ? 0 : h + 1;
+        if (next == tail.load(std::memory_order_acquire)) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (n > taps_)
+            n = taps_;
+        sample_t *slot = &ring[h * taps_];
+        std::memcpy(slot, w, n * sizeof(sample_t));
+        std::fill(slot + n, slot + taps_, sample_t(0));
+        ring_index[h] = static_cast<uint64_t>(snapshot_count) * decimation_;
+        ring_n[h] = n;
+        head.store(next, std::memory_order_release);
+    }
+
+    unsigned long dropped_snapshots() const { return dropped.load(); }
+
+private:
+
+    std::string filename_;
+    unsigned decimation_;
+    unsigned taps_;
+    unsigned ring_snapshots_;
+
+    unsigned countdown;
+    unsigned long snapshot_count;
+
+    std::vector<sample_t> ring;
+    std::vector<uint64_t> ring_index;
+    std::vector<uint32_t> ring_n;
+
+    // `head' is only written by the audio callback, `tail' only by the writer
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+    std::atomic<unsigned long> dropped;
+
+    std::thread writer;
+    std::atomic<bool> writing;
+    std::mutex writer_mutex;
+    std::condition_variable writer_cv;
+
+    std::FILE *file;
+
+    void write_header(uint32_t samplerate);
+    void drain();
+    void writer_loop();
+
+};
+
+class CoefTraceException: public std::runtime_error {
+public:
+    CoefTraceException(const std::string& desc)
+        : runtime_error(std::string("Coefficient trace error: ") + desc) {}
+};
+
+#endif // COEFTRACE_H
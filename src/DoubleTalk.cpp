@@ -0,0 +1,77 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file DoubleTalk.cpp
+ *
+ * Holds the implementation of the `DoubleTalkDetector` class.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#include <cmath>
+
+#include <algorithm>
+
+#include "DoubleTalk.h"
+#include "simd.h"
+
+void DoubleTalkDetector::configure(int geigel_db, int ncc_percent) {
+    geigel_gain = std::pow(10.0f, geigel_db / 20.0f);
+    ncc_threshold = ncc_percent / 100.0f;
+}
+
+void DoubleTalkDetector::start() {
+    std::fill(x_peaks.begin(), x_peaks.end(), 0);
+    peak_idx = 0;
+    hangover = 0;
+}
+
+bool DoubleTalkDetector::detect(const sample_t *x, const sample_t *y) {
+
+    const sample_t *x_blk = x + LAGS; // aligned with y
+
+    x_peaks[peak_idx] = SIMD::max_abs(x_blk, blk_size);
+    peak_idx = (peak_idx + 1) % static_cast<unsigned>(x_peaks.size());
+
+    sample_t y_energy = SIMD::sum_squares(y, blk_size);
+    bool double_talk = false;
+
+    // ignore silence, where both statistics would be meaningless
+    if (y_energy >= 1e-8f * blk_size) {
+
+        // Geigel
+        sample_t x_peak = *std::max_element(x_peaks.begin(), x_peaks.end());
+        double_talk = SIMD::max_abs(y, blk_size) > geigel_gain * x_peak;
+
+        // normalized cross-correlation: the echo is y[n] = sum h[l] x[n-l]
+        if (!double_talk) {
+            sample_t best = 0;
+            for (unsigned l = 0; l <= LAGS; ++l) {
+                const sample_t *xl = x_blk - l;
+                sample_t x_energy = SIMD::sum_squares(xl, blk_size);
+                if (x_energy <= 0)
+                    continue;
+                sample_t r = SIMD::dot(xl, y, blk_size);
+                best = std::max(best, r*r / x_energy);
+            }
+            // best is the largest squared coefficient, times y_energy
+            double_talk = best < ncc_threshold*ncc_threshold * y_energy;
+        }
+
+    }
+
+    if (double_talk)
+        hangover = HANGOVER_BLOCKS;
+    else if (hangover)
+        --hangover;
+    return hangover != 0;
+
+}
@@ -0,0 +1,102 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file DoubleTalk.h
+ *
+ * Holds the interface to the `DoubleTalkDetector` class.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#ifndef DOUBLETALK_H
+#define DOUBLETALK_H
+
+#include <vector>
+
+/// Block-level double-talk detector
+/**
+  * Decides, for each block of microphone samples `y`, whether it contains
+  * something other than the echo of the far-end signal `x` (that is, whether
+  * the near-end talker is speaking). The adaptive filter should not learn
+  * during double-talk, or the near-end speech will corrupt its estimate of
+  * the echo path.
+  *
+  * Two classic statistics are combined; double-talk is declared if either
+  * of them says so:
+  *
+  *  - Geigel: the peak of `|y|` in the block is compared with the peak of
+  *    `|x|` over the last `history_blks` blocks (which should span the
+  *    whole echo path). The echo of `x` is never louder than `x` times the
+  *    gain of the path, so a louder `y` must have another source.
+  *  - Normalized cross-correlation: the largest correlation coefficient
+  *    between the `y` block and the `x` block, over lags `0` to `LAGS`. If
+  *    `y` is (mostly) echo, some lag will correlate well with it.
+  *
+  * Once detected, double-talk is held for `HANGOVER_BLOCKS` blocks, so that
+  * the filter doesn't resume learning between two syllables. Blocks where
+  * `y` is silent never trigger the detector.
+  *
+  * All the reductions are done by the kernels in simd.h. The detector is
+  * meant to run on `Stream`'s worker thread, not in the audio callback.
+  */
+class DoubleTalkDetector
+{
+
+public:
+    typedef float sample_t;
+
+    /// Largest lag (in samples) checked by the cross-correlation statistic
+    static constexpr unsigned LAGS = 128;
+
+    static constexpr unsigned HANGOVER_BLOCKS = 8;
+
+    static constexpr int DEFAULT_GEIGEL_DB = 0;
+    static constexpr int DEFAULT_NCC_PERCENT = 50;
+
+    DoubleTalkDetector(unsigned blk, unsigned history_blks)
+      : blk_size(blk), x_peaks(history_blks)
+    {
+        configure(DEFAULT_GEIGEL_DB, DEFAULT_NCC_PERCENT);
+        start();
+    }
+
+    /// Sets the thresholds
+    /**
+      * \param[in]  geigel_db   How much (in dB) the peak of `y` may be above
+      *                         the peak of `x` before it is double-talk.
+      * \param[in]  ncc_percent Correlation coefficient (in percent) below
+      *                         which it is double-talk.
+      */
+    void configure(int geigel_db, int ncc_percent);
+
+    /// Forgets the past blocks. Called when a session starts.
+    void start();
+
+    /// Processes one block; returns true if it is double-talk
+    /**
+      * `x` points to `LAGS + blk_size` far-end samples, of which the last
+      * `blk_size` are aligned with the `blk_size` microphone samples in `y`.
+      */
+    bool detect(const sample_t *x, const sample_t *y);
+
+private:
+
+    unsigned blk_size;
+    float geigel_gain;
+    float ncc_threshold;
+
+    std::vector<sample_t> x_peaks; // peak of |x| in each of the last blocks
+    unsigned peak_idx;
+    unsigned hangover;
+
+};
+
+#endif // DOUBLETALK_H
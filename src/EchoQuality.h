@@ -0,0 +1,227 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file EchoQuality.h
+ *
+ * Holds the `EchoQuality` class, which measures how well an adaptive filter
+ * cancels an echo whose path is known.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#ifndef ECHOQUALITY_H
+#define ECHOQUALITY_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+/// Echo cancellation measures, accumulated window by window
+/**
+  * The caller runs the filter over consecutive windows of the input, and
+  * after each one calls `add_window()` with the microphone signal `d`, the
+  * error `e` returned by the filter, and the coefficients `w` the filter has
+  * at the end of the window. From these, we get the ERLE (echo return loss
+  * enhancement, \f$10\log_{10}\sum d^2/\sum e^2\f$) and the misalignment
+  * (\f$10\log_{10}\|h-w\|^2/\|h\|^2\f$, where \f$h\f$ is the true echo path)
+  * over time, and their summary at the end of the pass.
+  *
+  * Windows in which the echo is too weak (e.g. pauses in the speech) have no
+  * meaningful ERLE, so they are marked inactive and left out of the ERLE
+  * figures. A window with echo where the filter cancelled all of it (`e` is
+  * zero) is still active: its ERLE is taken as `MAX_ERLE_DB`, which also
+  * bounds the ERLE of the other windows and of the summary.
+  *
+  * Nothing is allocated after the constructor, so that the measures can be
+  * taken between the timed parts of a benchmark.
+  */
+template <typename SAMPLE_T>
+class EchoQuality
+{
+
+public:
+
+    constexpr static unsigned DEFAULT_WINDOW = 1024; // samples
+    constexpr static double DEFAULT_TARGET_ERLE = 20; // dB
+    /// Windows whose mean echo power is below this are inactive
+    constexpr static double ACTIVITY_THRESHOLD_DB = -60;
+    /// Ceiling of the ERLE figures, reached when the echo is cancelled
+    /// perfectly
+    constexpr static double MAX_ERLE_DB = 150;
+    /// The steady state is taken as the last quarter of the pass
+    constexpr static double STEADY_FRACTION = .25;
+
+    /// The measures of one window
+    struct Point {
+        double time;          ///< end of the window, in seconds
+        bool active;          ///< whether there was echo in the window
+        double erle_db;       ///< zero if the window isn't active
+        double misalignment_db;
+    };
+
+    /// The measures of a whole pass
+    /**
+      * A figure that couldn't be measured (e.g. no active windows, or a
+      * filter without coefficients) is NaN.
+      */
+    struct Summary {
+        double erle_db;              ///< over all the active windows
+        double steady_erle_db;       ///< over the active windows of the
+                                     ///< steady state
+        double steady_error_db;      ///< mean power of `e` in the steady
+                                     ///< state, in dBFS
+        double misalignment_db;      ///< at the end of the pass
+        double convergence_time;     ///< seconds until the ERLE stays above
+                                     ///< the target; NaN if it never does
+        double target_erle_db;
+        std::vector<Point> curve;
+    };
+
+    /// `max_samples` is the length of a pass, which fixes the size of
+    /// the curve.
+    EchoQuality(const std::vector<SAMPLE_T>& echo_path, int samplerate,
+                unsigned max_samples, unsigned window = DEFAULT_WINDOW)
+        : h(echo_path), h_energy(0), srate(samplerate), window_(window),
+          target_db(DEFAULT_TARGET_ERLE)
+    {
+        for (auto x : h)
+            h_energy += double(x) * x;
+        curve.reserve(max_samples / window_ + 1);
+        sums.reserve(curve.capacity());
+        start();
+    }
+
+    unsigned window() const { return window_; }
+
+    void set_target_erle(double db) { target_db = db; }
+
+    /// Starts a new pass
+    void start() {
+        curve.clear(); // keeps the capacity
+        sums.clear();
+        samples = 0;
+    }
+
+    /// Accumulates `n` samples (at most a window) of `d` and `e`, and the
+    /// filter coefficients at the end of them
+    void add_window(const SAMPLE_T *d, const SAMPLE_T *e, unsigned n,
+                    const SAMPLE_T *w, unsigned nw) {
+        double dd = 0, ee = 0;
+        for (unsigned i = 0; i != n; ++i) {
+            dd += double(d[i]) * d[i];
+            ee += double(e[i]) * e[i];
+        }
+        samples += n;
+        Point p;
+        p.time = double(samples) / srate;
+        // activity only depends on the echo: a perfect cancellation must
+        // count, and not be left out of the figures
+        p.active = n != 0 && dd > 0 &&
+                   dd / n >= std::pow(10, ACTIVITY_THRESHOLD_DB / 10);
+        p.erle_db = p.active ? erle(dd, ee) : 0;
+        p.misalignment_db = misalignment(w, nw);
+        if (curve.size() != curve.capacity()) {
+            curve.push_back(p);
+            sums.push_back(Sums{dd, ee, n});
+        }
+    }
+
+    Summary summary() const;
+
+private:
+
+    static double to_db(double ratio) { return 10 * std::log10(ratio); }
+
+    /// Clamped to `MAX_ERLE_DB`, which is also the ERLE of `ee == 0`
+    static double erle(double dd, double ee) {
+        return ee > dd * std::pow(10, -MAX_ERLE_DB / 10) ?
+                    to_db(dd / ee) : MAX_ERLE_DB;
+    }
+
+    double misalignment(const SAMPLE_T *w, unsigned nw) const {
+        if (h_energy == 0 || !w || nw == 0)
+            return std::numeric_limits<double>::quiet_NaN();
+        double err = 0;
+        size_t n = std::max(h.size(), size_t(nw));
+        for (size_t i = 0; i != n; ++i) {
+            double hi = i < h.size() ? h[i] : 0;
+            double wi = i < nw ? w[i] : 0;
+            err += (hi - wi) * (hi - wi);
+        }
+        return to_db(err / h_energy);
+    }
+
+    struct Sums {
+        double dd, ee;
+        unsigned n;
+    };
+
+    std::vector<SAMPLE_T> h;
+    double h_energy;
+    int srate;
+    unsigned window_;
+    double target_db;
+
+    unsigned long samples;
+    std::vector<Point> curve;
+    std::vector<Sums> sums; // parallel to `curve`
+
+};
+
+template <typename SAMPLE_T>
+typename EchoQuality<SAMPLE_T>::Summary EchoQuality<SAMPLE_T>::summary() const {
+
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    Summary s;
+    s.target_erle_db = target_db;
+    s.curve = curve;
+    s.misalignment_db = curve.empty() ? nan : curve.back().misalignment_db;
+
+    auto steady_first = static_cast<size_t>(
+                std::floor(double(curve.size()) * (1 - STEADY_FRACTION)));
+    double dd = 0, ee = 0;               // active windows
+    double steady_dd = 0, steady_ee = 0; // active windows of the steady state
+    double steady_power = 0;             // all windows of the steady state
+    unsigned long steady_n = 0;
+    // the ERLE has converged at the end of the last active window below the
+    // target, if there are active windows after it
+    double t = 0;
+    bool converged = false;
+    for (size_t k = 0; k != curve.size(); ++k) {
+        bool steady = k >= steady_first;
+        if (steady) {
+            steady_power += sums[k].ee;
+            steady_n += sums[k].n;
+        }
+        if (!curve[k].active)
+            continue;
+        dd += sums[k].dd;
+        ee += sums[k].ee;
+        if (steady) {
+            steady_dd += sums[k].dd;
+            steady_ee += sums[k].ee;
+        }
+        converged = curve[k].erle_db >= target_db;
+        if (!converged)
+            t = curve[k].time;
+    }
+    s.erle_db = dd > 0 ? erle(dd, ee) : nan;
+    s.steady_erle_db = steady_dd > 0 ? erle(steady_dd, steady_ee) : nan;
+    s.steady_error_db = steady_power > 0 ?
+                to_db(steady_power / double(steady_n)) : nan;
+    s.convergence_time = converged ? t : nan;
+
+    return s;
+
+}
+
+#endif // ECHOQUALITY_H
@@ -0,0 +1,346 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file IsolatedRunner.cpp
+ *
+ * Holds the implementation of the `IsolatedRunner` class.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "IsolatedRunner.h"
+
+/**
+  * The helper is looked for in the same directory as the running executable
+  * (`/proc/self/exe`), which is where CMake puts both of them.
+  */
+std::string IsolatedRunner::helper_path() {
+    char buf[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", buf, sizeof buf - 1);
+    if (len <= 0)
+        return "atfa-dso-runner";
+    buf[len] = '\0';
+    std::string exe(buf);
+    return exe.substr(0, exe.rfind('/') + 1) + "atfa-dso-runner";
+}
+
+/**
+  * Creates the shared region and the eventfds, and then spawns the helper.
+  *
+  * \throws IsolatedRunnerException if the helper cannot be started, or if it
+  *         rejects the DSO.
+  */
+IsolatedRunner::IsolatedRunner(const std::string& dso_path)
+  : path(dso_path), region(nullptr), shm_fd(-1), req_fd(-1), resp_fd(-1),
+    pid(-1), ticket(0), rt_rate(0), failed_(false), stalled_(false),
+    restart_pending(false)
+{
+    using namespace RunnerShm;
+
+    shm_fd = memfd_create("atfa-dso-runner", MFD_CLOEXEC);
+    if (shm_fd < 0 || ftruncate(shm_fd, sizeof(Region)) != 0) {
+        release();
+        throw IsolatedRunnerException("could not create the shared memory.");
+    }
+    void *mem = mmap(nullptr, sizeof(Region), PROT_READ | PROT_WRITE,
+                     MAP_SHARED, shm_fd, 0);
+    if (mem == MAP_FAILED) {
+        release();
+        throw IsolatedRunnerException("could not map the shared memory.");
+    }
+    region = new (mem) Region;
+    region->magic = MAGIC;
+    region->has_state_io = 0;
+    region->state_size = 0;
+
+    req_fd = eventfd(0, EFD_CLOEXEC);
+    resp_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (req_fd < 0 || resp_fd < 0) {
+        release();
+        throw IsolatedRunnerException("could not create the eventfds.");
+    }
+
+    try {
+        spawn();
+    } catch (...) {
+        release();
+        throw;
+    }
+}
+
+/**
+  * Starts a helper on the (already created) shared region and eventfds, and
+  * waits for it to load (and test) the DSO. The ring starts over, empty.
+  *
+  * \throws IsolatedRunnerException if the helper cannot be started, or if it
+  *         rejects the DSO.
+  */
+void IsolatedRunner::spawn() {
+    using namespace RunnerShm;
+
+    region->state = STARTING;
+    region->head = 0;
+    region->done = 0;
+    region->w_n = 0;
+    ticket = 0;
+
+    // everything the child needs is prepared before fork(), since after it
+    // only async-signal-safe functions may be called
+    std::vector<std::string> args = {
+        helper_path(), path, std::to_string(shm_fd),
+        std::to_string(req_fd), std::to_string(resp_fd)
+    };
+    std::vector<char *> argv;
+    for (auto& a : args)
+        argv.push_back(&a[0]);
+    argv.push_back(nullptr);
+
+    pid = fork();
+    if (pid == 0) {
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        fcntl(shm_fd, F_SETFD, 0);
+        fcntl(req_fd, F_SETFD, 0);
+        fcntl(resp_fd, F_SETFD, 0);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    if (pid < 0)
+        throw IsolatedRunnerException("could not fork the helper process.");
+
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(STARTUP_TIMEOUT_MS);
+    while (region->state.load(std::memory_order_acquire) == STARTING) {
+        int status;
+        if (waitpid(pid, &status, WNOHANG) == pid) {
+            pid = -1;
+            throw IsolatedRunnerException(
+                "the helper process " + args[0] + " exited before loading the"
+                " DSO (is it installed next to the atfa executable?)."
+            );
+        }
+        if (std::chrono::steady_clock::now() > deadline) {
+            kill_helper();
+            throw IsolatedRunnerException("timed out loading the DSO.");
+        }
+        pollfd pfd = {resp_fd, POLLIN, 0};
+        if (poll(&pfd, 1, 10) > 0) {
+            uint64_t v;
+            if (read(resp_fd, &v, sizeof v) < 0) {}
+        }
+    }
+    if (region->state == FAILED) {
+        std::string err(region->error);
+        kill_helper();
+        throw IsolatedRunnerException(err);
+    }
+}
+
+IsolatedRunner::~IsolatedRunner() {
+    if (pid > 0 && !failed_) {
+        next_slot().op = RunnerShm::OP_QUIT;
+        wait_done(submit(), std::chrono::milliseconds(CONTROL_TIMEOUT_MS));
+    }
+    kill_helper();
+    release();
+}
+
+/**
+  * If the helper fails, `e` is filled with `y` (what the dummy filter would
+  * do) for the rest of the session; and so it is while the runner is
+  * stalled.
+  *
+  * Called from the audio callback. The only system calls made are one
+  * `write()` to wake up the helper and, if the block is not ready after a
+  * short spin, `ppoll()` on the response eventfd.
+  */
+bool IsolatedRunner::run(const float *x, const float *y, const int *learn,
+                         float *e, unsigned n, int *updates) {
+    using namespace RunnerShm;
+    *updates = 0;
+    if (failed_ || stalled_.load(std::memory_order_acquire)) {
+        std::copy(y, y + n, e);
+        return false;
+    }
+    if (restart_pending.exchange(false)) {
+        next_slot().op = OP_RESTART;
+        submit(); // no need to wait: requests are processed in order
+    }
+    while (n) {
+        unsigned len = std::min(n, MAX_BLOCK);
+        Slot& s = next_slot();
+        s.op = OP_RUN;
+        s.n = len;
+        std::memcpy(s.x, x, len * sizeof(float));
+        std::memcpy(s.y, y, len * sizeof(float));
+        for (unsigned i = 0; i != len; ++i)
+            s.learn[i] = static_cast<uint8_t>(learn[i] != 0);
+        std::chrono::microseconds timeout{
+            std::chrono::milliseconds(RUN_TIMEOUT_MS)};
+        if (rt_rate > 0)
+            timeout = std::chrono::microseconds(static_cast<long>(
+                        RT_TIMEOUT_FRACTION * 1e6 * len / rt_rate));
+        if (!wait_done(submit(), timeout)) {
+            std::copy(y, y + n, e);
+            if (rt_rate > 0) // recover() takes it from here
+                stalled_.store(true, std::memory_order_release);
+            else
+                failed_ = true;
+            return false;
+        }
+        std::memcpy(e, s.e, len * sizeof(float));
+        *updates += static_cast<int>(s.updates);
+        x += len; y += len; learn += len; e += len;
+        n -= len;
+    }
+    return true;
+}
+
+/**
+  * \throws IsolatedRunnerException if the helper does not answer in time, or
+  *         if the request failed inside the helper (e.g. `adapf_init`
+  *         returned NULL).
+  */
+void IsolatedRunner::control(RunnerShm::Op op) {
+    if (failed_)
+        throw IsolatedRunnerException("the helper process is not running.");
+    RunnerShm::Slot& s = next_slot();
+    s.op = op;
+    s.n = 0;
+    if (!wait_done(submit(), std::chrono::milliseconds(CONTROL_TIMEOUT_MS))) {
+        failed_ = true;
+        throw IsolatedRunnerException("the helper process stopped answering.");
+    }
+    // the helper answered everything before this request, the late block too
+    stalled_.store(false, std::memory_order_release);
+    if (s.status != 0)
+        throw IsolatedRunnerException(region->error);
+}
+
+std::vector<char> IsolatedRunner::save_state() {
+    control(RunnerShm::OP_SAVE_STATE);
+    return std::vector<char>(region->state_data,
+                             region->state_data + region->state_size);
+}
+
+void IsolatedRunner::load_state(const std::vector<char>& state) {
+    if (state.size() > RunnerShm::MAX_STATE)
+        throw IsolatedRunnerException("filter state too large.");
+    std::copy(state.begin(), state.end(), region->state_data);
+    region->state_size = state.size();
+    control(RunnerShm::OP_LOAD_STATE);
+}
+
+/**
+  * Must be called from outside the audio callback, which leaves the helper
+  * alone while the runner is stalled. The helper gets `RUN_TIMEOUT_MS` more
+  * to answer the late block, e.g. in case it was only preempted; if it
+  * doesn't, it is killed, and a new one is started, with the filter
+  * initialized from scratch. If that fails too, the runner has `failed()`.
+  *
+  * \returns whether the helper was restarted.
+  */
+bool IsolatedRunner::recover() {
+    if (failed_ || !stalled_.load(std::memory_order_acquire))
+        return false;
+    if (wait_done(ticket, std::chrono::milliseconds(RUN_TIMEOUT_MS))) {
+        stalled_.store(false, std::memory_order_release);
+        return false;
+    }
+    kill_helper();
+    try {
+        spawn();
+        control(RunnerShm::OP_INIT); // which clears `stalled_`
+    } catch (const IsolatedRunnerException&) {
+        failed_ = true; // and stays stalled
+    }
+    return true;
+}
+
+uint32_t IsolatedRunner::submit() {
+    ++ticket;
+    region->head.store(ticket, std::memory_order_release);
+    uint64_t one = 1;
+    if (write(req_fd, &one, sizeof one) < 0) {}
+    return ticket;
+}
+
+/// Waits until the helper has completed request number `t`.
+bool IsolatedRunner::wait_done(uint32_t t,
+                               std::chrono::microseconds timeout) {
+    auto is_done = [this, t]() {
+        uint32_t d = region->done.load(std::memory_order_acquire);
+        return static_cast<int32_t>(d - t) >= 0;
+    };
+    // the helper usually answers in a few microseconds; spin a little before
+    // paying for a sleep
+    for (unsigned i = 0; i != 2000; ++i)
+        if (is_done())
+            return true;
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!is_done()) {
+        auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            deadline - std::chrono::steady_clock::now()
+        ).count();
+        if (remaining < 0)
+            return false;
+        timespec ts = {static_cast<time_t>(remaining / 1000000000),
+                       static_cast<long>(remaining % 1000000000)};
+        pollfd pfd = {resp_fd, POLLIN, 0};
+        if (ppoll(&pfd, 1, &ts, nullptr) > 0) {
+            uint64_t v;
+            if (read(resp_fd, &v, sizeof v) < 0) {}
+        }
+    }
+    return true;
+}
+
+void IsolatedRunner::kill_helper() {
+    if (pid <= 0)
+        return;
+    int status;
+    if (waitpid(pid, &status, WNOHANG) != pid) {
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+    }
+    pid = -1;
+}
+
+void IsolatedRunner::release() {
+    if (region) {
+        region->~Region();
+        munmap(region, sizeof(RunnerShm::Region));
+        region = nullptr;
+    }
+    for (int *fd : {&shm_fd, &req_fd, &resp_fd}) {
+        if (*fd >= 0)
+            close(*fd);
+        *fd = -1;
+    }
+}
@@ -0,0 +1,220 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file IsolatedRunner.h
+ *
+ * Holds the interface to the `IsolatedRunner` class, and the layout of the
+ * memory region it shares with the `atfa-dso-runner` helper process.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#ifndef ISOLATEDRUNNER_H
+#define ISOLATEDRUNNER_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2,
+              "The shared-memory ring needs address-free (lock-free) atomics");
+
+/// Layout of the memory shared between ATFA and the helper process
+/**
+  * ATFA is the only producer and the helper is the only consumer. Each
+  * request occupies one `Slot`; ATFA fills the slot, increments `head`, and
+  * writes to the request eventfd. The helper processes every slot up to
+  * `head`, increments `done` after each one, and then writes to the response
+  * eventfd.
+  */
+namespace RunnerShm {
+
+constexpr uint32_t MAGIC = 0x52465441; // "ATFR"
+
+/// Maximum number of samples handed to the helper in a single request
+constexpr unsigned MAX_BLOCK = 2048;
+constexpr unsigned SLOTS = 4;
+constexpr unsigned MAX_TAPS = 8192;
+constexpr unsigned MAX_TEXT = 65536;
+constexpr size_t MAX_STATE = 4 << 20;
+
+enum Op : uint32_t {
+    OP_RUN,     ///< run the filter over the `n` samples of the slot
+    OP_INIT,    ///< adapf_init
+    OP_CLOSE,   ///< adapf_close
+    OP_RESTART, ///< adapf_restart
+    OP_SAVE_STATE, ///< adapf_save_state, into `Region::state_data`
+    OP_LOAD_STATE, ///< adapf_load_state, from `Region::state_data`
+    OP_QUIT     ///< end the helper process
+};
+
+enum State : uint32_t {
+    STARTING, ///< helper still loading (and testing) the DSO
+    READY,    ///< helper waiting for requests
+    FAILED    ///< helper could not load the DSO; see `Region::error`
+};
+
+struct Slot {
+    uint32_t op;
+    uint32_t n;
+    uint32_t updates; // written by the helper
+    int32_t status;   // written by the helper; non-zero means error
+    float x[MAX_BLOCK];
+    float y[MAX_BLOCK];
+    float e[MAX_BLOCK]; // written by the helper
+    uint8_t learn[MAX_BLOCK];
+};
+
+struct Region {
+    uint32_t magic;
+    std::atomic<uint32_t> state;
+    std::atomic<uint32_t> head; // requests submitted by ATFA
+    std::atomic<uint32_t> done; // requests completed by the helper
+    uint32_t w_n; // coefficients after the last OP_RUN
+    float w[MAX_TAPS];
+    char error[1024];
+    char title[1024];
+    char listing[MAX_TEXT];
+    uint32_t has_state_io;
+    uint64_t state_size;
+    char state_data[MAX_STATE];
+    Slot ring[SLOTS];
+};
+
+}
+
+/// Runs an adaptive filter DSO inside a separate helper process
+/**
+  * The helper (`atfa-dso-runner`, installed next to the `atfa` executable)
+  * `dlopen`s the DSO, so that a crashing DSO only takes down the helper.
+  * Samples are exchanged in blocks through a shared-memory ring; a whole
+  * PortAudio buffer costs a single round trip, so the per-sample overhead is
+  * the round-trip latency divided by the block size.
+  *
+  * A DSO that stalls (or crashes) is detected by a timeout. From then on,
+  * `run()` returns the microphone signal unfiltered, just like the dummy
+  * filter, and `failed()` returns `true`.
+  *
+  * Inside the audio callback (see `set_realtime()`), `run()` can't wait that
+  * long: it only waits for a fraction of the duration of the block, and, if
+  * the helper is late, passes the block through and leaves the runner
+  * `stalled()`. It then keeps passing the samples through, without touching
+  * the helper, until another thread calls `recover()`.
+  *
+  * Only one thread may submit requests at a time. The `request_restart()`
+  * method is the exception: it may be called from any thread, and the
+  * restart is performed right before the next `run()`.
+  */
+class IsolatedRunner
+{
+
+public:
+
+    /// Time we wait for the helper to load and test the DSO
+    static constexpr int STARTUP_TIMEOUT_MS = 5000;
+    /// Time we wait for init/close/restart requests
+    static constexpr int CONTROL_TIMEOUT_MS = 2000;
+    /// Time we wait for a block to be filtered, outside of real time
+    static constexpr int RUN_TIMEOUT_MS = 50;
+    /// Fraction of the duration of a block we wait for it in real time
+    static constexpr double RT_TIMEOUT_FRACTION = .5;
+
+    explicit IsolatedRunner(const std::string& dso_path);
+    ~IsolatedRunner();
+
+    IsolatedRunner(const IsolatedRunner&) = delete;
+    IsolatedRunner& operator=(const IsolatedRunner&) = delete;
+
+    /// Filters `n` samples. Returns false if the helper has failed or is
+    /// stalled.
+    bool run(const float *x, const float *y, const int *learn, float *e,
+             unsigned n, int *updates);
+
+    /// From now on, `run()` is called in real time, with samples at this
+    /// rate; zero goes back to `RUN_TIMEOUT_MS`
+    /**
+      * Must not be called while another thread may be calling `run()`.
+      */
+    void set_realtime(int samplerate) { rt_rate = samplerate; }
+
+    /// Whether a block was late in real time, and `recover()` is due
+    bool stalled() const { return stalled_.load(std::memory_order_acquire); }
+
+    /// Brings a stalled runner back, restarting the helper if needed
+    bool recover();
+
+    /// Sends an init, close or restart request and waits for it.
+    void control(RunnerShm::Op op);
+
+    bool has_state_io() const { return region->has_state_io; }
+    std::vector<char> save_state();
+    void load_state(const std::vector<char>& state);
+
+    void request_restart() { restart_pending = true; }
+
+    /// Coefficient vector as of the last block filtered.
+    const float *coefficients(unsigned *n) const {
+        *n = region->w_n;
+        return region->w;
+    }
+
+    bool failed() const { return failed_.load(); }
+
+    std::string title() const { return region->title; }
+    std::string listing() const { return region->listing; }
+
+    /// Full path of the `atfa-dso-runner` executable.
+    static std::string helper_path();
+
+private:
+
+    std::string path;
+
+    RunnerShm::Region *region;
+    int shm_fd;
+    int req_fd;
+    int resp_fd;
+    pid_t pid;
+
+    uint32_t ticket; // number of requests submitted so far
+
+    int rt_rate; // zero outside of real time
+    std::atomic<bool> failed_;
+    // set by `run()`, which then leaves the helper to whoever clears it
+    std::atomic<bool> stalled_;
+    std::atomic<bool> restart_pending;
+
+    RunnerShm::Slot& next_slot() {
+        return region->ring[ticket % RunnerShm::SLOTS];
+    }
+    uint32_t submit();
+    bool wait_done(uint32_t t, std::chrono::microseconds timeout);
+
+    void spawn();
+    void kill_helper();
+    void release();
+
+};
+
+class IsolatedRunnerException: public std::runtime_error {
+public:
+    IsolatedRunnerException(const std::string& desc)
+        : runtime_error(std::string("Isolated runner: ") + desc) {}
+};
+
+#endif // ISOLATEDRUNNER_H
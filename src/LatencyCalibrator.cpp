@@ -0,0 +1,172 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file LatencyCalibrator.cpp
+ *
+ * Holds the `LatencyCalibrator` class, which measures the round-trip latency
+ * of an audio device.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#include <cmath>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "LatencyCalibrator.h"
+#include "Stream.h"
+
+LatencyCalibrator::LatencyCalibrator(Probe probe, double level)
+  : probe_(make_probe(probe, level))
+{}
+
+double LatencyCalibrator::max_latency() {
+    return double(FFT_SIZE - PROBE_LENGTH) / Stream::samplerate;
+}
+
+/**
+  * The MLS comes from a 12-bit Galois LFSR, with the primitive polynomial
+  * \f$x^{12}+x^6+x^4+x+1\f$; its samples are \f$\pm\f$`level`. The chirp
+  * sweeps linearly from 100 Hz to 5 kHz (just below half of
+  * `Stream::samplerate`), with short fades at both ends.
+  */
+Signal::container_t LatencyCalibrator::make_probe(Probe probe, double level) {
+    Signal::container_t p(PROBE_LENGTH);
+    const auto lvl = static_cast<Signal::sample_t>(level);
+    if (probe == MLS) {
+        unsigned lfsr = 1;
+        for (auto& x : p) {
+            x = (lfsr & 1) ? lvl : -lvl;
+            lfsr = (lfsr >> 1) ^ ((lfsr & 1) ? 0x829u : 0u);
+        }
+        return p;
+    }
+    const double f0 = 100, f1 = 5000;
+    const double T = double(PROBE_LENGTH) / Stream::samplerate;
+    const unsigned fade = PROBE_LENGTH / 32;
+    for (unsigned n = 0; n != PROBE_LENGTH; ++n) {
+        double t = double(n) / Stream::samplerate;
+        double phase = 2*M_PI * (f0*t + (f1 - f0) * t*t / (2*T));
+        double env = 1;
+        unsigned edge = std::min(n, PROBE_LENGTH - 1 - n);
+        if (edge < fade)
+            env = .5 - .5*std::cos(M_PI * edge / fade);
+        p[n] = static_cast<Signal::sample_t>(level * env * std::sin(phase));
+    }
+    return p;
+}
+
+/**
+  * The probe starts with the first callback, and the recording lasts for
+  * `FFT_SIZE` samples at `Stream::samplerate`, so that any latency up to
+  * `max_latency()` is caught whole.
+  */
+LatencyCalibrator::Result LatencyCalibrator::measure(AudioDevice& dev) const {
+
+    const int rate = dev.samplerate();
+    if (rate < int(Stream::samplerate) || rate % int(Stream::samplerate) != 0)
+        throw CalibrationException("The rate of the device must be a"
+                                   " multiple of the stream's.");
+    const auto ratio = static_cast<unsigned long>(rate) / Stream::samplerate;
+
+    // allocated here, and not in the callback
+    Signal::container_t recording(FFT_SIZE);
+    std::atomic<bool> done{false};
+    unsigned long pos = 0; // device samples so far
+    float acc = 0;
+
+    dev.start([&](const float *in, float *out, unsigned long frames) {
+        for (unsigned long i = 0; i != frames; ++i, ++pos) {
+            unsigned long n = pos / ratio; // at Stream::samplerate
+            out[i] = n < probe_.size() ? probe_[n] : 0;
+            if (n >= FFT_SIZE)
+                continue;
+            acc += in[i];
+            if (pos % ratio == ratio - 1) {
+                recording[n] = acc / ratio;
+                acc = 0;
+            }
+        }
+        if (pos < FFT_SIZE * ratio)
+            return true;
+        done = true;
+        return false;
+    });
+
+    // twice the length of the recording, and some more to start the device
+    auto timeout = std::chrono::steady_clock::now() +
+                   std::chrono::milliseconds(
+                       2000 * FFT_SIZE / Stream::samplerate + 2000);
+    while (!done && std::chrono::steady_clock::now() < timeout)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    dev.stop();
+    if (!done)
+        throw AudioDeviceException("The device stopped before the end of"
+                                   " the recording.");
+
+    return find(recording);
+
+}
+
+LatencyCalibrator::Result LatencyCalibrator::find(
+        const Signal::container_t& recording) const {
+
+    DefaultDFT dft;
+    Signal::container_t x_re(FFT_SIZE), x_im(FFT_SIZE);
+    Signal::container_t p_re(FFT_SIZE), p_im(FFT_SIZE);
+    std::copy_n(recording.begin(), std::min(recording.size(), x_re.size()),
+                x_re.begin());
+    std::copy(probe_.begin(), probe_.end(), p_re.begin());
+    dft(x_re, x_im);
+    dft(p_re, p_im);
+
+    // X times the conjugate of P is the transform of the cross-correlation
+    for (unsigned k = 0; k != FFT_SIZE; ++k) {
+        auto re = x_re[k]*p_re[k] + x_im[k]*p_im[k];
+        auto im = x_im[k]*p_re[k] - x_re[k]*p_im[k];
+        x_re[k] = re;
+        x_im[k] = im;
+    }
+    dft(x_re, x_im, DefaultDFT::INVERSE);
+
+    // lags after this one would wrap around
+    const unsigned last = FFT_SIZE - static_cast<unsigned>(probe_.size());
+    unsigned peak = 0;
+    double energy = 0;
+    for (unsigned l = 0; l <= last; ++l) {
+        energy += double(x_re[l]) * x_re[l];
+        if (std::abs(x_re[l]) > std::abs(x_re[peak]))
+            peak = l;
+    }
+    double rms = std::sqrt(energy / (last + 1));
+    double top = std::abs(x_re[peak]);
+
+    Result r;
+    r.peak_db = rms > 0 ? 20*std::log10(top / rms) : 0;
+    if (r.peak_db < MIN_PEAK_DB)
+        throw CalibrationException("The probe was not found in the"
+                                   " recording. Check that the output is"
+                                   " heard by the input, and that the"
+                                   " volume is high enough.");
+    r.lag = peak;
+    if (peak != 0 && peak != last) {
+        double y0 = std::abs(x_re[peak - 1]), y2 = std::abs(x_re[peak + 1]);
+        double den = y0 - 2*top + y2;
+        if (den != 0)
+            r.lag += .5 * (y0 - y2) / den;
+    }
+    r.latency = r.lag / Stream::samplerate;
+    return r;
+
+}
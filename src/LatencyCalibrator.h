@@ -0,0 +1,101 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file LatencyCalibrator.h
+ *
+ * Holds the interface to the `LatencyCalibrator` class.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#ifndef LATENCYCALIBRATOR_H
+#define LATENCYCALIBRATOR_H
+
+#include <stdexcept>
+#include <string>
+
+#include "AudioDevice.h"
+#include "Signal.h"
+
+/// Measures the round-trip latency of an audio device
+/**
+  * Plays a probe signal (a maximum length sequence or a chirp) through the
+  * device, records what comes back, and finds the probe in the recording by
+  * cross-correlation, computed with the FFT of `DefaultDFT`. The position of
+  * the correlation peak, refined by parabolic interpolation, is the latency.
+  *
+  * The probe goes through the same path as the audio of a `Stream`: it is
+  * made at `Stream::samplerate` and each sample is repeated to reach the
+  * rate of the device, and the recording is decimated back by averaging.
+  * This is the latency that goes in `Stream::Scenario::system_latency`.
+  *
+  * For the speakers to be heard by the microphone, the device should be a
+  * loopback cable, or the speakers should be loud enough, in a quiet room.
+  */
+class LatencyCalibrator
+{
+
+public:
+
+    enum Probe { MLS, Chirp };
+
+    /// Size of the cross-correlation, at `Stream::samplerate`; it is also
+    /// how much is recorded
+    constexpr static unsigned FFT_SIZE = DefaultDFT::tblsize;
+    /// MLS of order 12, and the chirp of the same length
+    constexpr static unsigned PROBE_LENGTH = 4095;
+    constexpr static double DEFAULT_LEVEL = .25; // peak amplitude
+    /// Minimum correlation peak, over the RMS of the correlation, for the
+    /// probe to count as found
+    constexpr static double MIN_PEAK_DB = 15;
+
+    struct Result {
+        double latency; ///< in seconds
+        double lag;     ///< in samples at `Stream::samplerate`
+        double peak_db; ///< the correlation peak, over its RMS
+    };
+
+    explicit LatencyCalibrator(Probe probe = MLS,
+                               double level = DEFAULT_LEVEL);
+
+    /// The longest latency that can be measured, in seconds
+    static double max_latency();
+
+    /// Plays the probe through `dev` and measures its latency
+    /**
+      * Blocks until the recording is over.
+      *
+      * \throws AudioDeviceException if the device fails or stalls.
+      * \throws CalibrationException if the probe was not found.
+      */
+    Result measure(AudioDevice& dev) const;
+
+    /// Finds the probe in `FFT_SIZE` recorded samples, at
+    /// `Stream::samplerate`, that started along with the probe
+    Result find(const Signal::container_t& recording) const;
+
+    const Signal::container_t& probe() const { return probe_; }
+
+    static Signal::container_t make_probe(Probe probe, double level);
+
+private:
+
+    Signal::container_t probe_;
+
+};
+
+class CalibrationException : public std::runtime_error {
+public:
+    CalibrationException(const std::string& desc)
+        : runtime_error(std::string("Latency calibration error: ") + desc) {}
+};
+
+#endif // LATENCYCALIBRATOR_H
@@ -0,0 +1,211 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file PerfCounters.cpp
+ *
+ * Holds the implementation of the `PerfCounters` class.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#ifdef __linux__
+extern "C" {
+#   include <linux/perf_event.h>
+#   include <sys/ioctl.h>
+#   include <sys/syscall.h>
+#   include <unistd.h>
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#   include <cpuid.h>
+#endif
+
+#include "PerfCounters.h"
+
+namespace {
+
+#ifdef __linux__
+
+bool intel_cpu() {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned eax, regs[3];
+    if (!__get_cpuid(0, &eax, &regs[0], &regs[2], &regs[1]))
+        return false;
+    char vendor[13];
+    std::memcpy(vendor, regs, 12);
+    vendor[12] = '\0';
+    return std::strcmp(vendor, "GenuineIntel") == 0;
+#else
+    return false;
+#endif
+}
+
+/// Returns false if the event is not known for this CPU
+bool event_attr(PerfCounters::Event e, perf_event_attr& attr) {
+    // FP_ARITH_INST_RETIRED (Intel, since Broadwell); the umask selects
+    // scalar (single and double), or 128- and 256-bit packed
+    constexpr std::uint64_t FP_ARITH = 0xC7;
+    constexpr std::uint64_t FP_SCALAR_UMASK = 0x03;
+    constexpr std::uint64_t FP_PACKED_UMASK = 0x3C;
+    switch (e) {
+    case PerfCounters::Cycles:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        return true;
+    case PerfCounters::Instructions:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        return true;
+    case PerfCounters::CacheMisses:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        return true;
+    case PerfCounters::BranchMisses:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+        return true;
+    case PerfCounters::FPScalar:
+        attr.type = PERF_TYPE_RAW;
+        attr.config = (FP_SCALAR_UMASK << 8) | FP_ARITH;
+        return intel_cpu();
+    case PerfCounters::FPPacked:
+        attr.type = PERF_TYPE_RAW;
+        attr.config = (FP_PACKED_UMASK << 8) | FP_ARITH;
+        return intel_cpu();
+    default:
+        return false;
+    }
+}
+
+#endif
+
+}
+
+const char *PerfCounters::name(Event e) {
+    static const char *names[NUM_EVENTS] = {
+        "cycles", "instructions", "cache misses", "branch misses",
+        "scalar FP instructions", "SIMD FP instructions"
+    };
+    return e < NUM_EVENTS ? names[e] : "";
+}
+
+PerfCounters::Counts PerfCounters::Counts::per(double n) const {
+    Counts c = *this;
+    for (auto& v : c.value)
+        if (v >= 0)
+            v /= n;
+    return c;
+}
+
+PerfCounters::PerfCounters() {
+
+    for (auto& fd : fds)
+        fd = -1;
+
+#ifdef __linux__
+    bool denied = false;
+    for (int e = 0; e != NUM_EVENTS; ++e) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        if (!event_attr(Event(e), attr)) {
+            error_msg += std::string(name(Event(e))) +
+                         ": not known for this CPU. ";
+            continue;
+        }
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+        // this thread, on any CPU
+        long fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        if (fd < 0) {
+            int err = errno;
+            if (err == EACCES || err == EPERM)
+                denied = true;
+            error_msg += std::string(name(Event(e))) + ": " +
+                         std::strerror(err) + ". ";
+            continue;
+        }
+        fds[e] = static_cast<int>(fd);
+    }
+    if (!available() && denied)
+        error_msg += "Check /proc/sys/kernel/perf_event_paranoid.";
+#else
+    error_msg = "Performance counters are only supported on Linux.";
+#endif
+
+}
+
+PerfCounters::~PerfCounters() {
+#ifdef __linux__
+    for (int fd : fds)
+        if (fd >= 0)
+            close(fd);
+#endif
+}
+
+bool PerfCounters::available() const {
+    for (int fd : fds)
+        if (fd >= 0)
+            return true;
+    return false;
+}
+
+void PerfCounters::start() {
+#ifdef __linux__
+    for (int fd : fds)
+        if (fd >= 0)
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+}
+
+void PerfCounters::stop() {
+#ifdef __linux__
+    for (int fd : fds)
+        if (fd >= 0)
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+#endif
+}
+
+void PerfCounters::reset() {
+#ifdef __linux__
+    for (int fd : fds)
+        if (fd >= 0)
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+#endif
+}
+
+/**
+  * Counts that were multiplexed are scaled up to the whole time they were
+  * enabled. An event that never got to run reads as unavailable.
+  */
+PerfCounters::Counts PerfCounters::read() const {
+    Counts c;
+    for (int e = 0; e != NUM_EVENTS; ++e) {
+        c.value[e] = -1;
+#ifdef __linux__
+        if (fds[e] < 0)
+            continue;
+        std::uint64_t buf[3]; // value, time enabled, time running
+        if (::read(fds[e], buf, sizeof(buf)) != sizeof(buf) || buf[2] == 0)
+            continue;
+        c.value[e] = double(buf[0]) * double(buf[1]) / double(buf[2]);
+#endif
+    }
+    return c;
+}
@@ -0,0 +1,92 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file PerfCounters.h
+ *
+ * Holds the interface to the `PerfCounters` class.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <string>
+
+/// Hardware performance counters of the calling thread
+/**
+  * Opens one Linux `perf_event_open` counter per `Event`, counting only in
+  * user space and only for the thread that constructed the object. The
+  * counters are opened separately (not as a group), so that the kernel can
+  * multiplex them if the PMU doesn't have enough registers; the counts are
+  * then scaled by the fraction of the time each counter actually ran.
+  *
+  * Opening a counter may fail, e.g. because of `kernel.perf_event_paranoid`,
+  * or inside a virtual machine, or (for the floating-point events, which
+  * are only known for Intel CPUs) on other vendors. Such counters are
+  * simply not available, and `error()` tells why; nothing is thrown.
+  *
+  * Like `Timing::Stopwatch`, the counters accumulate between `start()` and
+  * `stop()` calls, until `reset()`.
+  */
+class PerfCounters
+{
+
+public:
+
+    enum Event {
+        Cycles, Instructions, CacheMisses, BranchMisses,
+        FPScalar,   ///< scalar floating-point arithmetic instructions
+        FPPacked,   ///< SIMD (SSE/AVX) floating-point arithmetic instructions
+        NUM_EVENTS
+    };
+
+    static const char *name(Event e);
+
+    /// Counts of all events; a count is negative if its event is unavailable
+    struct Counts {
+        double value[NUM_EVENTS];
+        bool has(Event e) const { return value[e] >= 0; }
+        double operator[](Event e) const { return value[e]; }
+        /// Instructions per cycle, or a negative number
+        double ipc() const {
+            return has(Cycles) && has(Instructions) && value[Cycles] > 0 ?
+                        value[Instructions] / value[Cycles] : -1;
+        }
+        /// Divides every available count by `n`
+        Counts per(double n) const;
+    };
+
+    PerfCounters();
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool available() const; ///< whether any event could be opened
+    bool available(Event e) const { return fds[e] >= 0; }
+
+    /// Why the unavailable events couldn't be opened (empty if all opened)
+    const std::string& error() const { return error_msg; }
+
+    void start();
+    void stop();
+    void reset();
+
+    Counts read() const;
+
+private:
+    int fds[NUM_EVENTS];
+    std::string error_msg;
+
+};
+
+#endif // PERFCOUNTERS_H
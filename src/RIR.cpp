@@ -0,0 +1,214 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file RIR.cpp
+ *
+ * Holds the text parser and the file loader for room impulse responses.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#include <cctype>
+#include <cstdint>
+
+#include <algorithm>
+#include <fstream>
+#include <locale>
+#include <sstream>
+
+#include "RIR.h"
+#include "utils.h"
+
+namespace {
+
+enum CharClass : unsigned char { OTHER, SPACE, DIGIT, ALPHA };
+
+/// The class of each byte, so that the scan is one lookup per character
+struct CharTable {
+    CharClass cls[256];
+    CharTable() {
+        for (int c = 0; c != 256; ++c)
+            cls[c] = std::isspace(c) ? SPACE :
+                     std::isdigit(c) ? DIGIT :
+                     std::isalpha(c) ? ALPHA : OTHER;
+    }
+    CharClass operator()(char ch) const {
+        return cls[static_cast<unsigned char>(ch)];
+    }
+};
+
+const CharTable char_class;
+
+/// Powers of ten that are exact in a `double`
+const double POW10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/// Parses the number at `p` (which is a digit or a dot), and leaves `p` just
+/// after it; false if it is malformed or out of the range of a `double`
+/**
+  * When the exponent is small, the result is a single multiplication or
+  * division by an exact power of ten. It is correctly rounded if the digits
+  * fit in the 53 bits of a `double`, and otherwise (as with the 17 digits
+  * that MATLAB writes) it is off by at most an ulp of a `double`, far below
+  * the precision of the samples. Other numbers, which hardly ever show up
+  * in a RIR, are handed to the standard library.
+  */
+bool parse_number(const char *& p, const char *last, double& x) {
+    const char *begin = p;
+    uint64_t mant = 0;
+    int digits = 0, exp10 = 0;
+    bool any = false, exact = true;
+    auto digit = [&](int d, bool frac) {
+        any = true;
+        if (mant == 0 && d == 0) {
+            exp10 -= frac;
+            return;
+        }
+        if (digits == 19) { // no more room: drop it
+            exact = exact && d == 0;
+            exp10 += !frac;
+            return;
+        }
+        mant = 10*mant + static_cast<unsigned>(d);
+        ++digits;
+        exp10 -= frac;
+    };
+    for (; p != last && char_class(*p) == DIGIT; ++p)
+        digit(*p - '0', false);
+    if (p != last && *p == '.')
+        for (++p; p != last && char_class(*p) == DIGIT; ++p)
+            digit(*p - '0', true);
+    if (!any)
+        return false;
+    if (p != last && (*p == 'e' || *p == 'E')) {
+        ++p;
+        bool neg = false;
+        if (p != last && (*p == '+' || *p == '-'))
+            neg = *p++ == '-';
+        if (p == last || char_class(*p) != DIGIT)
+            return false;
+        int e = 0;
+        for (; p != last && char_class(*p) == DIGIT; ++p)
+            e = std::min(10*e + (*p - '0'), 100000);
+        exp10 += neg ? -e : e;
+    }
+    if (mant == 0) {
+        x = 0;
+        return true;
+    }
+    if (exact && exp10 >= -22 && exp10 <= 22) {
+        x = exp10 < 0 ? double(mant) / POW10[-exp10]
+                      : double(mant) * POW10[exp10];
+        return true;
+    }
+    std::istringstream iss(std::string(begin, p));
+    iss.imbue(std::locale::classic());
+    iss >> x;
+    return !iss.fail();
+}
+
+}
+
+/**
+  * The text is scanned once, with no copies. The number of samples is
+  * estimated beforehand from the number of separators, counted with
+  * `std::count` (a loop that the compiler vectorizes), so that the vector
+  * seldom grows while parsing.
+  */
+Signal::container_t parse_rir_text(const char *first, const char *last) {
+
+    const auto separators = std::count(first, last, ',') +
+                            std::count(first, last, '\n');
+    Signal::container_t h;
+    h.reserve(static_cast<size_t>(separators) + 1);
+
+    enum State { start, name, equals, open } pos = start;
+    bool neg = false;
+    for (const char *p = first; p != last; ) {
+        char ch = *p;
+        CharClass cls = char_class(ch);
+        if (cls == SPACE) {
+            ++p;
+            continue;
+        }
+        if (cls == DIGIT || ch == '.') {
+            double x;
+            if (!parse_number(p, last, x))
+                throw RIRParseException("Non-conforming input data.");
+            h.push_back(static_cast<Signal::sample_t>(neg ? -x : x));
+            neg = false;
+            pos = open;
+            continue;
+        }
+        if (neg) // a minus sign must be followed by a number
+            throw RIRParseException("Non-conforming input data.");
+        if (ch == ']')
+            return h;
+        ++p;
+        if (ch == ',')
+            pos = open;
+        else if (ch == '[' && pos != open)
+            pos = open;
+        else if (ch == '=' && pos != open && pos != equals)
+            pos = equals;
+        else if (ch == '-') {
+            neg = true;
+            pos = open;
+        }
+        else if (cls == ALPHA && pos == start) {
+            while (p != last && (char_class(*p) == ALPHA ||
+                                 char_class(*p) == DIGIT || *p == '_'))
+                ++p;
+            pos = name;
+        }
+        else
+            throw RIRParseException("Non-conforming input data.");
+    }
+    if (neg)
+        throw RIRParseException("Non-conforming input data.");
+    return h;
+
+}
+
+namespace {
+bool ends_with_nocase(std::string s, const std::string& suffix) {
+    for (auto& ch : s)
+        ch = static_cast<char>(std::tolower(static_cast<unsigned char>(ch)));
+    return s.size() >= suffix.size() &&
+           s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+}
+
+Signal load_rir_file(const std::string& filename) {
+    if (filename.empty())
+        return Signal{Signal::container_t(1, 1)};
+    if (ends_with_nocase(filename, ".m")) {
+        std::ifstream file(filename, std::ios::binary | std::ios::ate);
+        if (!file)
+            throw RIRInvalidException("Error opening RIR file.");
+        std::string contents(static_cast<size_t>(file.tellg()), '\0');
+        file.seekg(0);
+        if (!file.read(&contents[0],
+                       static_cast<std::streamsize>(contents.size())))
+            throw RIRInvalidException("Error reading RIR file.");
+        return Signal{parse_rir_text(contents)};
+    }
+    if (!ends_with_nocase(filename, ".wav"))
+        throw RIRInvalidException("RIR file must be *.m or *.wav.");
+    try {
+        return Signal{filename};
+    }
+    catch (const FileError&) {
+        throw RIRInvalidException("Error opening file.");
+    }
+}
@@ -0,0 +1,80 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file RIR.h
+ *
+ * Holds the exceptions, the text parser and the file loader for room impulse
+ * responses.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#ifndef RIR_H
+#define RIR_H
+
+#include <stdexcept>
+#include <string>
+
+#include "Signal.h"
+
+/*****************************************/
+/***** RIRException and its children *****/
+/*****************************************/
+
+class RIRException: public std::runtime_error {
+public:
+    RIRException(const std::string& desc)
+        : runtime_error(std::string("RIR error: ") + desc) {}
+};
+
+class RIRParseException: public RIRException {
+public:
+    RIRParseException(const std::string& desc)
+        : RIRException(std::string("Parse error: ") + desc) {}
+};
+
+class RIRSizeException: public RIRException {
+public:
+    RIRSizeException(const std::string& desc)
+        : RIRException(std::string("Size error: ") + desc) {}
+};
+
+class RIRInvalidException: public RIRException {
+public:
+    RIRInvalidException(const std::string& desc)
+        : RIRException(std::string("Invalid data: ") + desc) {}
+};
+
+/// Parses the samples of a RIR given as text
+/**
+  * Accepts a bare list of numbers, or a MATLAB-style assignment of a row
+  * vector (the format of the `*.m` RIR files). The numbers may be separated
+  * by commas or whitespace, and anything after the closing bracket is
+  * ignored.
+  *
+  * \throws RIRParseException if the text is not in that format.
+  */
+Signal::container_t parse_rir_text(const char *first, const char *last);
+
+inline Signal::container_t parse_rir_text(const std::string& txt) {
+    return parse_rir_text(txt.data(), txt.data() + txt.size());
+}
+
+/// Reads a RIR the same way a scenario does; no file means no RIR
+/**
+  * The file may be a `*.m` text file (see `parse_rir_text()`) or a `*.wav`
+  * file. An empty filename gives the unit impulse.
+  *
+  * \throws RIRException if the file can't be read or parsed.
+  */
+Signal load_rir_file(const std::string& filename);
+
+#endif // RIR_H
@@ -0,0 +1,276 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file RIRCache.cpp
+ *
+ * Holds the `RIRCache` class, which keeps loaded RIRs in binary files.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+extern "C" {
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+}
+
+#include "RIR.h"
+#include "RIRCache.h"
+#include "utils.h"
+
+namespace {
+
+const char MAGIC[8] = "ATFARIR";
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t samplerate;
+    uint64_t fft_size;
+    uint64_t taps;
+    uint64_t hash;
+};
+
+size_t align_up(size_t n) {
+    return (n + RIRCache::ALIGNMENT - 1) / RIRCache::ALIGNMENT *
+           RIRCache::ALIGNMENT;
+}
+
+/// Byte offsets of the parts of an entry
+struct Layout {
+    size_t taps, re, im, total;
+    Layout(size_t n_taps, size_t fft_size) {
+        const size_t s = sizeof(Signal::sample_t);
+        taps = align_up(sizeof(Header));
+        re = taps + align_up(n_taps * s);
+        im = re + align_up(fft_size * s);
+        total = im + align_up(fft_size * s);
+    }
+};
+
+/// Like `mkdir -p`; false if it fails
+bool make_dirs(const std::string& path) {
+    for (size_t pos = 1; pos <= path.size(); ++pos) {
+        if (pos != path.size() && path[pos] != '/')
+            continue;
+        std::string prefix = path.substr(0, pos);
+        if (mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST)
+            return false;
+    }
+    return true;
+}
+
+}
+
+RIRCache::Entry::~Entry() {
+    if (map_len != 0)
+        munmap(map, map_len);
+}
+
+RIRCache::RIRCache(int samplerate, size_t fft, size_t max,
+                   const std::string& d)
+    : srate(samplerate), fft_size(fft), max_taps(max), dir(d)
+{}
+
+std::string RIRCache::default_dir() {
+    const char *xdg = std::getenv("XDG_CACHE_HOME");
+    if (xdg && *xdg)
+        return std::string(xdg) + "/atfa/rir";
+    const char *home = std::getenv("HOME");
+    return std::string(home ? home : ".") + "/.cache/atfa/rir";
+}
+
+uint64_t RIRCache::hash_file(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file)
+        throw FileError(filename);
+    uint64_t h = 14695981039346656037ull;
+    std::vector<char> buf(1 << 16);
+    while (file) {
+        file.read(buf.data(), static_cast<std::streamsize>(buf.size()));
+        auto got = static_cast<size_t>(file.gcount());
+        for (size_t i = 0; i != got; ++i) {
+            h ^= static_cast<unsigned char>(buf[i]);
+            h *= 1099511628211ull;
+        }
+    }
+    if (file.bad())
+        throw FileError(filename);
+    return h;
+}
+
+std::string RIRCache::entry_path(uint64_t hash) const {
+    std::ostringstream oss;
+    oss << dir << '/' << std::hex;
+    oss.width(16);
+    oss.fill('0');
+    oss << hash << std::dec << '-' << srate << '-' << fft_size << ".rir";
+    return oss.str();
+}
+
+/**
+  * A file in the cache is only used if its header matches: an entry that
+  * doesn't (from another version, or truncated) is made again.
+  */
+std::shared_ptr<const RIRCache::Entry> RIRCache::get(
+        const std::string& filename) const {
+    uint64_t hash;
+    try {
+        hash = hash_file(filename);
+    } catch (const FileError&) {
+        throw RIRInvalidException("Error opening RIR file.");
+    }
+    std::string path = entry_path(hash);
+    if (auto e = map_entry(path, hash))
+        return e;
+    auto e = make_entry(filename);
+    if (!make_dirs(dir)) {
+        std::cerr << "[RIR Cache] Warning: could not create " << dir
+                  << "; the RIR won't be cached." << std::endl;
+        return e;
+    }
+    try {
+        write_entry(path, hash, *e);
+    } catch (const FileError&) {
+        std::cerr << "[RIR Cache] Warning: could not write " << path
+                  << "; the RIR won't be cached." << std::endl;
+        return e;
+    }
+    if (auto mapped = map_entry(path, hash))
+        return mapped;
+    return e;
+}
+
+std::shared_ptr<const RIRCache::Entry> RIRCache::map_entry(
+        const std::string& path, uint64_t hash) const {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+    struct stat st;
+    void *p = MAP_FAILED;
+    size_t len = 0;
+    if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(Header)) {
+        len = static_cast<size_t>(st.st_size);
+        p = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (p == MAP_FAILED)
+        return nullptr;
+
+    std::shared_ptr<Entry> e{new Entry};
+    e->map = p;
+    e->map_len = len;
+    const Header *h = static_cast<const Header *>(p);
+    if (std::memcmp(h->magic, MAGIC, sizeof(MAGIC)) != 0 ||
+            h->version != VERSION || h->hash != hash ||
+            h->samplerate != static_cast<uint32_t>(srate) ||
+            h->fft_size != fft_size || h->taps > max_taps ||
+            Layout(h->taps, fft_size).total != len)
+        return nullptr; // unmapped by the destructor
+    Layout l(h->taps, fft_size);
+    const char *base = static_cast<const char *>(p);
+    e->size_ = h->taps;
+    e->taps_ = reinterpret_cast<const sample_t *>(base + l.taps);
+    e->re_ = reinterpret_cast<const sample_t *>(base + l.re);
+    e->im_ = reinterpret_cast<const sample_t *>(base + l.im);
+    return e;
+}
+
+/**
+  * The entry is kept in memory in the same layout as in a file, so that
+  * both ways of getting an entry look the same to the caller.
+  */
+std::shared_ptr<const RIRCache::Entry> RIRCache::make_entry(
+        const std::string& filename) const {
+    Signal s = load_rir_file(filename);
+    s.set_samplerate(srate);
+    if (s.samples() > max_taps)
+        throw RIRSizeException(std::string("RIR pode ter no máximo ") +
+                               std::to_string(max_taps) +
+                               std::string(" amostras."));
+
+    Signal::container_t re(fft_size), im(fft_size);
+    std::copy(s.array(), s.array() + s.samples(), re.begin());
+    DefaultDFT dft;
+    dft(re, im);
+
+    std::shared_ptr<Entry> e{new Entry};
+    const size_t n = s.samples(), a = ALIGNMENT / sizeof(sample_t);
+    const size_t n_pad = (n + a - 1) / a * a;
+    const size_t f_pad = (fft_size + a - 1) / a * a;
+    // a vector isn't aligned to `ALIGNMENT`: leave room to start at the
+    // first multiple of it, as a mapped entry does
+    e->owned.resize(n_pad + 2*f_pad + a - 1);
+    void *p = e->owned.data();
+    size_t space = e->owned.size() * sizeof(sample_t);
+    sample_t *base = static_cast<sample_t *>(
+                std::align(ALIGNMENT, (n_pad + 2*f_pad) * sizeof(sample_t),
+                           p, space));
+    std::copy(s.array(), s.array() + n, base);
+    std::copy(re.begin(), re.end(), base + n_pad);
+    std::copy(im.begin(), im.end(), base + n_pad + f_pad);
+    e->size_ = n;
+    e->taps_ = base;
+    e->re_ = base + n_pad;
+    e->im_ = base + n_pad + f_pad;
+    return e;
+}
+
+/**
+  * The entry is written to a temporary file, which is then renamed, so that
+  * no one ever maps a half-written entry.
+  */
+void RIRCache::write_entry(const std::string& path, uint64_t hash,
+                           const Entry& e) const {
+    Layout l(e.size(), fft_size);
+    std::vector<char> buf(l.total);
+    Header h;
+    std::memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    h.version = VERSION;
+    h.samplerate = static_cast<uint32_t>(srate);
+    h.fft_size = fft_size;
+    h.taps = e.size();
+    h.hash = hash;
+    std::memcpy(buf.data(), &h, sizeof(h));
+    const size_t s = sizeof(sample_t);
+    std::memcpy(buf.data() + l.taps, e.taps(), e.size() * s);
+    std::memcpy(buf.data() + l.re, e.freq_re(), fft_size * s);
+    std::memcpy(buf.data() + l.im, e.freq_im(), fft_size * s);
+
+    std::string tmp = path + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream file(tmp, std::ios::binary);
+        file.write(buf.data(), static_cast<std::streamsize>(buf.size()));
+        file.close(); // the last of the data may only fail to go out here
+        if (!file) {
+            // a partial tmp file would never be cleaned up (nor used)
+            std::remove(tmp.c_str());
+            throw FileError(tmp);
+        }
+    }
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        throw FileError(path);
+    }
+}
@@ -0,0 +1,125 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file RIRCache.h
+ *
+ * Holds the interface to the `RIRCache` class.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#ifndef RIRCACHE_H
+#define RIRCACHE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <memory>
+#include <string>
+
+#include "Signal.h"
+
+/// On-disk cache of RIR files, ready to be given to a `Stream`
+/**
+  * Loading a RIR means parsing text or decoding a WAV file, resampling it,
+  * and computing its spectrum. The cache keeps the result of all that in a
+  * binary file, named after a hash of the contents of the RIR file, the
+  * sample rate and the FFT size, so that the next time the same RIR is
+  * loaded, all that is left is to hash the file and `mmap` the entry.
+  *
+  * An entry holds a header, then the taps, and then the real and imaginary
+  * parts of the spectrum, each part starting at a multiple of `ALIGNMENT`
+  * bytes. The cache is local to the machine: the entries are in its byte
+  * order.
+  *
+  * If the cache directory can't be written, a warning is emitted, and the
+  * RIR is still loaded, just not cached.
+  */
+class RIRCache
+{
+
+public:
+
+    typedef Signal::sample_t sample_t;
+
+    constexpr static size_t ALIGNMENT = 64;
+    constexpr static uint32_t VERSION = 1;
+
+    /// A loaded RIR: the taps, at the rate of the cache, and their spectrum
+    class Entry {
+    public:
+        ~Entry();
+        Entry(const Entry&) = delete;
+        Entry& operator=(const Entry&) = delete;
+
+        const sample_t *taps() const { return taps_; }
+        size_t size() const { return size_; }
+        /// `fft_size` values each
+        const sample_t *freq_re() const { return re_; }
+        const sample_t *freq_im() const { return im_; }
+        /// Whether it comes from a file in the cache
+        bool mapped() const { return map_len != 0; }
+
+    private:
+        friend class RIRCache;
+        Entry() : taps_(nullptr), re_(nullptr), im_(nullptr), size_(0),
+                  map(nullptr), map_len(0), owned() {}
+        const sample_t *taps_, *re_, *im_;
+        size_t size_;
+        void *map;
+        size_t map_len;
+        Signal::container_t owned; // when the entry couldn't be mapped
+    };
+
+    /// The cache for a given `Stream` configuration
+    /**
+      * \param[in] samplerate   rate to which the RIRs are resampled
+      * \param[in] fft_size     length of the spectra
+      * \param[in] max_taps     longest RIR allowed
+      * \param[in] dir          where the entries are kept
+      */
+    RIRCache(int samplerate, size_t fft_size, size_t max_taps,
+             const std::string& dir = default_dir());
+
+    /// `$XDG_CACHE_HOME/atfa/rir`, or `~/.cache/atfa/rir`
+    static std::string default_dir();
+
+    /// Loads a RIR file, from the cache if it's there
+    /**
+      * The file is read the same way as by `load_rir_file()`.
+      *
+      * \throws RIRException if the file can't be read or parsed, or if
+      * the RIR is longer than allowed.
+      */
+    std::shared_ptr<const Entry> get(const std::string& filename) const;
+
+    /// FNV-1a hash of the contents of a file
+    /// \throws FileError if the file can't be read.
+    static uint64_t hash_file(const std::string& filename);
+
+private:
+
+    std::string entry_path(uint64_t hash) const;
+    std::shared_ptr<const Entry> map_entry(const std::string& path,
+                                           uint64_t hash) const;
+    std::shared_ptr<const Entry> make_entry(const std::string& filename)
+        const;
+    void write_entry(const std::string& path, uint64_t hash,
+                     const Entry& e) const;
+
+    int srate;
+    size_t fft_size;
+    size_t max_taps;
+    std::string dir;
+
+};
+
+#endif // RIRCACHE_H
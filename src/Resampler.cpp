@@ -0,0 +1,189 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file Resampler.cpp
+ *
+ * Holds the `Resampler` class, which converts signals between sample rates.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#include <cmath>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Resampler.h"
+
+namespace {
+
+constexpr double KAISER_BETA = 8.6; // about 85 dB of stopband attenuation
+constexpr unsigned LANES = 8; // independent sums in the dot products
+
+unsigned long gcd(unsigned long a, unsigned long b) {
+    while (b != 0) {
+        unsigned long t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/// Modified Bessel function of the first kind, of order zero
+double bessel_i0(double x) {
+    double sum = 1, term = 1;
+    for (int k = 1; term > 1e-12 * sum; ++k) {
+        term *= (x / (2*k)) * (x / (2*k));
+        sum += term;
+    }
+    return sum;
+}
+
+}
+
+Resampler::Resampler(int from, int to) {
+    if (from <= 0 || to <= 0)
+        throw std::invalid_argument("Sample rates must be positive.");
+    unsigned long f = static_cast<unsigned long>(from);
+    unsigned long t = static_cast<unsigned long>(to);
+    unsigned long g = gcd(f, t);
+    L = t / g;
+    M = f / g;
+    bank = get_bank(L, M);
+}
+
+Resampler::index_t Resampler::output_size(index_t n) const {
+    return static_cast<index_t>(
+                static_cast<unsigned long long>(n) * L / M);
+}
+
+std::shared_ptr<const Resampler::Bank> Resampler::get_bank(unsigned long L,
+                                                           unsigned long M) {
+    static std::mutex mtx;
+    static std::map<std::pair<unsigned long, unsigned long>,
+                    std::shared_ptr<const Bank>> cache;
+    std::lock_guard<std::mutex> lock(mtx);
+    auto& b = cache[std::make_pair(L, M)];
+    if (!b)
+        b = make_bank(L, M);
+    return b;
+}
+
+/**
+  * The coefficient of phase \f$p\f$ and tap \f$k\f$ multiplies the input
+  * sample that is \f$p/P + K/2 - 1 - k\f$ input samples before the output
+  * sample, where \f$P\f$ is the number of phases and \f$K\f$ the number of
+  * taps. Each phase is normalized to unit DC gain.
+  */
+std::shared_ptr<const Resampler::Bank> Resampler::make_bank(unsigned long L,
+                                                            unsigned long M) {
+    auto bank = std::make_shared<Bank>();
+    // how much wider the sinc is, in input samples, when downsampling
+    unsigned stretch = static_cast<unsigned>((M + L - 1) / L);
+    double cutoff = std::min(1.0, double(L) / double(M));
+    bank->phases = static_cast<unsigned>(std::min<unsigned long>(L,
+                                                                 MAX_PHASES));
+    bank->taps = 2 * ZERO_CROSSINGS * stretch;
+    bank->h.resize(bank->phases * bank->taps);
+    const double half = bank->taps / 2;
+    const double i0_beta = bessel_i0(KAISER_BETA);
+    for (unsigned p = 0; p != bank->phases; ++p) {
+        sample_t *row = &bank->h[p * bank->taps];
+        double sum = 0;
+        std::vector<double> c(bank->taps);
+        for (unsigned k = 0; k != bank->taps; ++k) {
+            double t = double(p) / bank->phases + half - 1 - k;
+            double u = cutoff * t;
+            double sinc = u == 0 ? 1 : std::sin(M_PI * u) / (M_PI * u);
+            double r = t / half;
+            double win = std::abs(r) >= 1 ? 0 :
+                         bessel_i0(KAISER_BETA * std::sqrt(1 - r*r)) / i0_beta;
+            c[k] = sinc * win;
+            sum += c[k];
+        }
+        for (unsigned k = 0; k != bank->taps; ++k)
+            row[k] = static_cast<sample_t>(c[k] / sum);
+    }
+    return bank;
+}
+
+/**
+  * The dot products are summed in `LANES` independent partial sums, and the
+  * taps are a multiple of `LANES`, so that the compiler can vectorize them.
+  * Samples before and after the input are zero: near its ends, the taps
+  * that reach them are read from a zero-padded copy of just those samples.
+  */
+void Resampler::run(const sample_t *in, index_t n, sample_t *out,
+                    index_t first, index_t last) const {
+    const unsigned K = bank->taps;
+    const unsigned long long P = bank->phases;
+    Signal::container_t edge(K);
+    for (index_t m = first; m != last; ++m) {
+        unsigned long long pos = static_cast<unsigned long long>(m) * M;
+        index_t base = static_cast<index_t>(pos / L);
+        unsigned long long p = pos % L;
+        if (P != L) // nearest of the phases in the bank
+            p = (p * P + L/2) / L;
+        if (p == P) { // rounded up to the next input sample
+            p = 0;
+            ++base;
+        }
+        // the taps reach from input sample base + 1 - K/2 to base + K/2
+        const sample_t *x;
+        if (base + 1 >= K/2 && base + K/2 < n)
+            x = in + (base + 1 - K/2);
+        else {
+            for (unsigned k = 0; k != K; ++k) {
+                index_t i = base + 1 + k; // plus K/2
+                edge[k] = i >= K/2 && i - K/2 < n ? in[i - K/2] : 0;
+            }
+            x = edge.data();
+        }
+        const sample_t *h = &bank->h[static_cast<size_t>(p) * K];
+        sample_t acc[LANES] = {};
+        for (unsigned k = 0; k != K; k += LANES)
+            for (unsigned j = 0; j != LANES; ++j)
+                acc[j] += x[k + j] * h[k + j];
+        sample_t y = 0;
+        for (unsigned j = 0; j != LANES; ++j)
+            y += acc[j];
+        out[m] = y;
+    }
+}
+
+void Resampler::operator()(const sample_t *in, index_t n,
+                           sample_t *out) const {
+    const index_t N = output_size(n);
+    if (N == 0)
+        return;
+    unsigned threads = 1;
+    if (N >= PARALLEL_SAMPLES)
+        threads = static_cast<unsigned>(std::min<index_t>(
+                    std::max(1u, std::thread::hardware_concurrency()),
+                    N / (PARALLEL_SAMPLES / 4)));
+    if (threads == 1) {
+        run(in, n, out, 0, N);
+        return;
+    }
+    std::vector<std::thread> workers;
+    index_t step = (N + threads - 1) / threads;
+    for (index_t first = step; first < N; first += step)
+        workers.emplace_back(&Resampler::run, this, in, n, out,
+                             first, std::min(first + step, N));
+    run(in, n, out, 0, step);
+    for (auto& w : workers)
+        w.join();
+}
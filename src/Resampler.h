@@ -0,0 +1,93 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file Resampler.h
+ *
+ * Holds the interface to the `Resampler` class.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <memory>
+
+#include "Signal.h"
+
+/// Band-limited sample rate conversion by a rational factor
+/**
+  * Converting from `from` to `to` Hz is upsampling by \f$L\f$, lowpass
+  * filtering, and downsampling by \f$M\f$, where \f$L/M\f$ is `to`/`from` in
+  * lowest terms. The filter is a Kaiser-windowed sinc, with its cutoff at the
+  * lower of the two Nyquist frequencies, and it is split in \f$L\f$ phases
+  * (the polyphase filter bank) so that only the products that make it to the
+  * output are computed: each output sample is the dot product of `taps()`
+  * input samples with one of the phases.
+  *
+  * The banks are expensive to make, so they are cached, one per pair of
+  * rates, and shared by all the resamplers of that pair. When \f$L\f$ is
+  * larger than `MAX_PHASES`, the bank only has `MAX_PHASES` phases, and each
+  * output sample uses the nearest one.
+  *
+  * Long signals are split among a few threads (see `PARALLEL_SAMPLES`).
+  */
+class Resampler
+{
+
+public:
+
+    typedef Signal::sample_t sample_t;
+    typedef Signal::index_t index_t;
+
+    /// Zero crossings of the sinc on each side of its center, at the lower
+    /// rate
+    constexpr static unsigned ZERO_CROSSINGS = 16;
+    constexpr static unsigned MAX_PHASES = 4096;
+    /// Outputs with at least this many samples are made by many threads
+    constexpr static index_t PARALLEL_SAMPLES = 1 << 18;
+
+    /// \throws std::invalid_argument if a rate isn't positive.
+    Resampler(int from, int to);
+
+    /// Number of output samples for `n` input samples
+    index_t output_size(index_t n) const;
+
+    /// Converts the `n` samples at `in`, writing `output_size(n)` samples at
+    /// `out`; besides them, it only needs `taps()` samples per thread
+    void operator()(const sample_t *in, index_t n, sample_t *out) const;
+
+    /// Length of each phase of the filter
+    unsigned taps() const { return bank->taps; }
+
+private:
+
+    struct Bank {
+        unsigned phases;
+        unsigned taps;
+        Signal::container_t h; ///< `phases` rows of `taps` coefficients
+    };
+
+    static std::shared_ptr<const Bank> get_bank(unsigned long L,
+                                                unsigned long M);
+    static std::shared_ptr<const Bank> make_bank(unsigned long L,
+                                                 unsigned long M);
+
+    /// Makes the output samples in `[first, last)`
+    void run(const sample_t *in, index_t n, sample_t *out,
+             index_t first, index_t last) const;
+
+    unsigned long L, M;
+    std::shared_ptr<const Bank> bank;
+
+};
+
+#endif // RESAMPLER_H
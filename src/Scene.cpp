@@ -7,8 +7,8 @@
  * Orientador: Markus Lima
  */
 
-#include "dialogs/ChangeRIRDialog.h"
 #include "Stream.h"
+#include "RIR.h"
 #include "utils.h"
 
 template<>
@@ -74,6 +74,43 @@ Scene::Scenario(const QJsonObject &json, int delay_max)
     else
         filter_learning = DEFAULT_FLEARN;
 
+    // dtd_enabled
+    if (json.contains(QStringLiteral("dtd_enabled"))) {
+        if (!json["dtd_enabled"].isBool())
+            throw SceneJsonInvfieldException(
+                    "dtd_enabled", "this field should be a boolean.");
+        dtd_enabled = json["dtd_enabled"].toBool();
+    }
+    else
+        dtd_enabled = false;
+
+    // dtd_geigel_db
+    if (json.contains(QStringLiteral("dtd_geigel_db"))) {
+        int json_geigel = json["dtd_geigel_db"].toInt();
+        if (json_geigel < -30 || json_geigel > 30)
+            throw SceneJsonOOBException("dtd_geigel_db", json_geigel,
+                                        -30, 30);
+        dtd_geigel_db = json_geigel;
+    }
+    else
+        dtd_geigel_db = DoubleTalkDetector::DEFAULT_GEIGEL_DB;
+
+    // dtd_ncc_percent
+    if (json.contains(QStringLiteral("dtd_ncc_percent"))) {
+        int json_ncc = json["dtd_ncc_percent"].toInt();
+        if (json_ncc < 0 || json_ncc > 100)
+            throw SceneJsonOOBException("dtd_ncc_percent", json_ncc, 0, 100);
+        dtd_ncc_percent = json_ncc;
+    }
+    else
+        dtd_ncc_percent = DoubleTalkDetector::DEFAULT_NCC_PERCENT;
+
+    // near_end_file
+    if (json.contains(QStringLiteral("near_end_file")))
+        near_end_file = json["near_end_file"].toString();
+    else
+        near_end_file = QStringLiteral("");
+
     // rir_source
     if (json.contains(QStringLiteral("rir_source"))) {
         const QString &rirsource_str = json["rir_source"].toString();
@@ -187,8 +224,9 @@ Scene::Scenario(const QJsonObject &json, int delay_max)
                 QFile file(rir_file);
                 if (!file.open(QIODevice::ReadOnly))
                     throw RIRInvalidException("Error opening RIR file.");
-                imp_resp = ChangeRIRDialog::parse_txt(
-                            file.readAll().constData());
+                QByteArray txt = file.readAll();
+                imp_resp = parse_rir_text(txt.constData(),
+                                          txt.constData() + txt.size());
             }
             else {
                 try {
@@ -220,6 +258,87 @@ Scene::Scenario(const QJsonObject &json, int delay_max)
         //       só pra pegar o path e jogar o filtro fora é overkill
         adapf_file = AdaptiveFilter<sample_t>().get_path();
 
+    // adapf_isolated
+    if (json.contains(QStringLiteral("adapf_isolated"))) {
+        if (!json["adapf_isolated"].isBool())
+            throw SceneJsonInvfieldException(
+                    "adapf_isolated", "this field should be a boolean.");
+        adapf_isolated = json["adapf_isolated"].toBool();
+    }
+    else
+        adapf_isolated = false;
+
+    // adapf_state_file
+    if (json.contains(QStringLiteral("adapf_state_file")))
+        adapf_state_file = json["adapf_state_file"].toString();
+    else
+        adapf_state_file = QStringLiteral("");
+
+    // watchdog_action
+    if (json.contains(QStringLiteral("watchdog_action"))) {
+        const QString &action_str = json["watchdog_action"].toString();
+        bool ok;
+        watchdog_action = Watchdog::action_from_name(
+                    action_str.toUtf8().constData(), &ok);
+        if (!ok)
+            throw SceneJsonInvtokenException(
+                    "in watchdog_action",
+                    "one of {Off,Restart,Freeze,Abort}",
+                    action_str.toUtf8().constData());
+    }
+    else
+        watchdog_action = Watchdog::DEFAULT_ACTION;
+
+    // watchdog_energy_ratio_db
+    if (json.contains(QStringLiteral("watchdog_energy_ratio_db"))) {
+        int json_ratio = json["watchdog_energy_ratio_db"].toInt();
+        if (json_ratio < 0 || json_ratio > 60)
+            throw SceneJsonOOBException("watchdog_energy_ratio_db", json_ratio,
+                                        0, 60);
+        watchdog_energy_ratio_db = json_ratio;
+    }
+    else
+        watchdog_energy_ratio_db = Watchdog::DEFAULT_ENERGY_RATIO_DB;
+
+    // watchdog_max_coef_norm
+    if (json.contains(QStringLiteral("watchdog_max_coef_norm"))) {
+        int json_norm = json["watchdog_max_coef_norm"].toInt();
+        if (json_norm < 1 || json_norm > 1000000)
+            throw SceneJsonOOBException("watchdog_max_coef_norm", json_norm,
+                                        1, 1000000);
+        watchdog_max_coef_norm = json_norm;
+    }
+    else
+        watchdog_max_coef_norm = Watchdog::DEFAULT_MAX_COEF_NORM;
+
+    // coef_trace_file
+    if (json.contains(QStringLiteral("coef_trace_file")))
+        coef_trace_file = json["coef_trace_file"].toString();
+    else
+        coef_trace_file = QStringLiteral("");
+
+    // coef_trace_decimation
+    if (json.contains(QStringLiteral("coef_trace_decimation"))) {
+        int json_decim = json["coef_trace_decimation"].toInt();
+        if (json_decim < 1 || json_decim > 65536)
+            throw SceneJsonOOBException("coef_trace_decimation", json_decim,
+                                        1, 65536);
+        coef_trace_decimation = json_decim;
+    }
+    else
+        coef_trace_decimation = CoefTrace::DEFAULT_DECIMATION;
+
+    // coef_trace_taps
+    if (json.contains(QStringLiteral("coef_trace_taps"))) {
+        int json_taps = json["coef_trace_taps"].toInt();
+        if (json_taps < 1 || json_taps > 65536)
+            throw SceneJsonOOBException("coef_trace_taps", json_taps,
+                                        1, 65536);
+        coef_trace_taps = json_taps;
+    }
+    else
+        coef_trace_taps = CoefTrace::DEFAULT_TAPS;
+
 }
 
 void Scene::save_to_file() const {
@@ -246,6 +365,15 @@ QJsonDocument Scene::to_json() const {
                     "Unknown error, bad value for filter_learning.");
     }
 
+    // dtd_enabled, dtd_geigel_db & dtd_ncc_percent
+    json["dtd_enabled"] = dtd_enabled;
+    json["dtd_geigel_db"] = dtd_geigel_db;
+    json["dtd_ncc_percent"] = dtd_ncc_percent;
+
+    // near_end_file
+    if (!near_end_file.isEmpty())
+        json["near_end_file"] = near_end_file;
+
     // rir_source
     switch (rir_source) {
     case NoRIR:
@@ -288,6 +416,26 @@ QJsonDocument Scene::to_json() const {
     // adapf_file
     json["adapf_file"] = adapf_file.c_str();
 
+    // adapf_isolated
+    if (adapf_isolated)
+        json["adapf_isolated"] = true;
+
+    // adapf_state_file
+    if (!adapf_state_file.isEmpty())
+        json["adapf_state_file"] = adapf_state_file;
+
+    // watchdog_action, watchdog_energy_ratio_db & watchdog_max_coef_norm
+    json["watchdog_action"] = Watchdog::action_name(watchdog_action);
+    json["watchdog_energy_ratio_db"] = watchdog_energy_ratio_db;
+    json["watchdog_max_coef_norm"] = watchdog_max_coef_norm;
+
+    // coef_trace_file, coef_trace_decimation & coef_trace_taps
+    if (!coef_trace_file.isEmpty()) {
+        json["coef_trace_file"] = coef_trace_file;
+        json["coef_trace_decimation"] = coef_trace_decimation;
+        json["coef_trace_taps"] = coef_trace_taps;
+    }
+
     return QJsonDocument(json);
 
 }
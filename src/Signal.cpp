@@ -16,6 +16,7 @@
  * \author Pedro Angelo Medeiros Fonini
  */
 
+#include <algorithm>
 #include <iostream>
 #include <stdexcept>
 #include <cmath>
@@ -25,7 +26,9 @@ extern "C" {
 #   include <sndfile.hh>
 }
 
+#include "Resampler.h"
 #include "Signal.h"
+#include "SignalSource.h"
 
 template <>
 const std::vector<double> DefaultDFT::costbl = DefaultDFT::initialize_costbl();
@@ -51,6 +54,10 @@ static int signal_callback(
   *
   * The sample rate is extracted from the file's meta-data info.
   *
+  * The file is read through a `SndFileSource`, a chunk at a time, so the
+  * other channels are never held in memory, and neither is a second copy of
+  * the samples.
+  *
   * [libsndfile]: http://www.mega-nerd.com/libsndfile/
   * [libsndfile_features]: http://www.mega-nerd.com/libsndfile/#Features
   *
@@ -63,33 +70,43 @@ static int signal_callback(
 Signal::Signal(const std::string &filename)
     : counter(0), srate(0)
 {
-
-    // open file
-    SNDFILE *file;
-    SF_INFO info;
-    if (!( file = sf_open(filename.c_str(), SFM_READ, &info) ))
+    SndFileSource source{filename};
+    read(source, std::numeric_limits<index_t>::max());
+    if (samples() != source.frames())
         throw FileError(filename);
+}
 
-    // check number of channels
-    long chans = info.channels;
-    if (chans > 1)
-        std::cerr << "Warning: file " << filename << " has more than one" <<
-                     " channel." << std::endl << "  We will use just the" <<
-                     " first (which is the left channel on stereo WAV files).";
-
-    // set properties
-    set_size(static_cast<index_t>(info.frames));
-    srate = info.samplerate;
-
-    // read file
-    long wav_samples = static_cast<long>(samples()) * chans;
-    container_t buf(static_cast<long unsigned>(wav_samples));
-    long items_read = sf_read_float(file, &buf[0], wav_samples);
-    if (items_read != wav_samples)
-        throw FileError(filename);
-    for (index_t i = 0; i < samples(); ++i)
-        data[i] = buf[i*static_cast<long unsigned>(chans)];
+/**
+  * Reads the samples of a source, a chunk at a time, straight into the
+  * signal; if the source knows its length, no memory is used besides that of
+  * the samples. Reading starts wherever the source is.
+  *
+  * \param[in]  source      Where the samples come from.
+  * \param[in]  max_samples Stop after this many samples, even if the source
+  *                         has more.
+  *
+  * \throws FileError if reading fails.
+  */
+Signal::Signal(SignalSource& source, index_t max_samples)
+    : counter(0), srate(0)
+{
+    read(source, max_samples);
+}
 
+void Signal::read(SignalSource& source, index_t max_samples) {
+    srate = source.samplerate();
+    if (source.frames() != 0)
+        data.reserve(std::min(source.frames(), max_samples));
+    while (data.size() < max_samples) {
+        index_t old_size = data.size();
+        index_t want = std::min(max_samples - old_size,
+                                SndFileSource::CHUNK_FRAMES);
+        data.resize(old_size + want);
+        index_t got = source.read(&data[old_size], want);
+        data.resize(old_size + got);
+        if (got < want)
+            break;
+    }
 }
 
 /**
@@ -240,40 +257,47 @@ void Signal::play(bool sleep) {
 }
 
 /**
-  * Changes the sample rate of the signal. The way it is done, this is
-  * equivalent to reconstructing the time-domain signal by linear interpolation,
-  * and then re-sampling the continuous-time reconstructed signal at the new
-  * sample rate.
+  * Changes the sample rate of the signal. This is done by a `Resampler`,
+  * which is equivalent to reconstructing the band-limited continuous-time
+  * signal, filtering out what lies above the new Nyquist frequency (if it is
+  * lower), and re-sampling it at the new sample rate. The filters for each
+  * pair of rates are computed only once.
+  *
+  * If the signal has no sample rate yet, it is just set.
   *
   * \param[in]  sr      The new sample rate in Hertz.
   *
   * \see srate
   */
 void Signal::set_samplerate(int sr) {
-    if (srate == 0) {
+    if (srate == 0 || srate == sr) {
         srate = sr;
         return;
     }
-    index_t N = std::floor(double(sr) * samples() / srate);
-    container_t new_data(N);
-    for (index_t i = 0; i < N; i++) {
-        double x = double(i) * (samples()-1) / (N-1);
-        new_data[i] = (std::floor(x+1) - x) * data[(index_t)std::floor(x)] +
-                      (x - std::floor(x))   * data[(index_t)std::ceil(x)];
-    }
-    data = new_data;
+    Resampler resample(srate, sr);
+    container_t new_data(resample.output_size(samples()));
+    resample(data.data(), samples(), new_data.data());
+    data.swap(new_data);
     srate = sr;
 }
 
 /**
-  * First, we re-sample \a other into a new temporary signal. Then we increase
-  * the caller's size if needed, and finally add the signals sample-by-sample.
+  * The samples of \a other are added in place. Only if its sample rate is not
+  * the same as the caller's (and neither is unknown), it is first re-sampled
+  * into a temporary signal. The caller grows if needed.
   *
   * \param[in]  other      The signal to be added to the caller.
   * \returns    a reference to this signal, already added to the `other`.
   */
-Signal& Signal::operator +=(Signal other) {
-    other.set_samplerate(srate);
+Signal& Signal::operator +=(SignalView other) {
+    Signal resampled;
+    if (other.samplerate() != 0 && srate != 0 &&
+            other.samplerate() != srate) {
+        resampled.data.assign(other.begin(), other.end());
+        resampled.srate = other.samplerate();
+        resampled.set_samplerate(srate);
+        other = resampled;
+    }
     if (other.samples() > samples())
         set_size(other.samples());
     for (index_t i = 0; i < other.samples(); i++)
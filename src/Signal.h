@@ -21,10 +21,16 @@
 
 #include <cmath>
 
+#include <algorithm>
+#include <limits>
+#include <utility>
 #include <vector>
 
 #include "utils.h"
 
+class SignalSource;
+class SignalView;
+
 /// A time- or frequency-domain signal
 /**
   * Holds data and provides routines for dealing with time-domain and
@@ -62,6 +68,10 @@ public:
     /// Constructs a signal from an audio file.
     explicit Signal(const std::string &filename);
 
+    /// Constructs a signal from the samples of a source.
+    explicit Signal(SignalSource& source,
+                    index_t max_samples = std::numeric_limits<index_t>::max());
+
     /// Copy-constructor. Constructs a signal as a copy of another.
     /**
       * Constructs a signal as a copy of another one. If this signal is not
@@ -73,10 +83,38 @@ public:
         : counter(0), data(other.data), srate(other.srate)
     {}
 
+    /// Move-constructor. Takes the samples of another signal, which is left
+    /// empty.
+    Signal(Signal&& other) noexcept
+        : counter(0), data(std::move(other.data)), srate(other.srate)
+    {}
+
     explicit Signal(const container_t& other)
         : counter{}, data{other}, srate{}
     {}
 
+    explicit Signal(container_t&& other)
+        : counter{}, data{std::move(other)}, srate{}
+    {}
+
+    /// Copies the samples and the sample rate of another signal; like the
+    /// constructors, it resets `counter`.
+    Signal& operator =(const Signal& other) {
+        counter = 0;
+        data = other.data;
+        srate = other.srate;
+        return *this;
+    }
+
+    /// Takes the samples and the sample rate of another signal, which is
+    /// left empty; like the constructors, it resets `counter`.
+    Signal& operator =(Signal&& other) noexcept {
+        counter = 0;
+        data = std::move(other.data);
+        srate = other.srate;
+        return *this;
+    }
+
     /// Frees memory used
     /**
       * Free the pointer to the array of samples.
@@ -91,7 +129,7 @@ public:
       * \returns a pointer to the first element of a contiguous region of memory
       * that holds the samples.
       */
-    const sample_t *array() const { return &data[0]; }
+    const sample_t *array() const { return data.data(); }
     // TODO: esse array() deveria se chamar begin(), e deveria ter um end()
 
     /// Number of samples.
@@ -169,7 +207,7 @@ public:
     void normalize() { gain(1.0/l_inf_norm()); }
 
     /// Adds the \a other signal to the caller.
-    Signal& operator +=(Signal other);
+    Signal& operator +=(SignalView other);
 
     /// Makes PortAudio playback the audio signal.
     void play(bool sleep=true);
@@ -402,13 +440,21 @@ public:
 
     };
 
-    static DFTDriver<> dft; ///< Single instance of the DFTDriver class.
+    /// Single instance of the DFTDriver class.
+    /**
+      * A driver keeps the size of the FFT it is computing, so this one can't
+      * be used by two threads at once.
+      */
+    static DFTDriver<> dft;
 
     /// Convolves the sinal with an impulse response.
     template<class DFT=DFTDriver<> >
-    void filter(Signal imp_resp);
+    void filter(SignalView imp_resp);
 
 private:
+    /// Appends up to `max_samples` samples of `source`.
+    void read(SignalSource& source, index_t max_samples);
+
     container_t data; ///< Holds the signal samples.
     int srate; ///< %Signal sample rate in Hertz.
 
@@ -416,12 +462,55 @@ private:
 
 using DefaultDFT = Signal::DFTDriver<>;
 
+/// Read-only samples that belong to someone else
+/**
+  * A pointer, a number of samples and a sample rate: what the operations
+  * that only read a signal need, without copying it. It may look at a
+  * whole `Signal` (to which it converts implicitly), at a `container_t`, or
+  * at any part of them; whatever it looks at must outlive it.
+  */
+class SignalView
+{
+public:
+    typedef Signal::sample_t sample_t;
+    typedef Signal::index_t index_t;
+
+    SignalView(const sample_t *samples, index_t count, int samplerate = 0)
+        : first(samples), n(count), srate(samplerate) {}
+    SignalView(const Signal& s)
+        : first(s.array()), n(s.samples()), srate(s.samplerate()) {}
+    explicit SignalView(const Signal::container_t& c, int samplerate = 0)
+        : first(c.data()), n(c.size()), srate(samplerate) {}
+
+    const sample_t *begin() const { return first; }
+    const sample_t *end() const { return first + n; }
+    index_t samples() const { return n; }
+    int samplerate() const { return srate; }
+    const sample_t& operator [](index_t index) const { return first[index]; }
+
+    /// The `count` samples from `start` on (or fewer, at the end)
+    SignalView slice(index_t start, index_t count) const {
+        start = std::min(start, n);
+        return SignalView(first + start, std::min(count, n - start), srate);
+    }
+
+private:
+    const sample_t *first;
+    index_t n;
+    int srate;
+};
+
 /// Adds two signals
 /**
+  * If `lhs` is a temporary, its samples are reused for the result, so that
+  * e.g. `a + b + c` allocates only once.
+  *
   * \see Signal::operator+=
   */
-inline Signal operator +(Signal lhs, const Signal& rhs)
-    { return lhs += rhs; }
+inline Signal operator +(Signal lhs, SignalView rhs) {
+    lhs += rhs;
+    return lhs;
+}
 
 /**
   * Convolves the signal with the given finite impulse response (FIR).
@@ -435,18 +524,24 @@ inline Signal operator +(Signal lhs, const Signal& rhs)
   * \see DFTDriver::operator()
   */
 template<class DFT>
-void Signal::filter(Signal imp_resp) {
-    imp_resp.set_samplerate(srate);
+void Signal::filter(SignalView imp_resp) {
+    DFT dft; // not the static one, so that signals can be filtered in parallel
+    Signal resampled; // only if the rates differ
+    if (imp_resp.samplerate() != 0 && srate != 0 &&
+            imp_resp.samplerate() != srate) {
+        resampled.data.assign(imp_resp.begin(), imp_resp.end());
+        resampled.srate = imp_resp.samplerate();
+        resampled.set_samplerate(srate);
+        imp_resp = resampled;
+    }
     index_t final_size = samples() + imp_resp.samples() - 1;
     if (final_size > DFT::tblsize) {
         // divide the signal in chunks of size N such that N+K-1==tblsize
-        container_t *big, *small;
+        SignalView big = imp_resp, small = *this;
         if (samples() > imp_resp.samples())
-            big = &data, small = &imp_resp.data;
-        else
-            big = &imp_resp.data, small = &data;
+            std::swap(big, small);
         long N = static_cast<long>(DFT::tblsize) -
-                static_cast<long>(small->size()) + 1l;
+                static_cast<long>(small.samples()) + 1l;
         container_t conv(final_size);
         if (N <= 0) {
             // fall back to time-domain filtering
@@ -459,7 +554,7 @@ void Signal::filter(Signal imp_resp) {
             for (index_t i = 0; i < conv.size()-samples(); i++)
                 for (index_t j = i+1; j < imp_resp.samples(); j++)
                     conv[samples()+i] += data[samples()+i-j] * imp_resp[j];
-            data = conv; // destroy old data, and copy new from `conv'
+            data.swap(conv);
             return;
         }
         container_t h_re(DFT::tblsize);
@@ -468,21 +563,22 @@ void Signal::filter(Signal imp_resp) {
         container_t x2(DFT::tblsize);
         container_t y1(DFT::tblsize);
         container_t y2(DFT::tblsize);
-        std::copy(small->begin(), small->end(), h_re.begin());
+        std::copy(small.begin(), small.end(), h_re.begin());
         dft(h_re, h_im);
         index_t i;
         // TODO: ao invés de incrementar o 'i' e calcular i1 e i2 a cada
         // iteração, a gente podia calcular diretamente o i1 e i2, e.g.:
-        // for (i1=0, i2=N ; i1 < big->size() ; i1+=2*N, i2+=2*N)
-        for (i = 0; i != big->size()/(2*static_cast<unsigned long>(N)); ++i) {
+        // for (i1=0, i2=N ; i1 < big.samples() ; i1+=2*N, i2+=2*N)
+        for (i = 0; i != big.samples()/(2*static_cast<unsigned long>(N));
+             ++i) {
             index_t i1 = i*2*static_cast<unsigned long>(N);
             index_t i2 = i1 + static_cast<unsigned long>(N);
-            std::copy(big->begin() + static_cast<long>(i1),
-                      big->begin() + static_cast<long>(i1) + N,
+            std::copy(big.begin() + static_cast<long>(i1),
+                      big.begin() + static_cast<long>(i1) + N,
                       x1.begin());
             std::fill(x1.begin() + N, x1.end(), 0);
-            std::copy(big->begin() + static_cast<long>(i2),
-                      big->begin() + static_cast<long>(i2) + N,
+            std::copy(big.begin() + static_cast<long>(i2),
+                      big.begin() + static_cast<long>(i2) + N,
                       x2.begin());
             std::fill(x2.begin() + N, x2.end(), 0);
             dft(x1, x2);
@@ -499,14 +595,14 @@ void Signal::filter(Signal imp_resp) {
         {
             index_t i1 = i*2*static_cast<unsigned long>(N);
             index_t i2 = i1 + static_cast<unsigned long>(N);
-            long L = static_cast<long>(big->size() - i1);
+            long L = static_cast<long>(big.samples() - i1);
             if (L > N) {
-                std::copy(big->begin() + static_cast<long>(i1),
-                          big->begin() + static_cast<long>(i1) + N,
+                std::copy(big.begin() + static_cast<long>(i1),
+                          big.begin() + static_cast<long>(i1) + N,
                           x1.begin());
                 std::fill(x1.begin() + N, x1.end(), 0);
-                std::copy(big->begin() + static_cast<long>(i2),
-                          big->end(),
+                std::copy(big.begin() + static_cast<long>(i2),
+                          big.end(),
                           x2.begin());
                 std::fill(x2.begin() + (L-N), x2.end(), 0);
                 dft(x1, x2);
@@ -519,13 +615,13 @@ void Signal::filter(Signal imp_resp) {
                     conv[i1 + j] += y1[j];
                 for (index_t j = 0;
                      static_cast<long>(j) !=
-                         L-N+static_cast<long>(small->size())-1;
+                         L-N+static_cast<long>(small.samples())-1;
                      ++j)
                     conv[i2 + j] += y2[j];
             }
             else {
-                std::copy(big->begin() + static_cast<long>(i1),
-                          big->end(),
+                std::copy(big.begin() + static_cast<long>(i1),
+                          big.end(),
                           x1.begin());
                 std::fill(x1.begin() + L, x1.end(), 0);
                 std::fill(x2.begin(), x2.end(), 0);
@@ -537,12 +633,12 @@ void Signal::filter(Signal imp_resp) {
                 dft(y1, y2, DFT::INVERSE);
                 for (index_t j = 0;
                      static_cast<long>(j) !=
-                         L+static_cast<long>(small->size())-1;
+                         L+static_cast<long>(small.samples())-1;
                      ++j)
                     conv[i1 + j] += y1[j];
             }
         }
-        data = conv; // destroy old data, and copy new from `conv'
+        data.swap(conv);
     }
     else {
         // fit the whole signal in only one fft
@@ -555,11 +651,11 @@ void Signal::filter(Signal imp_resp) {
         container_t x2(L);
         container_t y1(L);
         container_t y2(L);
-        std::copy(imp_resp.data.begin(), imp_resp.data.end(), h_re.begin());
+        std::copy(imp_resp.begin(), imp_resp.end(), h_re.begin());
         dft(h_re, h_im);
         std::copy(data.begin(), data.end(), x1.begin());
         dft(x1, x2);
-        for (index_t j = 0; j != DFT::tblsize; ++j) {
+        for (index_t j = 0; j != L; ++j) {
             y1[j] = x1[j]*h_re[j] - x2[j]*h_im[j];
             y2[j] = x1[j]*h_im[j] + x2[j]*h_re[j];
         }
@@ -0,0 +1,80 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file SignalSource.cpp
+ *
+ * Holds the libsndfile implementation of `SignalSource`.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#include <cstdio>
+
+#include <algorithm>
+#include <iostream>
+
+#include "SignalSource.h"
+#include "utils.h"
+
+SndFileSource::SndFileSource(const std::string& fn)
+    : filename(fn), file(nullptr), info(), chunk()
+{
+    if (!( file = sf_open(filename.c_str(), SFM_READ, &info) ))
+        throw FileError(filename);
+    if (info.channels > 1) {
+        std::cerr << "Warning: file " << filename << " has more than one" <<
+                     " channel." << std::endl << "  We will use just the" <<
+                     " first (which is the left channel on stereo WAV files)."
+                  << std::endl;
+        chunk.resize(CHUNK_FRAMES * static_cast<unsigned long>(info.channels));
+    }
+}
+
+SndFileSource::~SndFileSource() {
+    sf_close(file);
+}
+
+unsigned long SndFileSource::frames() const {
+    return static_cast<unsigned long>(info.frames);
+}
+
+/**
+  * Mono files are read straight into `dst`; the others go through a chunk
+  * of interleaved samples, from which the first channel is copied.
+  */
+unsigned long SndFileSource::read(float *dst, unsigned long n) {
+    if (info.channels == 1) {
+        sf_count_t got = sf_readf_float(file, dst, static_cast<sf_count_t>(n));
+        if (got < 0)
+            throw FileError(filename);
+        return static_cast<unsigned long>(got);
+    }
+    const auto chans = static_cast<unsigned long>(info.channels);
+    unsigned long done = 0;
+    while (done < n) {
+        unsigned long want = std::min(n - done, CHUNK_FRAMES);
+        sf_count_t got = sf_readf_float(file, chunk.data(),
+                                        static_cast<sf_count_t>(want));
+        if (got < 0)
+            throw FileError(filename);
+        for (unsigned long i = 0; i != static_cast<unsigned long>(got); ++i)
+            dst[done + i] = chunk[i * chans];
+        done += static_cast<unsigned long>(got);
+        if (static_cast<unsigned long>(got) < want)
+            break;
+    }
+    return done;
+}
+
+void SndFileSource::rewind() {
+    if (sf_seek(file, 0, SEEK_SET) < 0)
+        throw FileError(filename);
+}
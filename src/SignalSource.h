@@ -0,0 +1,91 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file SignalSource.h
+ *
+ * Holds the `SignalSource` interface, and its libsndfile implementation.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#ifndef SIGNALSOURCE_H
+#define SIGNALSOURCE_H
+
+#include <string>
+#include <vector>
+
+#include <sndfile.hh>
+
+/// A mono signal that is read a piece at a time
+/**
+  * Sources let long audio files be used without holding all of their
+  * samples in memory at once: whoever reads them asks for as many samples
+  * as it can take, and the source only keeps a small buffer of its own.
+  */
+class SignalSource
+{
+public:
+
+    virtual ~SignalSource() {}
+
+    virtual int samplerate() const = 0;
+
+    /// Total number of samples, which may be unknown (zero)
+    virtual unsigned long frames() const = 0;
+
+    /// Reads up to `n` samples into `dst`
+    /**
+      * \returns the number of samples read, which is only less than `n` at
+      * the end of the signal.
+      *
+      * \throws FileError if reading fails.
+      */
+    virtual unsigned long read(float *dst, unsigned long n) = 0;
+
+    /// Goes back to the first sample
+    virtual void rewind() = 0;
+
+};
+
+/// An audio file, read through libsndfile
+/**
+  * Any format supported by libsndfile is accepted (see `Signal`). The file
+  * is read `CHUNK_FRAMES` at a time, and only the first channel is kept; a
+  * warning is emitted if there are others.
+  */
+class SndFileSource : public SignalSource
+{
+public:
+
+    constexpr static unsigned long CHUNK_FRAMES = 4096;
+
+    /// \throws FileError if the file can't be opened.
+    explicit SndFileSource(const std::string& filename);
+    ~SndFileSource();
+
+    SndFileSource(const SndFileSource&) = delete;
+    SndFileSource& operator=(const SndFileSource&) = delete;
+
+    int samplerate() const override { return info.samplerate; }
+    unsigned long frames() const override;
+    unsigned long read(float *dst, unsigned long n) override;
+    void rewind() override;
+
+private:
+
+    std::string filename;
+    SNDFILE *file;
+    SF_INFO info;
+    std::vector<float> chunk; // interleaved, for files with many channels
+
+};
+
+#endif // SIGNALSOURCE_H
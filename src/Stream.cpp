@@ -35,6 +35,7 @@ extern "C" {
 }
 
 #include <exception>
+#include <iostream>
 
 #ifdef ATFA_LOG_MATLAB
 # include <iostream>
@@ -51,10 +52,7 @@ extern "C" {
 #include "VAD.h"
 #include "AdaptiveFilter.h"
 #include "utils.h"
-
-#ifdef ATFA_LOG_MATLAB
-Stream::sample_t Stream::wvec[ATFA_WVEC_SAMPLE_MAX][ATFA_WVEC_MAX];
-#endif
+#include "simd.h"
 
 /// Callback function for dealing with PortAudio
 static int stream_callback(
@@ -63,9 +61,6 @@ static int stream_callback(
         PaStreamCallbackFlags status_flags, void *user_data
 );
 
-static float teste1[1024];
-static float teste2[1024];
-
 /**
   * See the description for the `signal_callback()` function, in the Signal.cpp
   * file for information on how this function accomplishes audio I/O, together
@@ -98,37 +93,60 @@ static int stream_callback(
     PaStreamCallbackFlags status_flags, void *user_data
 ) {
 
-    if (frames_per_buf/4 == 0) return paContinue;
-
     Stream * const data = static_cast<Stream *>(user_data);
 
     (void) time_info; // prevent unused variable warning
     (void) status_flags;
 
-    float *ib = (float*)in_buf;
-    float *ob = (float*)out_buf;
+    bool keep_going = data->process(static_cast<const float *>(in_buf),
+                                    static_cast<float *>(out_buf),
+                                    frames_per_buf);
 
-    for (unsigned i=0; i<frames_per_buf/4; ++i) {
-        teste1[i] = (ib[4*i]+ib[4*i+1]+ib[4*i+2]+ib[4*i+3])/4;
-    }
+    return keep_going ? paContinue : paAbort;
+
+}
+
+/**
+  * The input is split in pieces of at most `max_callback` samples (at the
+  * stream's samplerate), so that `cb_in` and `cb_out` never need to grow.
+  */
+bool Stream::process(const float *in_buf, float *out_buf,
+                     unsigned long frames) {
+
+    bool keep_going = true;
+
+    for (unsigned long left = frames/4; left != 0; ) {
+
+        auto n = std::min(left, static_cast<unsigned long>(max_callback));
+        const float *ib = in_buf;
+        float *ob = out_buf;
+
+        for (unsigned i=0; i<n; ++i) {
+            cb_in[i] = (ib[4*i]+ib[4*i+1]+ib[4*i+2]+ib[4*i+3])/4;
+        }
+
+        keep_going = read_write(cb_in.data(), cb_out.data(), n) &&
+                     keep_going;
+
+        ob[0] = cb_out[0];
+        ob[1] = cb_out[0];
+        ob[2] = cb_out[0];
+        ob[3] = cb_out[0];
 
-    data->read_write(static_cast<const Stream::sample_t *>(teste1),
-                     static_cast<Stream::sample_t *>(teste2),
-                     frames_per_buf/4);
+        for (unsigned i=1; i<n; ++i) {
+            ob[4*i]   = cb_out[i-1]*0.75f + cb_out[i]*0.25f;
+            ob[4*i+1] = cb_out[i-1]*0.50f + cb_out[i]*0.50f;
+            ob[4*i+2] = cb_out[i-1]*0.25f + cb_out[i]*0.75f;
+            ob[4*i+3] =                     cb_out[i]*1.00f;
+        }
 
-    ob[0] = teste2[0];
-    ob[1] = teste2[0];
-    ob[2] = teste2[0];
-    ob[3] = teste2[0];
+        in_buf += 4*n;
+        out_buf += 4*n;
+        left -= n;
 
-    for (unsigned i=1; i<frames_per_buf/4; ++i) {
-        ob[4*i]   = teste2[i-1]*0.75f + teste2[i]*0.25f;
-        ob[4*i+1] = teste2[i-1]*0.50f + teste2[i]*0.50f;
-        ob[4*i+2] = teste2[i-1]*0.25f + teste2[i]*0.75f;
-        ob[4*i+3] =                     teste2[i]*1.00f;
     }
 
-    return paContinue;
+    return keep_going;
 
 }
 
@@ -136,7 +154,8 @@ void Stream::set_scene(const Scenario& new_scene) {
     scene = new_scene;
     set_delay(static_cast<unsigned>(scene.delay - scene.system_latency));
     set_filter(scene.imp_resp);
-    setAdapfAlgorithm(new AdaptiveFilter<sample_t>(scene.adapf_file));
+    setAdapfAlgorithm(new AdaptiveFilter<sample_t>(scene.adapf_file,
+                                                   scene.adapf_isolated));
 }
 
 /**
@@ -158,36 +177,7 @@ void Stream::set_scene(const Scenario& new_scene) {
   */
 PaStream *Stream::echo() {
 
-    adapf->initialize_data_structures();
-
-    // no need for mutex, because the rir_thread has not started yet
-    is_running = true;
-
-    // the rir_thread will wait until it is notified, so no problem starting it
-    // right away.
-    rir_thread = new std::thread(&Stream::rir_fft, this);
-
-    blk_count = 0;
-    blk_offset = 0;
-    std::fill(data_in.begin(),  data_in.end(),  0);
-    std::fill(data_out.begin(), data_out.end(), 0);
-    { // TODO: Deveria existir um método estático estilo factory da classe
-      // Signal que cria AWGN :)
-        std::mt19937 rng;
-        std::normal_distribution<> gauss{0, std::pow(10,scene.noise_vol/20)};
-        for (auto& x : awgn) x = gauss(rng)*0; // TODO: terminar de implementar
-    }
-    write_ptr = data_in.begin();
-    read_ptr  = data_out.begin();
-    rir_ptr   = data_in.begin();
-    awgn_ptr  = awgn.begin();
-    auto stream_delay =
-            static_cast<unsigned>(scene.delay - scene.system_latency);
-    if (stream_delay < min_delay)
-        throw std::out_of_range("[Stream::echo] Stream delay (delay minus"
-                                " system latency) cannot be less than the"
-                                " duration of one block.");
-    set_delay(stream_delay);
+    start_session();
 
 #ifndef ATFA_DEBUG
     PaStream *stream;
@@ -319,6 +309,39 @@ PaStream *Stream::echo() {
 
 }
 
+/**
+  * Empties the circular buffers and puts all the pointers back at their
+  * beginning, as at the start of a session.
+  *
+  * \throws std::out_of_range if the stream delay is shorter than one block
+  */
+void Stream::reset_buffers() {
+    blk_count = 0;
+    blk_offset = 0;
+    std::fill(data_in.begin(),  data_in.end(),  0);
+    std::fill(data_out.begin(), data_out.end(), 0);
+    vad_bits.reset();
+    dt_bits.reset();
+    engine_status.reset();
+    { // TODO: Deveria existir um método estático estilo factory da classe
+      // Signal que cria AWGN :)
+        std::mt19937 rng;
+        std::normal_distribution<> gauss{0, std::pow(10,scene.noise_vol/20)};
+        for (auto& x : awgn) x = gauss(rng)*0; // TODO: terminar de implementar
+    }
+    write_ptr = data_in.begin();
+    read_ptr  = data_out.begin();
+    rir_ptr   = data_in.begin();
+    awgn_ptr  = awgn.begin();
+    auto stream_delay =
+            static_cast<unsigned>(scene.delay - scene.system_latency);
+    if (stream_delay < min_delay)
+        throw std::out_of_range("[Stream::echo] Stream delay (delay minus"
+                                " system latency) cannot be less than the"
+                                " duration of one block.");
+    set_delay(stream_delay);
+}
+
 /**
   * This method closes a PortAudio session created by `echo()`.
   *
@@ -357,6 +380,76 @@ void Stream::stop(PaStream *s) {
     SCOUT("======= STOP =======");
 #endif
 
+    end_session();
+
+}
+
+void Stream::start_session() {
+
+    adapf->initialize_data_structures();
+    adapf->reset_nup();
+    adapf->set_realtime(samplerate);
+
+    // warm start: resume from a previously converged filter
+    if (!scene.adapf_state_file.isEmpty() && !adapf->is_dummy()) {
+        try {
+            adapf->load_state_file(scene.adapf_state_file.toUtf8().constData());
+        } catch (const AdapfException& e) {
+            std::cerr << "[Stream] Warning: the adaptive filter will start"
+                      << " from scratch." << std::endl
+                      << "[Stream] " << e.what() << std::endl;
+        }
+    }
+
+    watchdog.configure(scene.watchdog_action, scene.watchdog_energy_ratio_db,
+                       scene.watchdog_max_coef_norm, samplerate / 2);
+    watchdog.start();
+    learning_frozen = false;
+
+    dtd.configure(scene.dtd_geigel_db, scene.dtd_ncc_percent);
+    dtd.start();
+    near_end.clear();
+    near_idx = 0;
+    if (!scene.near_end_file.isEmpty()) {
+        try {
+            Signal talker{scene.near_end_file.toUtf8().constData()};
+            talker.set_samplerate(samplerate);
+            near_end.assign(talker.array(),
+                            talker.array() + talker.samples());
+        } catch (const FileError& e) {
+            std::cerr << "[Stream] Warning: could not read the near-end"
+                      << " talker; there will be none." << std::endl
+                      << "[Stream] " << e.what() << std::endl;
+        }
+    }
+    start_vad();
+
+    {
+        QString trace_file = scene.coef_trace_file;
+#ifdef ATFA_LOG_MATLAB
+        if (trace_file.isEmpty())
+            trace_file = "ATFA_LOG_MATLAB.wtrace";
+#endif
+        coef_trace.configure(
+                    trace_file.toUtf8().constData(),
+                    static_cast<unsigned>(scene.coef_trace_decimation),
+                    static_cast<unsigned>(scene.coef_trace_taps));
+        coef_trace.start(samplerate); // no-op if trace_file is empty
+    }
+
+    reset_buffers();
+
+    // no need for mutex, because the rir_thread has not started yet
+    is_running = true;
+
+    // the rir_thread will wait until it is notified, so no problem starting it
+    // right away.
+    rir_thread = new std::thread(&Stream::rir_fft, this);
+
+}
+
+void Stream::end_session() {
+
     {
         std::lock_guard<std::mutex> lk(running_mutex);
         is_running = false;
@@ -376,6 +469,11 @@ void Stream::stop(PaStream *s) {
     SCOUT("rir_thread deleted");
     rir_thread = nullptr;
 
+    coef_trace.stop();
+    SCOUT("coef_trace stopped");
+
+    watchdog.flush_log();
+
 #ifdef ATFA_LOG_MATLAB
 # define ADBG_PASTE(x,y) x##y
 # define MXVAR(NOME) ADBG_PASTE(mx_,NOME)
@@ -407,7 +505,7 @@ void Stream::stop(PaStream *s) {
     if (pmat == NULL)
         std::cout << "Erro ao abrir .mat ." << std::endl;
     constexpr unsigned long SAMPLES_IN_PMAT = 192000;
-    static double buffer[ATFA_WVEC_MAX*SAMPLES_IN_PMAT];
+    static double buffer[SAMPLES_IN_PMAT];
     MKMXVAR(in, "data_in",
             1, std::min(SAMPLES_IN_PMAT, data_in.size()),
             data_in[j]);
@@ -415,12 +513,8 @@ void Stream::stop(PaStream *s) {
             1, std::min(SAMPLES_IN_PMAT, data_out.size()),
             data_out[j]);
     MKMXVAR(vad, "cpp_vad",
-            1, std::min(SAMPLES_IN_PMAT, vad.size()),
-            vad[j]);
-    MKMXVAR(w, "wvec",
-            ATFA_WVEC_MAX,
-            std::min(SAMPLES_IN_PMAT, ATFA_WVEC_SAMPLE_MAX),
-            wvec[j][i]);
+            1, std::min(SAMPLES_IN_PMAT, vad_bits.size()),
+            vad_bits.test(j));
     MKMXVAR(Fs, "Fs",
             1, 1,
             samplerate);
@@ -442,15 +536,52 @@ void Stream::stop(PaStream *s) {
     std::cout << "Fim!" << std::endl;
 #endif
 
+    adapf->set_realtime(0);
+
+    // keep the converged state, so that it can be saved by the user
+    last_adapf_state.clear();
+    if (adapf->has_state_io()) {
+        try {
+            last_adapf_state = adapf->save_state();
+        } catch (const AdapfException& e) {
+            std::cerr << "[Stream] Warning: could not save the adaptive filter"
+                      << " state." << std::endl
+                      << "[Stream] " << e.what() << std::endl;
+        }
+    }
+
     adapf->destroy_data_structures();
 
+    stop_vad();
+
+}
+
+void Stream::start_vad() {
+    spectral_vad.start();
+    if (vad_plugin)
+        vad_plugin->initialize_data_structures(blk_size, samplerate);
+}
+
+void Stream::stop_vad() {
+    if (vad_plugin)
+        vad_plugin->destroy_data_structures();
+}
+
+bool Stream::detect_voice(container_t::const_iterator first,
+                          const container_t& re, const container_t& im) {
+    // the spectral VAD must see every block, to track the noise
+    bool spectral = spectral_vad(re, im);
+    switch (vad_source.load(std::memory_order_relaxed)) {
+    case SpectralDomainVAD:
+        return spectral;
+    case PluginVAD:
+        return vad_plugin->classify(&*first, blk_size);
+    default:
+        return (*calcVAD)(first, first + blk_size);
+    }
 }
 
 void Stream::rir_fft() {
-    static container_t x_re(fft_size); // FFT helpers
-    static container_t x_im(fft_size);
-    static container_t y_re(fft_size);
-    static container_t y_im(fft_size);
 #ifdef ATFA_DEBUG
 #define RCOUT(COE) do { \
     std::lock_guard<std::mutex> lk(io_mutex); \
@@ -471,111 +602,158 @@ void Stream::rir_fft() {
         });
         count = blk_count;
         blk_count = 0;
+        auto ready = blk_ready;
         lk.unlock();
         RCOUT("count = " << count);
         if (count < 0) return;
+        engine_status.backlog.store(count, std::memory_order_relaxed);
+        watchdog.flush_log();
         RCOUT("gonna process " << count << " block(s).");
         for (int i=0; i<count; ++i) {
-            // process a single block.
-            // TODO: com o truque da parte imaginária (ver Signal::filter),
-            // talvez dê  pra aceitar RIRs com até o dobro do tamanho (a gente
-            // dividiria a RIR em duas, e colocaria a primeira metade na parte
-            // real e a segunda metade na parte imaginária, e convoluiria o
-            // bloco com essa RIR complexa)
             RCOUT("-> Block #" << i);
-            // For performance, we won't test that filter_ptr <= data_out.end();
-            // We assume that the rest of the code enforces it. TODO: if DEBUG,
-            //                            testar se filter_ptr <= data_out.end()
-            pa_fperbuf_t remaining =
-                    static_cast<pa_fperbuf_t>(data_out.end() - filter_ptr);
-            RCOUT("remaining = " << remaining);
-            long overflow = (long)fft_size - (long)remaining;
-            RCOUT("overflow = " << overflow);
-            // buf_size is an integer multiple of blk_size, so that
-            // rir_ptr+blk_size is guaranteed to be <= data_in.end() .
-            auto rir_end_ptr = rir_ptr + blk_size;
-            RCOUT("rir_end_ptr    = data_in.begin()  + " <<
-                  (rir_end_ptr    - data_in.begin()));
-            {
-                bool vad_in_this_block = (*calcVAD)(rir_ptr, rir_end_ptr);
-                if (led_widget)
-                    led_widget->setLEDStatus(vad_in_this_block);
-                *vad_ptr++ = vad_in_this_block;
-                if (vad_ptr == vad.end())
-                    vad_ptr = vad.begin();
-            }
-            { auto blk_end = std::copy(rir_ptr, rir_end_ptr, x_re.begin());
-              std::fill(blk_end, x_re.end(), 0); }
-            std::fill(x_im.begin(), x_im.end(), 0);
-            Signal::dft(x_re, x_im);
-            for (index_t j = 0; j != fft_size; ++j) {
-                y_re[j] = x_re[j]*h_freq_re[j] - x_im[j]*h_freq_im[j];
-                y_im[j] = x_re[j]*h_freq_im[j] + x_im[j]*h_freq_re[j];
-            }
-            Signal::dft(y_re, y_im, DefaultDFT::INVERSE);
-            // overlap and add: we add the first 'blks_in_fft-1' blocks,
-            // which do overlap, and then we force the last block, which is
-            // plain new and will override the old samples from one buffer
-            // ago.
-            auto y_last = y_re.begin() + (blks_in_fft-1)*blk_size;
-            auto f_ptr = filter_ptr;
-            auto y_first = y_re.begin();
-            if (overflow < 0) {
-                RCOUT("No overflow in this block.");
-                for (; y_first != y_last;       ++y_first, ++f_ptr)
-                    *f_ptr += *y_first;
-                for (; y_first != y_re.end();   ++y_first, ++f_ptr, ++awgn_ptr)
-                    *f_ptr = *y_first + *awgn_ptr;
-                filter_ptr += blk_size;
-            }
-            else if (size_t(overflow) < blk_size) {
-                RCOUT("Only the last block of the RIR overflows");
-                for (; y_first != y_last;       ++y_first, ++f_ptr)
-                    *f_ptr += *y_first;
-                for (; f_ptr != data_out.end(); ++y_first, ++f_ptr, ++awgn_ptr)
-                    *f_ptr = *y_first + *awgn_ptr;
-                f_ptr = data_out.begin();
-                for (; y_first != y_re.end();   ++y_first, ++f_ptr, ++awgn_ptr)
-                    *f_ptr = *y_first + *awgn_ptr;
-                filter_ptr += blk_size;
-            }
-            else if (size_t(overflow) < (blks_in_fft-1)*blk_size) {
-                RCOUT("The first block fits the remaining of the buffer.");
-                for (; f_ptr != data_out.end(); ++y_first, ++f_ptr)
-                    *f_ptr += *y_first;
-                f_ptr = data_out.begin();
-                for (; y_first != y_last;       ++y_first, ++f_ptr)
-                    *f_ptr += *y_first;
-                for (; y_first != y_re.end();   ++y_first, ++f_ptr, ++awgn_ptr)
-                    *f_ptr = *y_first + *awgn_ptr;
-                filter_ptr += blk_size;
-            }
-            else {
-                RCOUT("The convolution overflows already on the first block.");
-                for (; f_ptr != data_out.end(); ++y_first, ++f_ptr)
-                    *f_ptr += *y_first;
-                f_ptr = data_out.begin();
-                for (; y_first != y_last;       ++y_first, ++f_ptr)
-                    *f_ptr += *y_first;
-                for (; y_first != y_re.end();   ++y_first, ++f_ptr, ++awgn_ptr)
-                    *f_ptr = *y_first + *awgn_ptr;
-                filter_ptr = data_out.begin() +
-                             static_cast<long>(blk_size - remaining);
-            }
-            if (rir_end_ptr == data_in.end()) {
-                rir_ptr = data_in.begin();
-                awgn_ptr = awgn.begin();
-            }
-            else
-                rir_ptr = rir_end_ptr;
-#ifdef ATFA_DEBUG
-            RCOUT("rir_ptr        = data_in.begin()  + " <<
-                  (rir_ptr        - data_in.begin()));
-            RCOUT("filter_ptr     = data_out.begin() + " <<
-                  (filter_ptr     - data_out.begin()));
-#endif
+            process_block();
+        }
+        // only this thread writes the latencies
+        std::chrono::duration<float> latency =
+                std::chrono::steady_clock::now() - ready;
+        auto r = std::memory_order_relaxed;
+        engine_status.block_latency.store(latency.count(), r);
+        if (latency.count() > engine_status.max_block_latency.load(r))
+            engine_status.max_block_latency.store(latency.count(), r);
+    }
+}
+
+/**
+  * Filters the block at `rir_ptr` with the RIR and overlaps-and-adds the
+  * result at `filter_ptr`; also runs the VAD on the block and the
+  * double-talk detector on its echo. This is one iteration of `rir_fft`.
+  */
+void Stream::process_block() {
+    // TODO: com o truque da parte imaginária (ver Signal::filter),
+    // talvez dê  pra aceitar RIRs com até o dobro do tamanho (a gente
+    // dividiria a RIR em duas, e colocaria a primeira metade na parte
+    // real e a segunda metade na parte imaginária, e convoluiria o
+    // bloco com essa RIR complexa)
+    // For performance, we won't test that filter_ptr <= data_out.end();
+    // We assume that the rest of the code enforces it. TODO: if DEBUG,
+    //                            testar se filter_ptr <= data_out.end()
+    pa_fperbuf_t remaining =
+            static_cast<pa_fperbuf_t>(data_out.end() - filter_ptr);
+    RCOUT("remaining = " << remaining);
+    long overflow = (long)fft_size - (long)remaining;
+    RCOUT("overflow = " << overflow);
+    // buf_size is an integer multiple of blk_size, so that
+    // rir_ptr+blk_size is guaranteed to be <= data_in.end() .
+    auto rir_end_ptr = rir_ptr + blk_size;
+    RCOUT("rir_end_ptr    = data_in.begin()  + " <<
+          (rir_end_ptr    - data_in.begin()));
+    auto blk = static_cast<size_t>(rir_ptr - data_in.begin()) /
+               blk_size;
+    // the echo of the current block starts at filter_ptr
+    auto echo_idx = static_cast<size_t>(filter_ptr - data_out.begin());
+    { auto blk_end = std::copy(rir_ptr, rir_end_ptr, x_re.begin());
+      std::fill(blk_end, x_re.end(), 0); }
+    std::fill(x_im.begin(), x_im.end(), 0);
+    dft(x_re, x_im);
+    {
+        bool vad_in_this_block = detect_voice(rir_ptr, x_re, x_im);
+        vad_bits.set(blk, vad_in_this_block);
+        engine_status.voice.store(vad_in_this_block,
+                                  std::memory_order_relaxed);
+        engine_status.far_peak.store(
+                    SIMD::max_abs(&*rir_ptr, blk_size),
+                    std::memory_order_relaxed);
+    }
+    for (index_t j = 0; j != fft_size; ++j) {
+        y_re[j] = x_re[j]*h_freq_re[j] - x_im[j]*h_freq_im[j];
+        y_im[j] = x_re[j]*h_freq_im[j] + x_im[j]*h_freq_re[j];
+    }
+    dft(y_re, y_im, DefaultDFT::INVERSE);
+    // overlap and add: we add the first 'blks_in_fft-1' blocks,
+    // which do overlap, and then we force the last block, which is
+    // plain new and will override the old samples from one buffer
+    // ago.
+    auto y_last = y_re.begin() + (blks_in_fft-1)*blk_size;
+    auto f_ptr = filter_ptr;
+    auto y_first = y_re.begin();
+    if (overflow < 0) {
+        RCOUT("No overflow in this block.");
+        for (; y_first != y_last;       ++y_first, ++f_ptr)
+            *f_ptr += *y_first;
+        for (; y_first != y_re.end();   ++y_first, ++f_ptr, ++awgn_ptr)
+            *f_ptr = *y_first + *awgn_ptr;
+        filter_ptr += blk_size;
+    }
+    else if (size_t(overflow) < blk_size) {
+        RCOUT("Only the last block of the RIR overflows");
+        for (; y_first != y_last;       ++y_first, ++f_ptr)
+            *f_ptr += *y_first;
+        for (; f_ptr != data_out.end(); ++y_first, ++f_ptr, ++awgn_ptr)
+            *f_ptr = *y_first + *awgn_ptr;
+        f_ptr = data_out.begin();
+        for (; y_first != y_re.end();   ++y_first, ++f_ptr, ++awgn_ptr)
+            *f_ptr = *y_first + *awgn_ptr;
+        filter_ptr += blk_size;
+    }
+    else if (size_t(overflow) < (blks_in_fft-1)*blk_size) {
+        RCOUT("The first block fits the remaining of the buffer.");
+        for (; f_ptr != data_out.end(); ++y_first, ++f_ptr)
+            *f_ptr += *y_first;
+        f_ptr = data_out.begin();
+        for (; y_first != y_last;       ++y_first, ++f_ptr)
+            *f_ptr += *y_first;
+        for (; y_first != y_re.end();   ++y_first, ++f_ptr, ++awgn_ptr)
+            *f_ptr = *y_first + *awgn_ptr;
+        filter_ptr += blk_size;
+    }
+    else {
+        RCOUT("The convolution overflows already on the first block.");
+        for (; f_ptr != data_out.end(); ++y_first, ++f_ptr)
+            *f_ptr += *y_first;
+        f_ptr = data_out.begin();
+        for (; y_first != y_last;       ++y_first, ++f_ptr)
+            *f_ptr += *y_first;
+        for (; y_first != y_re.end();   ++y_first, ++f_ptr, ++awgn_ptr)
+            *f_ptr = *y_first + *awgn_ptr;
+        filter_ptr = data_out.begin() +
+                     static_cast<long>(blk_size - remaining);
+    }
+    // the echo of the block is complete: the near-end talker joins it at the
+    // microphone
+    for (auto& y : dtd_y) {
+        sample_t& mic = data_out[echo_idx++ % buf_size];
+        if (!near_end.empty()) {
+            mic += near_end[near_idx];
+            near_idx = near_idx + 1 == near_end.size() ? 0 : near_idx + 1;
         }
+        y = mic;
+    }
+    engine_status.echo_peak.store(
+                SIMD::max_abs(dtd_y.data(), blk_size),
+                std::memory_order_relaxed);
+    if (scene.dtd_enabled) {
+        auto x_idx = blk*blk_size + buf_size - DoubleTalkDetector::LAGS;
+        for (auto& x : dtd_x)
+            x = data_in[x_idx++ % buf_size];
+        bool dt = dtd.detect(dtd_x.data(), dtd_y.data());
+        dt_bits.set(blk, dt);
+        engine_status.double_talk.store(dt, std::memory_order_relaxed);
     }
+    else
+        engine_status.double_talk.store(false, std::memory_order_relaxed);
+    engine_status.blocks.fetch_add(1, std::memory_order_relaxed);
+    if (rir_end_ptr == data_in.end()) {
+        rir_ptr = data_in.begin();
+        awgn_ptr = awgn.begin();
+    }
+    else
+        rir_ptr = rir_end_ptr;
+#ifdef ATFA_DEBUG
+    RCOUT("rir_ptr        = data_in.begin()  + " <<
+          (rir_ptr        - data_in.begin()));
+    RCOUT("filter_ptr     = data_out.begin() + " <<
+          (filter_ptr     - data_out.begin()));
+#endif
 }
 
 /**
@@ -595,5 +773,25 @@ void Stream::set_filter(const container_t& h, bool substitute) {
     std::fill(h_freq_re.begin(), h_freq_re.end(), 0);
     std::fill(h_freq_im.begin(), h_freq_im.end(), 0);
     std::copy(scene.imp_resp.begin(), scene.imp_resp.end(), h_freq_re.begin());
-    Signal::dft(h_freq_re, h_freq_im);
+    dft(h_freq_re, h_freq_im);
+}
+
+/**
+  * Same as `set_filter(const container_t&, bool)`, but the spectrum is
+  * copied instead of computed.
+  *
+  * \param[in]  h       A vector containing the RIR samples
+  * \param[in]  freq_re Real part of the DFT of `h`, zero-padded to `fft_size`
+  * \param[in]  freq_im Imaginary part of that DFT
+  */
+void Stream::set_filter(const container_t& h, const sample_t *freq_re,
+                        const sample_t *freq_im) {
+    if (h.size() >= fft_size - blk_size)
+        // A convolução de 'h' com um bloco deve caber em uma fft
+        throw std::length_error(std::string("RIR pode ter no máximo ") +
+                                std::to_string(fft_size - blk_size) +
+                                std::string(" amostras."));
+    scene.imp_resp = h;
+    std::copy(freq_re, freq_re + fft_size, h_freq_re.begin());
+    std::copy(freq_im, freq_im + fft_size, h_freq_im.begin());
 }
@@ -24,24 +24,28 @@ extern "C" {
 #   include <dlfcn.h>
 }
 
-#ifdef ATFA_LOG_MATLAB
-# include <cstring>
-#endif
-
+#include <chrono>
 #include <cmath>
 
 #include <vector>
+#include <atomic>
 #include <algorithm>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <functional>
+#include <memory>
 
 #include <QtCore>
 
 #include "VAD.h"
+#include "VADPlugin.h"
 #include "AdaptiveFilter.h"
-#include "widgets/LEDIndicatorWidget.h"
+#include "DoubleTalk.h"
+#include "CoefTrace.h"
+#include "Watchdog.h"
+#include "RIR.h"
+#include "Signal.h"
 #include "utils.h"
 
 typedef unsigned long pa_fperbuf_t;
@@ -129,6 +133,13 @@ public:
 
         OOV filter_learning;
 
+        bool dtd_enabled; // also stop learning during double-talk
+        int dtd_geigel_db;
+        int dtd_ncc_percent;
+        // audio file mixed into the microphone signal, as a near-end talker
+        // (looped); empty: the microphone only gets the echo and the noise
+        QString near_end_file;
+
         RIR_filetype_t rir_filetype;
         RIR_source_t rir_source;
         QString rir_file;
@@ -145,6 +156,16 @@ public:
         container_t imp_resp;
 
         std::string adapf_file;
+        bool adapf_isolated; // run the DSO in a helper process
+        QString adapf_state_file; // empty: filter starts from scratch
+
+        Watchdog::Action watchdog_action; // what to do if the filter diverges
+        int watchdog_energy_ratio_db; // output/mic energy that means trouble
+        int watchdog_max_coef_norm;
+
+        QString coef_trace_file; // empty: coefficients are not traced
+        int coef_trace_decimation; // samples between snapshots
+        int coef_trace_taps; // coefficients stored per snapshot
 
         QString filename;
 
@@ -159,10 +180,20 @@ public:
             const container_t& ir = container_t(1,1),
             const AdaptiveFilter<sample_t>& adapf = AdaptiveFilter<sample_t>()
         )
-          : filter_learning(flearn),
+          : filter_learning(flearn), dtd_enabled(false),
+            dtd_geigel_db(DoubleTalkDetector::DEFAULT_GEIGEL_DB),
+            dtd_ncc_percent(DoubleTalkDetector::DEFAULT_NCC_PERCENT),
+            near_end_file(""),
             rir_filetype(filetype), rir_source(source), rir_file(rir_filename),
             delay(d), system_latency(sl), volume(vol), noise_vol(noise),
-            imp_resp(ir), adapf_file(adapf.get_path())
+            imp_resp(ir), adapf_file(adapf.get_path()),
+            adapf_isolated(adapf.is_isolated()), adapf_state_file(""),
+            watchdog_action(Watchdog::DEFAULT_ACTION),
+            watchdog_energy_ratio_db(Watchdog::DEFAULT_ENERGY_RATIO_DB),
+            watchdog_max_coef_norm(Watchdog::DEFAULT_MAX_COEF_NORM),
+            coef_trace_file(""),
+            coef_trace_decimation(CoefTrace::DEFAULT_DECIMATION),
+            coef_trace_taps(CoefTrace::DEFAULT_TAPS)
         {}
 
         Scenario(const QString &fn, int delay_max)
@@ -193,6 +224,9 @@ public:
     // In miliseconds
     static constexpr int min_delay = std::ceil(1000.0 * blk_size / samplerate);
 
+    /// The most samples `process()` gives to `read_write()` at a time
+    static constexpr size_t max_callback = 1024;
+
     /// Returns the next audio sample
     /**
       * Reads the audio sample pointed to by `read_ptr` and makes the pointer
@@ -201,58 +235,126 @@ public:
       *
       * \returns the next audio sample in line
       *
+      * \returns false if the stream should be aborted (see `Watchdog`)
+      *
       * \see data
       * \see write
       */
     template<class InputIt, class OutputIt>
-    void read_write(InputIt in_buf, OutputIt out_buf, pa_fperbuf_t pa_frames) {
+    bool read_write(InputIt in_buf, OutputIt out_buf, pa_fperbuf_t pa_frames) {
         if (sample_count < 1024)
             sample_count += static_cast<int>(pa_frames);
         pa_fperbuf_t remaining =
                 static_cast<pa_fperbuf_t>(data_out.end() - read_ptr);
         long overflow = (long)pa_frames - (long)remaining;
-        auto read_end_ptr = (overflow < 0) ?
-                    (read_ptr + (long)pa_frames) :
-                    (data_out.begin() + overflow);
-        /* Nesse loop, a gente calcula a cada iteração o índice do VAD
-         * correspondente àquela amostra. Tem dois jeitos de otimizar isso:
-         *  "Sem perda": sabendo que o tamanho do bloco do VAD é maior ou igual
-         *               a `pa_frames' (verificar), calcular de antemão onde
-         *               tem VAD e onde não tem, e dividir o loop abaixo em
-         *               dois.
-         *  "Com perda": Calcular um valor único de índice do VAD para a
-         *               primeira das `pa_frames' amostras, e usar esse valor
-         *               pra todas as amostras subsequentes. Ao invés de usar
-         *               a primeira amostra, pode usar a amostra média.
-         */
-        while (read_ptr != read_end_ptr) {
-            auto vad_idx =
-                    static_cast<unsigned long>(adapf_ptr-data_in.begin()) /
-                    blk_size;
-            *out_buf = scene.volume *
-                       adapf->get_sample(
-                           *adapf_ptr, *read_ptr,
-                           (scene.filter_learning==Scenario::On || (
-                               scene.filter_learning==Scenario::VAD &&
-                               vad[vad_idx]
-                           )) && (sample_count >= 1024)
-                       );
-#ifdef ATFA_LOG_MATLAB
-            // TODO: esse bloco todo tem que ser rodado somente se
-            //       a gente ainda não estourou o buffer do wvec.
-            //       (que tem tamanho ATFA_WVEC_SAMPLE_MAX)
-            {
-                const sample_t *it; unsigned n;
-                adapf->get_impresp(&it, &n);
-                std::memcpy(&(wvec[w_ptr][0]), it, n*sizeof(sample_t));
-            }
-            ++w_ptr;
-#endif
-            ++read_ptr, ++adapf_ptr, ++out_buf;
+        const sample_t *y_first = &*read_ptr; // for the watchdog
+        const OutputIt out_first = out_buf;
+        const bool enabled = !learning_frozen &&
+                             scene.filter_learning != Scenario::Off &&
+                             sample_count >= 1024;
+        // The learning flag only changes when adapf_ptr enters another block
+        // of data_in, so the samples are processed in spans that end either
+        // there or where read_ptr wraps. The flag is computed once per span,
+        // and both pointers only need to be rewinded at the end of a span.
+        // (buf_size is a multiple of blk_size, so adapf_ptr always wraps at
+        // the end of a block.)
+        pa_fperbuf_t done = 0;
+        pa_fperbuf_t learned = 0; // for the status
+        auto next_span = [&](pa_fperbuf_t max_len, int *learn) -> size_t {
+            auto adapf_idx = static_cast<size_t>(adapf_ptr - data_in.begin());
+            auto blk = adapf_idx / blk_size;
+            *learn = enabled &&
+                     (scene.filter_learning != Scenario::VAD ||
+                      vad_bits.test(blk)) &&
+                     !(scene.dtd_enabled && dt_bits.test(blk));
+            size_t span = std::min({
+                    static_cast<size_t>(max_len),
+                    blk_size - adapf_idx % blk_size,
+                    static_cast<size_t>(data_out.end() - read_ptr) });
+            if (*learn)
+                learned += span;
+            return span;
+        };
+        auto rewind = [this]() {
             if (read_ptr == data_out.end())
                 read_ptr = data_out.begin();
             if (adapf_ptr == data_in.end())
                 adapf_ptr = data_in.begin();
+        };
+        auto trace = [this]() {
+            if (coef_trace.tick()) {
+                const sample_t *w; unsigned n;
+                adapf->get_impresp(&w, &n);
+                coef_trace.push(w, n);
+            }
+        };
+        if (adapf->is_isolated()) {
+            // gather the samples, so that the helper process is woken up once
+            // per block instead of once per sample; the helper only reports
+            // the coefficients at the end of a block, so a block also ends
+            // where the trace takes a snapshot
+            while (done != pa_frames) {
+                unsigned n = 0, max_n = RunnerShm::MAX_BLOCK;
+                if (coef_trace.until_snapshot() != 0)
+                    max_n = std::min(max_n, coef_trace.until_snapshot());
+                while (n != max_n && done != pa_frames) {
+                    int learn;
+                    auto span = next_span(std::min<pa_fperbuf_t>(
+                                    pa_frames - done, max_n - n), &learn);
+                    std::fill_n(iso_learn.begin() + n, span, learn);
+                    std::copy_n(adapf_ptr, span, iso_x.begin() + n);
+                    std::copy_n(read_ptr, span, iso_y.begin() + n);
+                    adapf_ptr += static_cast<long>(span);
+                    read_ptr += static_cast<long>(span);
+                    rewind();
+                    n += static_cast<unsigned>(span);
+                    done += span;
+                }
+                adapf->run_block(iso_x.data(), iso_y.data(), iso_learn.data(),
+                                 iso_e.data(), n);
+                for (unsigned i = 0; i != n; ++i, ++out_buf) {
+                    *out_buf = scene.volume * iso_e[i];
+                    trace();
+                }
+            }
+        }
+        else while (done != pa_frames) {
+            int learn;
+            auto span = next_span(pa_frames - done, &learn);
+            for (size_t i = 0; i != span; ++i) {
+                *out_buf = scene.volume *
+                           adapf->get_sample(*adapf_ptr, *read_ptr, learn);
+                trace();
+                ++read_ptr, ++adapf_ptr, ++out_buf;
+            }
+            rewind();
+            done += span;
+        }
+        engine_status.learning.store(float(learned) / pa_frames,
+                                     std::memory_order_relaxed);
+        engine_status.filter_updates.store(adapf->number_of_updates(),
+                                           std::memory_order_relaxed);
+        bool keep_going = true;
+        if (!adapf->is_dummy() && watchdog.action() != Watchdog::Off) {
+            const sample_t *w; unsigned nw;
+            adapf->get_impresp(&w, &nw);
+            auto n1 = (overflow < 0) ? pa_frames : remaining;
+            switch (watchdog.check(&*out_first, pa_frames,
+                                   y_first, n1,
+                                   &*data_out.begin(), pa_frames - n1,
+                                   scene.volume, w, nw)) {
+            case Watchdog::Restart:
+                adapf->reset_state();
+                break;
+            case Watchdog::Freeze:
+                learning_frozen = true;
+                break;
+            case Watchdog::Abort:
+                keep_going = false;
+                break;
+            case Watchdog::Off:
+                break;
+            }
         }
         if (overflow < 0) { // there was no overflow
             write_ptr = std::copy(in_buf, in_buf + pa_frames, write_ptr);
@@ -267,34 +369,38 @@ public:
         if (blk_count_inc)
         {
             std::lock_guard<std::mutex> lk(blk_mutex);
+            if (blk_count == 0)
+                blk_ready = std::chrono::steady_clock::now();
             blk_count += blk_count_inc;
         }
         blk_cv.notify_one();
         blk_offset = current_offset % blk_size;
+        return keep_going;
     }
 
 
-#ifdef ATFA_LOG_MATLAB
-# define ATFA_STREAM_INIT_WPTR w_ptr(0),
-#else
-# define ATFA_STREAM_INIT_WPTR
-#endif
     /// Contructs from a `Scenario` object
     /**
       * Constructs a Stream object from `Scenario` parameters.
       *
       * \see Scenario
       */
-    Stream(LEDIndicatorWidget *ledw = nullptr, const Scenario& s = Scenario())
-        : ATFA_STREAM_INIT_WPTR
-          scene(s), sample_count{0}, adapf(new AdaptiveFilter<sample_t>()),
-          is_running(false), data_in(buf_size), data_out(buf_size),
-          vad(blks_in_buf),
+    explicit Stream(const Scenario& s = Scenario())
+        : scene(s), sample_count{0}, adapf(new AdaptiveFilter<sample_t>()),
+          learning_frozen(false), is_running(false),
+          data_in(buf_size), data_out(buf_size),
+          vad_bits(blks_in_buf), dt_bits(blks_in_buf),
           write_ptr(data_in.begin()), read_ptr(data_out.begin()),
-          vad_ptr(vad.begin()),
+          spectral_vad(blk_size, samplerate), vad_source(TimeDomainVAD),
+          dtd(blk_size, blks_in_fft),
+          x_re(fft_size), x_im(fft_size), y_re(fft_size), y_im(fft_size),
+          dtd_x(DoubleTalkDetector::LAGS + blk_size), dtd_y(blk_size),
+          near_end(), near_idx(0),
+          cb_in(max_callback), cb_out(max_callback),
           h_freq_re(fft_size), h_freq_im(fft_size),
           awgn(buf_size), awgn_ptr(awgn.begin()),
-          led_widget(ledw)
+          iso_x(RunnerShm::MAX_BLOCK), iso_y(RunnerShm::MAX_BLOCK),
+          iso_e(RunnerShm::MAX_BLOCK), iso_learn(RunnerShm::MAX_BLOCK)
     {
         auto stream_delay = scene.delay - scene.system_latency;
         if (stream_delay < min_delay)
@@ -306,41 +412,12 @@ public:
         // sets h_freq_re and h_freq_im
         set_filter(scene.imp_resp, false);
 
+        engine_status.reset();
+
         if (buf_size == 0) throw std::runtime_error("Stream: Bad buf_size");
         if (samplerate == 0) throw std::runtime_error("Stream: Bad srate");
-#ifdef ATFA_LOG_MATLAB
-        {
-            for (auto& w : wvec)
-                for (auto& x : w)
-                    x = 0;
-        }
-#endif
     }
 
-#ifdef ATFA_LOG_MATLAB
-    // TODO: não tem nenhum motivo pra essas constantes 'WVEC_MAX'
-    //       e 'WVEC_SAMPLE_MAX' serem macros ao invés de static constexpr!
-#define ATFA_WVEC_MAX (512)
-#define ATFA_WVEC_SAMPLE_MAX (blks_in_buf*blk_size / 2)
-    /* Esses maximos aí em cima são pra fazer com o que o vetor abaixo
-     * ocupe uns 200MB. Se não fosse esse máximo, o vetor
-     * estouria o fato de que o código inteiro precisa caber em um
-     * espaço endereçável por 32 bits (4GB). [referência: google "relocation
-     *                                        truncated to fit"]
-     * TODO: este problema deve ser consertado fazendo com que o wvec
-     * seja alocado no heap durante a construção da classe Stream.
-     * Por sinal, do jeito que está agora, ele só é 'static' pra não estourar
-     * a pilha (pq se fosse 'automatic storage' (i.e. stack), ao invés de
-     * 'static storage', esses 200MB iam parar na pilha). Quando
-     * colocar no heap, não precisa mais ser estático (até pq, semanticamente,
-     * não deveria ser estático, e só dá certo fazer como estático pq
-     * nunca tem mais de uma instância dessa classe existindo ao mesmo
-     * tempo).
-     */
-    static sample_t wvec[ATFA_WVEC_SAMPLE_MAX][ATFA_WVEC_MAX];
-    int w_ptr;
-#endif
-
     /// Runs the stream with predefined scenario parameters.
     PaStream *echo();
 
@@ -352,6 +429,30 @@ public:
     /// Stops the stream that is running
     void stop(PaStream *s) ATFA_STREAM_STOP_ATTR;
 
+    /// Prepares a session and starts the `rir_fft` thread
+    /**
+      * `echo()` calls this before opening the PortAudio stream, and `stop()`
+      * calls `end_session()` after closing it. They can also be called
+      * directly, to run the stream offline: the audio callbacks are then
+      * made by calling `process()`.
+      *
+      * \throws std::out_of_range if the stream delay is shorter than one
+      *         block
+      */
+    void start_session();
+    /// Stops the `rir_fft` thread and closes what `start_session()` opened
+    void end_session() ATFA_STREAM_STOP_ATTR;
+
+    /// One audio callback, at the samplerate of the audio device
+    /**
+      * The device runs at four times `samplerate`: the input is decimated,
+      * given to `read_write()`, and its output is interpolated back. Any
+      * remainder of `frames` not multiple of four is not touched.
+      *
+      * \returns false if the stream should be aborted (see `Watchdog`)
+      */
+    bool process(const float *in_buf, float *out_buf, unsigned long frames);
+
     /// Sets the delay parameter, given in miliseconds
     /**
       * Calculates how many samples are equivalent to the specified delay, and
@@ -405,6 +506,11 @@ public:
         set_filter(container_t(first, last), substitute);
     }
 
+    /// Sets the room impulse response, along with its spectrum (`fft_size`
+    /// points), computed beforehand (e.g. by `RIRCache`)
+    void set_filter(const container_t& h, const sample_t *freq_re,
+                    const sample_t *freq_im);
+
     void set_noise(int new_noise) {
         if (new_noise < -180  ||  new_noise > -20)
             throw std::runtime_error("Invalid noise level value.");
@@ -425,19 +531,74 @@ public:
         return is_running;
     }
 
-    void setLED(LEDIndicatorWidget *ledw) {
-        led_widget = ledw;
+    /// A snapshot of what the engine is doing, for the user interface
+    /**
+      * The fields are published separately by the audio callback and by the
+      * `rir_fft` thread, so they may come from slightly different instants.
+      */
+    struct Status {
+        bool voice;       ///< VAD decision on the last far-end block
+        bool double_talk; ///< double-talk detector decision on it
+        float far_peak;   ///< largest `|x|` in the last far-end block
+        float echo_peak;  ///< largest `|y|` in the echo of that block
+        int backlog;      ///< blocks `rir_fft` found pending when last woken
+        unsigned long blocks; ///< blocks processed in this session
+        float learning; ///< fraction of the last callback in which the
+                        ///< filter could learn
+        int filter_updates; ///< updates reported by the DSO in this session
+        float block_latency; ///< seconds from the oldest pending block being
+                             ///< ready until `rir_fft` finished the last
+                             ///< pending one, when it was last woken
+        float max_block_latency; ///< the worst `block_latency` in this
+                                 ///< session
+    };
+
+    /// Reads the current status. Lock-free; meant to be polled by a timer.
+    Status status() const {
+        const StatusAtomics& s = engine_status;
+        auto r = std::memory_order_relaxed;
+        return {
+            s.voice.load(r), s.double_talk.load(r),
+            s.far_peak.load(r), s.echo_peak.load(r),
+            s.backlog.load(r), s.blocks.load(r),
+            s.learning.load(r), s.filter_updates.load(r),
+            s.block_latency.load(r), s.max_block_latency.load(r)
+        };
     }
 
+    /// Selects the VAD
+    /**
+      * 0 for `vad_hard`, 1 for `vad_soft`, 2 for `SpectralVAD`, and 3 for the
+      * DSO given to `setVADPlugin()`.
+      *
+      * \throws std::runtime_error if 3 is chosen but there is no DSO.
+      */
     void setVADAlgorithm(int idx) {
         vad_algorithm_t algs[2] = { &vad_hard, &vad_soft };
-        calcVAD = algs[idx];
+        if (idx == 3 && !vad_plugin)
+            throw std::runtime_error("No VAD DSO has been loaded.");
+        if (idx < 2)
+            calcVAD = algs[idx];
+        vad_source = idx < 2  ? TimeDomainVAD :
+                     idx == 2 ? SpectralDomainVAD : PluginVAD;
+    }
+
+    /// Replaces the VAD DSO. Must not be called while the stream is running.
+    void setVADPlugin(VADPlugin *plugin) {
+        if (vad_source == PluginVAD && !plugin)
+            setVADAlgorithm(0);
+        vad_plugin.reset(plugin);
+    }
+
+    const VADPlugin *get_vad_plugin() const {
+        return vad_plugin.get();
     }
 
     void setAdapfAlgorithm(AdaptiveFilter<sample_t> *adapf_new) {
         if (adapf)
             delete adapf;
         adapf = adapf_new;
+        last_adapf_state.clear();
     }
 
     const char *get_adapf_title() {
@@ -456,16 +617,60 @@ public:
         return adapf->is_dummy();
     }
 
+    /// Whether the filter made no allocations nor locks in `adapf_run`
+    /// when it was tested (see `AdaptiveFilter::is_realtime_safe()`)
+    bool adapf_is_realtime_safe() const {
+        return adapf->is_realtime_safe();
+    }
+
+    /// Whether the state of the filter was kept when the last session ended.
+    bool has_adapf_state() const {
+        return !last_adapf_state.empty();
+    }
+
+    /// Saves the state of the filter at the end of the last session.
+    void save_adapf_state(const std::string& filename) const {
+        adapf->write_state_file(filename, last_adapf_state);
+    }
+
+    /// Whether the watchdog aborted the current session.
+    bool watchdog_aborted() const {
+        return watchdog.aborted();
+    }
+
+    /// Whether an isolated DSO stalled or crashed during the last session.
+    bool adapf_helper_failed() const {
+        return adapf->helper_failed();
+    }
+
+    /// Restarts an isolated DSO that was late for the audio callback; true
+    /// if it was restarted. Must not be called by the callback.
+    bool recover_adapf_helper() {
+        return adapf->recover_helper();
+    }
+
 private:
 
     int sample_count;
 
     AdaptiveFilter<sample_t> *adapf;
 
+    /// State of the filter when the last session ended (see `stop`)
+    AdaptiveFilter<sample_t>::state_t last_adapf_state;
+
+    /// Checks the output of the adaptive filter for divergence
+    Watchdog watchdog;
+    bool learning_frozen; // set by `read_write' when the watchdog trips
+
+    /// Snapshots of the adaptive filter coefficients, taken by `read_write`
+    CoefTrace coef_trace;
+
     std::condition_variable blk_cv;
     int blk_count; // how many blocks need to be processed by rir_fft.
                         // should only be accessed by owner of lock on blk_mutex
     std::mutex blk_mutex;
+    // when blk_count last became nonzero; also guarded by blk_mutex
+    std::chrono::steady_clock::time_point blk_ready;
 
     size_t blk_offset; // hoy many samples gave been written to current block
 
@@ -496,7 +701,16 @@ private:
     container_t data_in;
     container_t data_out;
 
-    std::vector<bool> vad;
+    /// Per-block learning flags, one bit per block of `data_in`
+    /**
+      * `rir_fft` sets the bits of each block as it processes it: `vad_bits`
+      * tells whether the VAD detected voice in the block, and `dt_bits`
+      * whether `dtd` detected double-talk in its echo. This happens at least
+      * `delay_samples` before `adapf_ptr` reaches the block, so `read_write`
+      * just tests the bits of the block, once per span of samples.
+      */
+    AtomicBitset vad_bits;
+    AtomicBitset dt_bits;
 
     /// An iterator to the next location to be written on the stream
     /**
@@ -530,10 +744,43 @@ private:
     container_t::iterator read_ptr;
     container_t::iterator filter_ptr;
 
-    std::vector<bool>::iterator vad_ptr;
     vad_algorithm_t calcVAD = &vad_hard;
+    SpectralVAD spectral_vad; // only used by rir_fft
+    std::unique_ptr<VADPlugin> vad_plugin;
+    enum VADSource { TimeDomainVAD, SpectralDomainVAD, PluginVAD };
+    std::atomic<int> vad_source;
+
+    /// Prepares the VADs for a new session
+    void start_vad();
+    /// Closes what `start_vad()` opened
+    void stop_vad();
+    /// Runs the selected VAD on the block at `first`, whose DFT (zero-padded
+    /// to `fft_size`) is given in `re` and `im`.
+    bool detect_voice(container_t::const_iterator first,
+                      const container_t& re, const container_t& im);
+
+    DoubleTalkDetector dtd; // only used by rir_fft
+
+    // FFT and buffers of `process_block', per stream so that many streams
+    // can run at the same time
+    DefaultDFT dft;
+    container_t x_re, x_im, y_re, y_im;
+    // contiguous copies of the circular buffers, for the double-talk detector
+    container_t dtd_x, dtd_y;
+    // the near-end talker, at `samplerate`, and the next of its samples to be
+    // mixed into the microphone signal; only used by rir_fft
+    container_t near_end;
+    size_t near_idx;
+
+    // `process' decimates into cb_in, and interpolates from cb_out
+    container_t cb_in, cb_out;
 
     void rir_fft();
+    /// One iteration of `rir_fft`: processes the block at `rir_ptr`
+    void process_block();
+
+    /// Clears the buffers and rewinds the pointers, for a new session
+    void reset_buffers();
 
     std::thread *rir_thread;
 
@@ -546,40 +793,35 @@ private:
     container_t awgn;
     container_t::const_iterator awgn_ptr;
 
-    LEDIndicatorWidget *led_widget;
+    // staging buffers for `AdaptiveFilter::run_block', when the DSO is
+    // isolated (see `IsolatedRunner')
+    container_t iso_x, iso_y, iso_e;
+    std::vector<int> iso_learn;
+
+    /// Written by the engine threads, read by `status()`
+    struct StatusAtomics {
+        std::atomic<bool> voice, double_talk;
+        std::atomic<float> far_peak, echo_peak;
+        std::atomic<int> backlog;
+        std::atomic<unsigned long> blocks;
+        std::atomic<float> learning;
+        std::atomic<int> filter_updates;
+        std::atomic<float> block_latency, max_block_latency;
+        void reset() {
+            auto r = std::memory_order_relaxed;
+            voice.store(false, r); double_talk.store(false, r);
+            far_peak.store(0, r); echo_peak.store(0, r);
+            backlog.store(0, r); blocks.store(0, r);
+            learning.store(0, r); filter_updates.store(0, r);
+            block_latency.store(0, r); max_block_latency.store(0, r);
+        }
+    } engine_status;
 
     friend class BenchmarkAdapfDialog;
+    friend class StreamBenchmark; // see microbench.cpp
 
 };
 
-/*****************************************/
-/***** RIRException and its children *****/
-/*****************************************/
-
-class RIRException: public std::runtime_error {
-public:
-    RIRException(const std::string& desc)
-        : runtime_error(std::string("RIR error: ") + desc) {}
-};
-
-class RIRParseException: public RIRException {
-public:
-    RIRParseException(const std::string& desc)
-        : RIRException(std::string("Parse error: ") + desc) {}
-};
-
-class RIRSizeException: public RIRException {
-public:
-    RIRSizeException(const std::string& desc)
-        : RIRException(std::string("Size error: ") + desc) {}
-};
-
-class RIRInvalidException: public RIRException {
-public:
-    RIRInvalidException(const std::string& desc)
-        : RIRException(std::string("Invalid data: ") + desc) {}
-};
-
 /********************/
 /***** Scenario *****/
 /********************/
@@ -0,0 +1,314 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file Timing.h
+ *
+ * Holds the repetition harness and the statistics used by the benchmarkers.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <cmath>
+#include <cstdint>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#   include <x86intrin.h>
+#   define ATFA_HAVE_TSC
+#endif
+
+/// Timing of code that runs for a short time, with some confidence
+/**
+  * A single timed pass says little: the first pass pays for page faults and
+  * cold caches, and any pass may be preempted, or run while the CPU is
+  * changing its frequency. The `Harness` repeats the measured code until a
+  * target wall time is spent, and summarizes the repetitions with order
+  * statistics, which the occasional preempted repetition can't skew.
+  */
+namespace Timing {
+
+typedef std::chrono::duration<double> seconds_t;
+
+/// Whether `tsc()` reads a real counter on this architecture
+constexpr bool have_tsc() {
+#ifdef ATFA_HAVE_TSC
+    return true;
+#else
+    return false;
+#endif
+}
+
+/// Reads the CPU time stamp counter, or returns 0 if there is none
+inline std::uint64_t tsc() {
+#ifdef ATFA_HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/// Accumulates the time spent in the measured part of a repetition
+/**
+  * The code being timed calls `start()` and `stop()` around the part that
+  * counts, so that setup and teardown can stay in the repetition without
+  * being measured. It may do so more than once.
+  */
+class Stopwatch
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    Stopwatch() : elapsed_(0), cycles_(0) {}
+
+    void start() {
+        start_time = clock::now();
+        start_cycles = tsc();
+    }
+
+    void stop() {
+        std::uint64_t end_cycles = tsc();
+        elapsed_ += clock::now() - start_time;
+        cycles_ += end_cycles - start_cycles;
+    }
+
+    seconds_t elapsed() const { return elapsed_; }
+    std::uint64_t cycles() const { return cycles_; }
+
+private:
+    clock::time_point start_time;
+    std::uint64_t start_cycles;
+    clock::duration elapsed_;
+    std::uint64_t cycles_;
+};
+
+/// Thrown out of `Harness::run` when its `Progress` is cancelled
+class Cancelled : public std::runtime_error {
+public:
+    Cancelled() : runtime_error("The benchmark was cancelled.") {}
+};
+
+/// Lets another thread follow, and cancel, a `Harness::run`
+/**
+  * The harness updates the fraction after every repetition. Long
+  * repetitions should call `check()` every once in a while, so that a
+  * cancellation doesn't have to wait for the whole repetition.
+  */
+class Progress
+{
+public:
+    Progress() : fraction_(0), cancelled_(false) {}
+
+    float fraction() const {
+        return fraction_.load(std::memory_order_relaxed);
+    }
+    void set_fraction(float f) {
+        fraction_.store(f, std::memory_order_relaxed);
+    }
+
+    void cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+    bool cancelled() const {
+        return cancelled_.load(std::memory_order_relaxed);
+    }
+
+    /// \throws Cancelled if `cancel()` was called
+    void check() const {
+        if (cancelled())
+            throw Cancelled();
+    }
+
+private:
+    std::atomic<float> fraction_;
+    std::atomic<bool> cancelled_;
+};
+
+/// Summary of the repetitions, normalized to a single call
+struct Stats {
+    unsigned repetitions;
+    seconds_t median;
+    seconds_t min, max;
+    seconds_t p10, p90;       ///< 10th and 90th percentiles
+    seconds_t mad;            ///< median absolute deviation from the median
+    seconds_t ci_low, ci_high; ///< 95% confidence interval of the median
+    seconds_t mean;           ///< mean of the repetitions that aren't outliers
+    unsigned outliers;        ///< repetitions more than 3 sigma (by the MAD)
+                              ///< away from the median
+    double cycles;            ///< median TSC cycles per call (0 if no TSC)
+};
+
+/// Linearly interpolated `p`-quantile of the sorted vector `v`
+inline double quantile(const std::vector<double>& v, double p) {
+    if (v.empty())
+        return 0;
+    double pos = p * double(v.size() - 1);
+    auto lo = static_cast<size_t>(pos);
+    if (lo + 1 >= v.size())
+        return v.back();
+    return v[lo] + (pos - double(lo)) * (v[lo+1] - v[lo]);
+}
+
+/// Computes the `Stats` of the per-repetition samples
+/**
+  * \param[in]  seconds     Time spent in each repetition.
+  * \param[in]  cycles      TSC cycles spent in each repetition.
+  * \param[in]  calls       How many calls each repetition made; every
+  *                         statistic is divided by it.
+  *
+  * The confidence interval of the median is distribution-free: its ends are
+  * the order statistics whose ranks are 1.96 standard deviations away from
+  * the middle rank, for a binomial with `p = 1/2`.
+  */
+inline Stats summarize(std::vector<double> seconds,
+                       std::vector<double> cycles, double calls) {
+
+    Stats s{};
+    s.repetitions = static_cast<unsigned>(seconds.size());
+    if (seconds.empty())
+        return s;
+    if (calls <= 0)
+        calls = 1;
+
+    std::sort(seconds.begin(), seconds.end());
+    std::sort(cycles.begin(), cycles.end());
+    size_t n = seconds.size();
+
+    double median = quantile(seconds, .5);
+    std::vector<double> deviations;
+    for (double x : seconds)
+        deviations.push_back(std::abs(x - median));
+    std::sort(deviations.begin(), deviations.end());
+    double mad = quantile(deviations, .5);
+
+    // 1.4826*MAD estimates the standard deviation of normal samples
+    double sum = 0;
+    size_t inliers = 0;
+    for (double x : seconds)
+        if (std::abs(x - median) <= 3 * 1.4826 * mad) {
+            sum += x;
+            ++inliers;
+        }
+
+    double half_width = 1.96 * std::sqrt(double(n)) / 2;
+    double lo_rank = std::floor(double(n)/2 - half_width);
+    double hi_rank = std::ceil(double(n)/2 + half_width);
+    size_t lo = lo_rank < 0 ? 0 : static_cast<size_t>(lo_rank);
+    size_t hi = std::min(n - 1, static_cast<size_t>(hi_rank));
+
+    s.median = seconds_t(median / calls);
+    s.min = seconds_t(seconds.front() / calls);
+    s.max = seconds_t(seconds.back() / calls);
+    s.p10 = seconds_t(quantile(seconds, .1) / calls);
+    s.p90 = seconds_t(quantile(seconds, .9) / calls);
+    s.mad = seconds_t(mad / calls);
+    s.ci_low = seconds_t(seconds[lo] / calls);
+    s.ci_high = seconds_t(seconds[hi] / calls);
+    s.mean = seconds_t(sum / double(inliers) / calls);
+    s.outliers = static_cast<unsigned>(n - inliers);
+    s.cycles = quantile(cycles, .5) / calls;
+    return s;
+
+}
+
+/// Runs a repetition over and over, and summarizes the timings
+/**
+  * A warmup repetition is run and discarded. Then repetitions are run until
+  * at least `target` seconds of wall time (setup included) have passed and
+  * at least `min_reps` repetitions were made, or until `max_reps`
+  * repetitions were made.
+  */
+class Harness
+{
+public:
+
+    constexpr static double DEFAULT_TARGET = 1; // seconds
+    constexpr static unsigned DEFAULT_MIN_REPS = 5;
+    constexpr static unsigned DEFAULT_MAX_REPS = 1000;
+
+    explicit Harness(double target = DEFAULT_TARGET,
+                     unsigned min_reps = DEFAULT_MIN_REPS,
+                     unsigned max_reps = DEFAULT_MAX_REPS)
+      : target_(target), min_reps_(min_reps),
+        max_reps_(std::max(min_reps, max_reps))
+    {}
+
+    double target() const { return target_; }
+    void set_target(double target) { target_ = target; }
+
+    /// How many repetitions `run` makes, if each takes `rep_seconds`
+    unsigned repetitions(double rep_seconds) const {
+        double reps = rep_seconds > 0 ? std::ceil(target_ / rep_seconds)
+                                      : double(max_reps_);
+        reps = std::min(std::max(reps, double(min_reps_)), double(max_reps_));
+        return static_cast<unsigned>(reps);
+    }
+
+    /// Wall time that `run` takes, warmup included, if each repetition
+    /// takes `rep_seconds`
+    double estimate(double rep_seconds) const {
+        return (repetitions(rep_seconds) + 1) * rep_seconds;
+    }
+
+    /// Runs `rep` repeatedly; `rep` makes `calls` calls to the timed code
+    /**
+      * `rep` is called as `rep(stopwatch)`, and must start and stop the
+      * given `Stopwatch` around the code it wants to measure.
+      *
+      * \throws Cancelled if `progress` is cancelled between repetitions.
+      */
+    template <class Repetition>
+    Stats run(Repetition rep, double calls, Progress *progress = nullptr) const;
+
+private:
+    double target_;
+    unsigned min_reps_, max_reps_;
+};
+
+template <class Repetition>
+Stats Harness::run(Repetition rep, double calls, Progress *progress) const {
+
+    { Stopwatch warmup; rep(warmup); }
+
+    std::vector<double> seconds, cycles;
+    auto start_time = Stopwatch::clock::now();
+    seconds_t wall{0};
+    while (seconds.size() < max_reps_ &&
+           (seconds.size() < min_reps_ || wall.count() < target_)) {
+        Stopwatch sw;
+        rep(sw);
+        seconds.push_back(sw.elapsed().count());
+        cycles.push_back(double(sw.cycles()));
+        wall = Stopwatch::clock::now() - start_time;
+        if (progress) {
+            progress->check();
+            // both conditions must hold to stop, unless max_reps_ is reached
+            float reps = float(seconds.size());
+            float f = std::min(reps / float(min_reps_),
+                               float(wall.count() / target_));
+            progress->set_fraction(std::min(1.0f,
+                                   std::max(f, reps / float(max_reps_))));
+        }
+    }
+
+    return summarize(std::move(seconds), std::move(cycles), calls);
+
+}
+
+}
+
+#endif // TIMING_H
@@ -16,57 +16,82 @@
  */
 
 #include <cmath>
+
+#include <algorithm>
 #include <vector>
 
 #include "VAD.h"
 
-constexpr double VAD_COEF_1 = -1.005079894781262e-4;
-constexpr double VAD_COEF_0 =  1.182502528634821e-2;
-
 bool vad_hard(std::vector<float>::const_iterator first,
               std::vector<float>::const_iterator last) {
-    unsigned zero_crossing = 0;
-    double power = 0;
-    if (first == last)
-        return false;
-    auto sample = *first;
-    int state = (sample > 0)*2 - 1;
-    power = sample*sample;
-    unsigned num_samples = 1;
-    for (; first != last; ++first) {
-        sample = *first;
-        if (sample * state < 0) {
-            state *= -1;
-            ++zero_crossing;
-        }
-        power += sample*sample;
-        ++num_samples;
-    }
-    power = std::sqrt(power/num_samples);
-    return (power > VAD_COEF_1*zero_crossing + VAD_COEF_0 +.002)
-           && ((zero_crossing <= 20) || (zero_crossing >= 60));
+    return vad<HardVADPolicy>(first, last);
 }
 
 bool vad_soft(std::vector<float>::const_iterator first,
               std::vector<float>::const_iterator last) {
-    unsigned zero_crossing = 0;
-    double power = 0;
-    if (first == last)
-        return false;
-    auto sample = *first;
-    int state = (sample > 0)*2 - 1;
-    power = sample*sample;
-    unsigned num_samples = 1;
-    for (; first != last; ++first) {
-        sample = *first;
-        if (sample * state < 0) {
-            state *= -1;
-            ++zero_crossing;
+    return vad<SoftVADPolicy>(first, last);
+}
+
+SpectralVAD::SpectralVAD(unsigned blk, unsigned samplerate)
+  : blk_size(blk)
+{
+    double bin_width = double(samplerate) / blk;
+    first_bin = static_cast<unsigned>(std::ceil(MIN_FREQ / bin_width));
+    unsigned last_bin = static_cast<unsigned>(MAX_FREQ / bin_width);
+    bins_per_band = std::max(1u, (last_bin - first_bin) / BANDS);
+    start();
+}
+
+void SpectralVAD::start() {
+    std::fill(noise, noise + BANDS, 0);
+    primed = false;
+    hangover = 0;
+}
+
+bool SpectralVAD::operator()(const std::vector<float>& re,
+                             const std::vector<float>& im) {
+
+    const size_t stride = re.size() / blk_size;
+    const float rise = static_cast<float>(std::pow(10, FLOOR_RISE_DB / 10));
+
+    float band_power[BANDS];
+    double total_power = 0, log_sum = 0;
+    size_t k = first_bin * stride;
+    for (unsigned b = 0; b != BANDS; ++b) {
+        float p = 0;
+        for (unsigned j = 0; j != bins_per_band; ++j, k += stride) {
+            float pj = re[k]*re[k] + im[k]*im[k];
+            p += pj;
+            log_sum += std::log(pj + 1e-20f);
         }
-        power += sample*sample;
-        ++num_samples;
+        band_power[b] = p;
+        total_power += p;
+    }
+    const unsigned bins = BANDS * bins_per_band;
+
+    double snr_db = 0;
+    for (unsigned b = 0; b != BANDS; ++b) {
+        float& n = noise[b];
+        if (!primed || band_power[b] < n)
+            n = band_power[b];
+        else
+            n *= rise;
+        n = std::max(n, 1e-20f);
+        snr_db += 10 * std::log10(std::max(band_power[b] / n, 1.0f));
     }
-    power = std::sqrt(power/num_samples);
-    return (power > VAD_COEF_1*zero_crossing + VAD_COEF_0-0.002)
-           && ((zero_crossing <= 25) || (zero_crossing >= 55));
+    snr_db /= BANDS;
+    primed = true;
+
+    // Parseval: the power of each bin is blk_size times the power per sample
+    double mean_power = total_power / bins;
+    double flatness = std::exp(log_sum / bins) / (mean_power + 1e-20);
+
+    bool voice = snr_db > SNR_THRESHOLD_DB && flatness < FLATNESS_MAX &&
+                 mean_power > MIN_POWER * blk_size;
+    if (voice)
+        hangover = HANGOVER_BLOCKS;
+    else if (hangover)
+        --hangover;
+    return hangover != 0;
+
 }
@@ -9,7 +9,7 @@
 
 /**
  *
- * \file Stream.h
+ * \file VAD.h
  *
  * Holds the interfaces to VAD functions.
  *
@@ -19,12 +19,165 @@
 #ifndef VAD_H
 #define VAD_H
 
+#include <cmath>
+#include <cstddef>
+
 #include <vector>
 
+#include "simd.h"
+
+/// Features of a block of samples, used by the VADs
+template <typename T>
+struct BlockFeatures
+{
+    T energy;                ///< sum of the squared samples
+    T peak;                  ///< largest absolute value
+    unsigned zero_crossings; ///< sign changes (zero counts as negative)
+    size_t samples;
+};
+
+/// Computes all the `BlockFeatures` of `x[0]` to `x[n-1]` in a single pass
+/**
+  * The loop is branchless and keeps `SIMD::LANES` independent accumulators,
+  * so that it is vectorized like the kernels in simd.h.
+  */
+template <typename T>
+inline BlockFeatures<T> block_features(const T *x, size_t n) {
+    using SIMD::LANES;
+    BlockFeatures<T> f = {0, 0, 0, n};
+    if (n == 0)
+        return f;
+    T energy[LANES] = {};
+    T peak[LANES] = {};
+    unsigned zc[LANES] = {};
+    // p[0] goes to the k-th accumulators; p[-1] is the previous sample
+    auto step = [&](const T *p, unsigned k) {
+        T a = p[0] < 0 ? -p[0] : p[0];
+        energy[k] += p[0] * p[0];
+        peak[k] = a > peak[k] ? a : peak[k];
+        zc[k] += (p[0] > 0) != (p[-1] > 0);
+    };
+    // the first sample has no predecessor, so it can't be a zero crossing
+    f.energy = x[0] * x[0];
+    f.peak = x[0] < 0 ? -x[0] : x[0];
+    const T *s = x + 1;
+    const T *end = s + (n - 1) / LANES * LANES;
+    for (; s != end; s += LANES)
+        for (unsigned k = 0; k != LANES; ++k)
+            step(s + k, k);
+    for (unsigned k = 0; k != (n - 1) % LANES; ++k)
+        step(s + k, k);
+    for (unsigned k = 0; k != LANES; ++k) {
+        f.energy += energy[k];
+        f.peak = peak[k] > f.peak ? peak[k] : f.peak;
+        f.zero_crossings += zc[k];
+    }
+    return f;
+}
+
+/// Coefficients of the zero-crossing-dependent power threshold
+constexpr double VAD_COEF_1 = -1.005079894781262e-4;
+constexpr double VAD_COEF_0 =  1.182502528634821e-2;
+
+/// Generic threshold VAD, parametrized by a compile-time `Policy`
+/**
+  * A block has voice if its RMS value is above a threshold that decreases
+  * with the number of zero crossings, and if the number of zero crossings is
+  * not in the range typical of noise. The `Policy` class provides:
+  *
+  *  - `OFFSET`: added to the RMS threshold;
+  *  - `ZC_LOW` and `ZC_HIGH`: zero crossings strictly between them mean
+  *    noise.
+  *
+  * New VADs of this kind are added by writing a new policy, and
+  * instantiating `vad`.
+  */
+template <class Policy>
+bool vad(std::vector<float>::const_iterator first,
+         std::vector<float>::const_iterator last) {
+    if (first == last)
+        return false;
+    auto f = block_features(&*first, static_cast<size_t>(last - first));
+    double rms = std::sqrt(double(f.energy) / f.samples);
+    return (rms > VAD_COEF_1*f.zero_crossings + VAD_COEF_0 + Policy::OFFSET)
+           && (f.zero_crossings <= Policy::ZC_LOW ||
+               f.zero_crossings >= Policy::ZC_HIGH);
+}
+
+struct HardVADPolicy {
+    static constexpr double OFFSET = .002;
+    static constexpr unsigned ZC_LOW = 20;
+    static constexpr unsigned ZC_HIGH = 60;
+};
+
+struct SoftVADPolicy {
+    static constexpr double OFFSET = -.002;
+    static constexpr unsigned ZC_LOW = 25;
+    static constexpr unsigned ZC_HIGH = 55;
+};
+
+/// VAD that works on the spectrum of the block
+/**
+  * `Stream::rir_fft` computes the DFT of each block (zero-padded to the FFT
+  * size) anyway, so this VAD costs no extra transform. Every `stride`-th bin
+  * of the padded spectrum is a bin of the block's own DFT. Only the bins
+  * between `MIN_FREQ` and `MAX_FREQ` (the telephone speech band) are used.
+  * They are split into `BANDS` sub-bands.
+  *
+  * Voice is detected when both of these hold:
+  *
+  *  - the mean SNR of the sub-bands is above `SNR_THRESHOLD_DB`, where the
+  *    noise floor of each sub-band is tracked by following its minimum
+  *    energy. The floor drops at once and rises by `FLOOR_RISE_DB` per block.
+  *  - the spectral flatness (geometric over arithmetic mean of the power)
+  *    is below `FLATNESS_MAX`. Noise is flat, and voiced speech is not.
+  *
+  * Detection is held for `HANGOVER_BLOCKS` blocks. The noise floor must be
+  * tracked continuously, so `operator()` should be called for every block.
+  */
+class SpectralVAD
+{
+
+public:
+    static constexpr unsigned BANDS = 8;
+    static constexpr unsigned HANGOVER_BLOCKS = 4;
+    static constexpr double MIN_FREQ = 150; // Hz
+    static constexpr double MAX_FREQ = 3800;
+    static constexpr double SNR_THRESHOLD_DB = 6;
+    static constexpr double FLATNESS_MAX = .3;
+    static constexpr double FLOOR_RISE_DB = .05; // about 4 dB/s at 11025 Hz
+    static constexpr double MIN_POWER = 1e-7; // per sample; about -70 dBFS
+
+    SpectralVAD(unsigned blk, unsigned samplerate);
+
+    /// Resets the noise floor. Called when a session starts.
+    void start();
+
+    /// Returns whether there is voice in the block whose spectrum is given
+    /**
+      * `re` and `im` hold the (unnormalized) DFT of the block, zero-padded
+      * to `re.size()` samples, which must be a multiple of the block size.
+      */
+    bool operator()(const std::vector<float>& re,
+                    const std::vector<float>& im);
+
+private:
+
+    unsigned blk_size;
+    unsigned first_bin, bins_per_band;
+
+    float noise[BANDS];
+    bool primed;
+    unsigned hangover;
+
+};
+
+/// Stricter VAD, suggested for noisy environments
 bool vad_hard(std::vector<float>::const_iterator first,
               std::vector<float>::const_iterator last);
 
+/// More sensitive VAD
 bool vad_soft(std::vector<float>::const_iterator first,
               std::vector<float>::const_iterator last);
 
-#endif // STREAM_H
+#endif // VAD_H
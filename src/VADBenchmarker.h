@@ -0,0 +1,130 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file VADBenchmarker.h
+ *
+ * Holds the `VADBenchmarker` class, which measures the cost and the accuracy
+ * of a voice activity detector.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#ifndef VADBENCHMARKER_H
+#define VADBENCHMARKER_H
+
+#include <cmath>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "Signal.h"
+#include "Timing.h"
+
+/// Measures the per-block cost and the accuracy of a VAD
+/**
+  * The input signal is cut in blocks, and each block is labelled as voice if
+  * its energy is at most `-REFERENCE_DB` dB below the loudest block. The VAD
+  * then classifies the same blocks with noise added, at the level of the
+  * scenario, so the clean signal serves as the reference.
+  *
+  * The detector is called as `detect(first, re, im)`, like
+  * `Stream::detect_voice`: `first` points to the block, and `re`/`im` hold
+  * its DFT zero-padded to `fft_size`. Only the detector call is timed, not
+  * the DFT.
+  */
+class VADBenchmarker
+{
+public:
+
+    constexpr static int REFERENCE_DB = -30;
+
+    struct Result {
+        std::chrono::duration<double> time_per_block;
+        unsigned blocks;
+        unsigned voice_blocks; ///< according to the reference
+        double hit_rate;         ///< voice blocks detected
+        double false_alarm_rate; ///< silent blocks detected as voice
+    };
+
+    VADBenchmarker(const Signal& input, int noise,
+                   size_t blk_size, size_t fft_size)
+        : blk_size_(blk_size), fft_size_(fft_size),
+          noisy_(input.array(), input.array() + input.samples())
+    {
+        size_t blocks = input.samples() / blk_size;
+        std::vector<double> energy(blocks);
+        for (size_t b = 0; b != blocks; ++b)
+            for (size_t i = b*blk_size; i != (b+1)*blk_size; ++i)
+                energy[b] += double(input[i]) * input[i];
+        double threshold = blocks == 0 ? 0 :
+                *std::max_element(energy.begin(), energy.end()) *
+                std::pow(10, REFERENCE_DB/10.0);
+        for (double e : energy)
+            labels_.push_back(e > threshold);
+        std::mt19937 rng;
+        std::normal_distribution<> gauss{0, std::pow(10, noise/20.0)};
+        for (auto& x : noisy_) x += gauss(rng);
+    }
+
+    /// \throws Timing::Cancelled if `progress` gets cancelled.
+    template <class Detector>
+    Result benchmark(Detector detect,
+                     const Timing::Progress *progress = nullptr);
+
+private:
+
+    size_t blk_size_;
+    size_t fft_size_;
+
+    Signal::container_t noisy_;
+    std::vector<bool> labels_;
+
+};
+
+template <class Detector>
+VADBenchmarker::Result VADBenchmarker::benchmark(
+        Detector detect, const Timing::Progress *progress) {
+
+    Signal::container_t re(fft_size_), im(fft_size_);
+    DefaultDFT dft; // Signal::dft can't be shared with other threads
+    std::chrono::steady_clock::duration total{0};
+    unsigned hits = 0, false_alarms = 0, voice = 0;
+
+    for (size_t b = 0; b != labels_.size(); ++b) {
+        if (progress)
+            progress->check();
+        auto first = noisy_.cbegin() + static_cast<long>(b*blk_size_);
+        std::fill(std::copy(first, first + static_cast<long>(blk_size_),
+                            re.begin()),
+                  re.end(), 0);
+        std::fill(im.begin(), im.end(), 0);
+        dft(re, im);
+        auto start_time = std::chrono::steady_clock::now();
+        bool detected = detect(first, re, im);
+        total += std::chrono::steady_clock::now() - start_time;
+        voice += labels_[b];
+        if (detected)
+            (labels_[b] ? hits : false_alarms) += 1;
+    }
+
+    unsigned blocks = static_cast<unsigned>(labels_.size());
+    std::chrono::duration<double> total_time = total;
+    return {
+        blocks ? total_time / double(blocks) : total_time, blocks, voice,
+        voice ? double(hits) / voice : 0,
+        blocks != voice ? double(false_alarms) / (blocks - voice) : 0
+    };
+
+}
+
+#endif // VADBENCHMARKER_H
@@ -0,0 +1,109 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file VADPlugin.cpp
+ *
+ * Holds the implementation of the `VADPlugin` class.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#include <cmath>
+
+#include <iostream>
+#include <vector>
+
+#include "VADPlugin.h"
+#include "utils.h"
+
+VADPlugin::VADPlugin(const std::string& dso_path)
+  : path(dso_path), data(nullptr)
+{
+
+    lib = dlopen(path.c_str(), RTLD_NOW);
+    if (!lib)
+        throw VADPluginException("Could not open shared object file",
+                                 path, dlerror());
+
+    auto api = static_cast<ATFA_VAD_API_table_t *>(dlsym(lib, "vad_api"));
+    if (!api || !api->init || !api->classify || !api->close || !api->title) {
+        std::string err = api ? "" : dlerror();
+        dlclose(lib);
+        throw VADPluginException("Could not open a complete vad_api table"
+                                 " from shared object file", path, err);
+    }
+
+    init = api->init;
+    classify_fn = api->classify;
+    close = api->close;
+
+    try {
+        test();
+    } catch (...) {
+        dlclose(lib);
+        throw;
+    }
+
+    title_str = (*api->title)();
+
+}
+
+VADPlugin::~VADPlugin() {
+    if (data) // must be closed while the DSO is still loaded
+        destroy_data_structures();
+    if (dlclose(lib) != 0)
+        std::cerr << "[VAD DSO] Warning: could not close dynamic shared"
+                  << " object." << std::endl
+                  << "[VAD DSO] DSO path: " << path << std::endl
+                  << "[VAD DSO] DL error: " << dlerror() << std::endl;
+}
+
+void VADPlugin::initialize_data_structures(unsigned blk_size,
+                                           unsigned samplerate) {
+    if (data)
+        destroy_data_structures();
+    data = (*init)(blk_size, samplerate);
+    if (!data)
+        throw VADPluginException("Could not initialize VAD data structures",
+                                 path);
+}
+
+void VADPlugin::destroy_data_structures() {
+    if (!(*close)(data))
+        std::cerr << "[VAD DSO] Warning: could not close VAD data"
+                  << " structures." << std::endl
+                  << "[VAD DSO] DSO path: " << path << std::endl;
+    data = nullptr;
+}
+
+/**
+  * Runs the detector on a few blocks of silence and of a loud tone, at two
+  * block sizes. Only checks that nothing fails; the decisions are up to the
+  * detector.
+  */
+void VADPlugin::test() {
+    for (unsigned blk_size : {128u, 256u}) {
+        VADData *dat = (*init)(blk_size, 11025);
+        if (!dat)
+            throw VADPluginException("Could not initialize VAD data"
+                                     " structures, during testing", path);
+        std::vector<float> x(blk_size, 0);
+        for (int i = 0; i < 4; ++i)
+            (*classify_fn)(dat, x.data(), blk_size);
+        for (unsigned n = 0; n != blk_size; ++n)
+            x[n] = .5f * static_cast<float>(std::sin(TAU * 200 * n / 11025));
+        for (int i = 0; i < 4; ++i)
+            (*classify_fn)(dat, x.data(), blk_size);
+        if (!(*close)(dat))
+            throw VADPluginException("Error while closing VAD data structures"
+                                     " during testing", path);
+    }
+}
@@ -0,0 +1,89 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file VADPlugin.h
+ *
+ * Holds the interface to the `VADPlugin` class.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#ifndef VADPLUGIN_H
+#define VADPLUGIN_H
+
+extern "C" {
+#include <dlfcn.h>
+}
+
+#include <stdexcept>
+#include <string>
+
+#include "atfa_vad_api.h"
+
+/// A VAD loaded from a DSO (see atfa_vad_api.h)
+/**
+  * The DSO is loaded and tested by the constructor. Then,
+  * `initialize_data_structures()` must be called before `classify()`, and
+  * `destroy_data_structures()` after the last call to it.
+  */
+class VADPlugin
+{
+
+public:
+
+    explicit VADPlugin(const std::string& dso_path);
+    ~VADPlugin();
+
+    VADPlugin(const VADPlugin&) = delete;
+    VADPlugin& operator=(const VADPlugin&) = delete;
+
+    void test();
+
+    void initialize_data_structures(unsigned blk_size, unsigned samplerate);
+    void destroy_data_structures();
+
+    bool classify(const float *x, unsigned n) {
+        return (*classify_fn)(data, x, n) != 0;
+    }
+
+    std::string get_path() const {
+        return path;
+    }
+
+    const char *get_title() const {
+        return title_str.c_str();
+    }
+
+private:
+
+    std::string path;
+    std::string title_str;
+
+    void *lib;
+
+    vad_init_t *init;
+    vad_classify_t *classify_fn;
+    vad_close_t *close;
+
+    VADData *data;
+
+};
+
+class VADPluginException: public std::runtime_error {
+public:
+    VADPluginException(const std::string& desc, const std::string& dso_path,
+                       const std::string& dlerr = "")
+        : runtime_error(std::string("VAD DSO error: ") + desc + ". DSO: " +
+                        dso_path + " ." +
+                        (dlerr.empty() ? "" : " DL error: " + dlerr)) {}
+};
+
+#endif // VADPLUGIN_H
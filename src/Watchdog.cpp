@@ -0,0 +1,71 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file Watchdog.cpp
+ *
+ * Holds the implementation of the `Watchdog` class.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#include <iostream>
+
+#include "Watchdog.h"
+
+void Watchdog::flush_log() {
+    unsigned t = tail.load(std::memory_order_relaxed);
+    unsigned h = head.load(std::memory_order_acquire);
+    while (t != h) {
+        const Event& ev = queue[t];
+        std::cerr << "[Watchdog] Warning: adaptive filter diverged at sample "
+                  << ev.sample << ": ";
+        switch (ev.reason) {
+        case NonFinite:
+            std::cerr << "non-finite output";
+            break;
+        case ErrorEnergy:
+            std::cerr << "output energy " << 10*std::log10(ev.value)
+                      << " dB above the microphone energy";
+            break;
+        case CoefNorm:
+            std::cerr << "coefficient norm " << ev.value;
+            break;
+        }
+        std::cerr << ". Action: " << action_name(ev.action) << "."
+                  << std::endl;
+        t = (t + 1) % QUEUE_SIZE;
+        tail.store(t, std::memory_order_release);
+    }
+    unsigned long d = dropped.exchange(0);
+    if (d)
+        std::cerr << "[Watchdog] Warning: " << d << " more events were not"
+                  << " logged." << std::endl;
+}
+
+const char *Watchdog::action_name(Action a) {
+    switch (a) {
+    case Off:     return "Off";
+    case Restart: return "Restart";
+    case Freeze:  return "Freeze";
+    case Abort:   return "Abort";
+    }
+    return "";
+}
+
+Watchdog::Action Watchdog::action_from_name(const std::string& name,
+                                            bool *ok) {
+    *ok = true;
+    for (Action a : {Off, Restart, Freeze, Abort})
+        if (name == action_name(a))
+            return a;
+    *ok = false;
+    return DEFAULT_ACTION;
+}
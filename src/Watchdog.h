@@ -0,0 +1,189 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file Watchdog.h
+ *
+ * Holds the interface to the `Watchdog` class.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <cmath>
+
+#include <array>
+#include <atomic>
+#include <string>
+
+#include "simd.h"
+
+/// Detects a diverging adaptive filter from inside the audio callback
+/**
+  * `Stream::read_write` calls `check()` once per callback, with the block of
+  * filter outputs it has just produced, the corresponding block of
+  * microphone samples, and the coefficient vector (if the DSO exposes it).
+  * The filter is considered to have diverged if:
+  *
+  *  - the output has a non-finite sample (NaN, Inf, or a value so large its
+  *    square overflows);
+  *  - the energy of the output is above `energy_ratio` times the energy of
+  *    the microphone signal, over a window of `hold_samples` samples (an
+  *    echo canceller should never make the echo louder);
+  *  - the norm of the coefficient vector is non-finite or above
+  *    `max_coef_norm`.
+  *
+  * All the reductions are done by the kernels in simd.h, so the cost is a
+  * few vector instructions per sample.
+  *
+  * When the filter diverges, `check()` returns the configured action, which
+  * is carried out by the caller, and records an `Event` in a lock-free queue.
+  * The events are printed to `std::cerr` by `flush_log()`, which must be
+  * called from a thread that is allowed to block.
+  */
+class Watchdog
+{
+
+public:
+    typedef float sample_t;
+
+    enum Action { Off, Restart, Freeze, Abort };
+    enum Reason { NonFinite, ErrorEnergy, CoefNorm };
+
+    struct Event {
+        unsigned long long sample; // samples processed before the event
+        Reason reason;
+        Action action;
+        float value; // energy ratio, or coefficient norm
+    };
+
+    static constexpr Action DEFAULT_ACTION = Restart;
+    static constexpr int DEFAULT_ENERGY_RATIO_DB = 6;
+    static constexpr int DEFAULT_MAX_COEF_NORM = 100;
+
+    static constexpr unsigned QUEUE_SIZE = 64;
+
+    Watchdog()
+      : action_(Off), energy_ratio(0), max_coef_norm(0), hold_samples(1),
+        head(0), tail(0), dropped(0), total_events(0), aborted_(false)
+    {
+        start();
+    }
+
+    void configure(Action action, int energy_ratio_db, int max_norm,
+                   unsigned hold) {
+        action_ = action;
+        energy_ratio = std::pow(10.0f, energy_ratio_db / 10.0f);
+        max_coef_norm = static_cast<float>(max_norm);
+        hold_samples = hold ? hold : 1;
+    }
+
+    Action action() const { return action_; }
+
+    /// Resets the counters. Called when a session starts.
+    void start() {
+        samples = 0;
+        window_samples = 0;
+        window_e = window_y = 0;
+        aborted_ = false;
+    }
+
+    /// Checks a block of output; returns the action to take, or `Off`.
+    /**
+      * The microphone block may be split in two parts, because it comes from
+      * a circular buffer. `gain` is the factor that was applied to the
+      * filter output before it was written to `e`.
+      */
+    Action check(const sample_t *e, unsigned n,
+                 const sample_t *y1, unsigned n1,
+                 const sample_t *y2, unsigned n2, float gain,
+                 const sample_t *w, unsigned nw) {
+        if (action_ == Off)
+            return Off;
+        unsigned long long first = samples;
+        samples += n;
+        sample_t e_energy = SIMD::sum_squares(e, n);
+        if (!std::isfinite(e_energy))
+            return trip(first, NonFinite, e_energy);
+        if (nw) {
+            sample_t norm = std::sqrt(SIMD::sum_squares(w, nw));
+            if (!std::isfinite(norm) || norm > max_coef_norm)
+                return trip(first, CoefNorm, norm);
+        }
+        if (gain > 0) {
+            window_e += e_energy / (gain*gain);
+            window_y += SIMD::sum_squares(y1, n1) + SIMD::sum_squares(y2, n2);
+            window_samples += n;
+            if (window_samples >= hold_samples) {
+                // ignore silence, where any ratio would be meaningless
+                bool silent = window_y < 1e-8f * window_samples;
+                float ratio = silent ? 0 : window_e / window_y;
+                window_e = window_y = 0;
+                window_samples = 0;
+                if (ratio > energy_ratio)
+                    return trip(first, ErrorEnergy, ratio);
+            }
+        }
+        return Off;
+    }
+
+    /// Whether the stream was aborted because of a divergence.
+    bool aborted() const { return aborted_; }
+
+    /// Prints pending events to `std::cerr`. Not real-time safe.
+    void flush_log();
+
+    unsigned long events() const { return total_events; }
+
+    static const char *action_name(Action a);
+    static Action action_from_name(const std::string& name, bool *ok);
+
+private:
+
+    Action action_;
+    float energy_ratio;
+    float max_coef_norm;
+    unsigned hold_samples;
+
+    unsigned long long samples;
+    unsigned window_samples;
+    float window_e, window_y;
+
+    std::array<Event, QUEUE_SIZE> queue;
+    std::atomic<unsigned> head; // written by the audio callback
+    std::atomic<unsigned> tail; // written by `flush_log()`
+    std::atomic<unsigned long> dropped;
+    std::atomic<unsigned long> total_events;
+
+    std::atomic<bool> aborted_;
+
+    Action trip(unsigned long long sample, Reason reason, float value) {
+        unsigned h = head.load(std::memory_order_relaxed);
+        unsigned next = (h + 1) % QUEUE_SIZE;
+        if (next == tail.load(std::memory_order_acquire))
+            dropped.fetch_add(1, std::memory_order_relaxed);
+        else {
+            queue[h] = Event{sample, reason, action_, value};
+            head.store(next, std::memory_order_release);
+        }
+        total_events.fetch_add(1, std::memory_order_relaxed);
+        // a restarted filter needs a fresh window
+        window_e = window_y = 0;
+        window_samples = 0;
+        if (action_ == Abort)
+            aborted_ = true;
+        return action_;
+    }
+
+};
+
+#endif // WATCHDOG_H
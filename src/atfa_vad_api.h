@@ -0,0 +1,72 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file atfa_vad_api.h
+ *
+ * Holds the C interface that a VAD (Voice Activity Detector) DSO implements.
+ *
+ * A VAD DSO exports a variable called `vad_api`, of type
+ * `ATFA_VAD_API_table_t`, filled with pointers to its functions. This
+ * mirrors the `adapf_api` table of adaptive filter DSOs. For example:
+ *
+ *     #include "atfa_vad_api.h"
+ *
+ *     struct VADData { float threshold; };
+ *
+ *     static VADData *my_init(unsigned blk_size, unsigned samplerate) {...}
+ *     static int my_classify(VADData *d, const float *x, unsigned n) {...}
+ *     static int my_close(VADData *d) {...}
+ *     static const char *my_title(void) { return "My VAD"; }
+ *
+ *     ATFA_VAD_API_table_t vad_api = {
+ *         my_init, my_classify, my_close, my_title
+ *     };
+ *
+ * The detector is initialized once per simulation, and `classify` is called
+ * once per block, from a worker thread (not from the audio callback).
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#ifndef ATFA_VAD_API_H
+#define ATFA_VAD_API_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct VADData VADData;
+
+/** Allocates the state of the detector, which will be given blocks of
+    `blk_size` samples at `samplerate` Hz. Returns NULL on failure. */
+typedef VADData *(vad_init_t)(unsigned blk_size, unsigned samplerate);
+
+/** Returns nonzero if the block `x[0]` to `x[n-1]` has voice. */
+typedef int (vad_classify_t)(VADData *data, const float *x, unsigned n);
+
+/** Frees the state. Returns zero on failure. */
+typedef int (vad_close_t)(VADData *data);
+
+/** Returns the name of the detector, shown in the user interface. */
+typedef const char *(vad_title_t)(void);
+
+typedef struct {
+    vad_init_t *init;
+    vad_classify_t *classify;
+    vad_close_t *close;
+    vad_title_t *title;
+} ATFA_VAD_API_table_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ATFA_VAD_API_H */
@@ -0,0 +1,551 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file batch.cpp
+ *
+ * Holds the `main` function of `atfa-batch`, which benchmarks every
+ * combination of input, RIR, noise and adaptive filter DSO listed in a
+ * manifest, on a pool of threads, and writes all the results to one table.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <QtCore>
+
+#include "AdapfBenchmarker.h"
+#include "AdaptiveFilter.h"
+#include "EchoQuality.h"
+#include "RIR.h"
+#include "Signal.h"
+#include "utils.h"
+
+namespace {
+
+typedef AdapfBenchmarker<float> benchmarker_t;
+
+const char *MODE_NAMES[3] = { "never", "normal", "always" };
+
+constexpr int NOISE_MIN = -180; // dB, the same range as in the scenarios
+constexpr int NOISE_MAX = -20;
+
+struct Options {
+    std::string manifest;
+    std::string output;
+    unsigned jobs = 0; // 0: one per hardware thread
+    bool help = false;
+};
+
+class UsageError : public std::runtime_error {
+public:
+    UsageError(const std::string& desc) : runtime_error(desc) {}
+};
+
+class ManifestError : public std::runtime_error {
+public:
+    ManifestError(const std::string& desc)
+        : runtime_error(std::string("Manifest error: ") + desc) {}
+};
+
+void print_usage(const char *argv0) {
+    std::cerr
+        << "Usage: " << argv0 << " [options] <manifest.json>\n"
+        << "\n"
+        << "Benchmarks every combination of input, RIR, noise level, noise"
+           " seed and\nadaptive filter DSO given in the manifest, and writes"
+           " one CSV row per\ncombination and learning mode, as soon as it is"
+           " done. The manifest is a\nJSON object like\n"
+        << "\n"
+        << "    { \"dsos\": [\"nlms.so\", \"rls.so\"],\n"
+           "      \"inputs\": [\"speech1.wav\", \"speech2.wav\"],\n"
+           "      \"rirs\": [\"\", \"room.m\"],\n"
+           "      \"noise_db\": [-180, -60],\n"
+           "      \"seeds\": [1, 2],\n"
+           "      \"modes\": [0, 1, 2],\n"
+           "      \"target\": 0.5,\n"
+           "      \"target_erle\": 20,\n"
+           "      \"isolated\": false }\n"
+        << "\n"
+        << "where only \"dsos\" and \"inputs\" are required, an empty RIR is"
+           " no RIR\nand an empty DSO is the dummy filter. Relative paths are"
+           " relative to the\nmanifest.\n"
+        << "\n"
+        << "Options:\n"
+        << "  --jobs N         benchmarks run at the same time (default: one"
+           " per\n                   hardware thread; use 1 for the most"
+           " reliable timings)\n"
+        << "  --output FILE    write to FILE instead of stdout\n"
+        << "\n"
+        << "Exit status: 0 if all went well, 1 if some combination failed,"
+           " 2 on bad\nusage, and 3 on any other error.\n";
+}
+
+Options parse_args(int argc, char *argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help") {
+            opts.help = true;
+            continue;
+        }
+        if (arg.compare(0, 2, "--") != 0) {
+            if (!opts.manifest.empty())
+                throw UsageError("Too many arguments.");
+            opts.manifest = arg;
+            continue;
+        }
+        if (i + 1 == argc)
+            throw UsageError(arg + " expects a value.");
+        std::string value = argv[++i];
+        if (arg == "--jobs") {
+            std::istringstream iss(value);
+            long n;
+            if (!(iss >> n) || !iss.eof() || n < 1)
+                throw UsageError("--jobs expects a positive integer.");
+            opts.jobs = static_cast<unsigned>(n);
+        }
+        else if (arg == "--output")
+            opts.output = value;
+        else
+            throw UsageError("Unknown option " + arg + ".");
+    }
+    if (opts.manifest.empty() && !opts.help)
+        throw UsageError("The manifest is required.");
+    return opts;
+}
+
+/// Values computed once and shared by all the threads that need them
+/**
+  * The first thread to `get()` a key computes its value, and the others wait
+  * for it. The caller says beforehand how many times each key will be used
+  * (`expect()`), and after each use calls `release()`, so that the value is
+  * dropped as soon as nobody needs it anymore; the memory in use then depends
+  * on the order of the work, and not on the size of the whole batch.
+  */
+template <typename Key, typename Value>
+class SharedCache
+{
+public:
+
+    typedef std::shared_ptr<const Value> pointer;
+
+    void expect(const Key& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++entries[key].uses;
+    }
+
+    /// The value of `key`, made with `make()` (which returns a new `Value`)
+    /// if it isn't there yet
+    /**
+      * If `make()` throws, everyone waiting for the key gets the exception.
+      */
+    template <class Make>
+    pointer get(const Key& key, Make make) {
+        std::unique_lock<std::mutex> lock(mutex);
+        Entry& e = entries[key];
+        if (e.value.valid()) {
+            auto value = e.value;
+            lock.unlock();
+            return value.get();
+        }
+        std::promise<pointer> promise;
+        e.value = promise.get_future().share();
+        auto value = e.value;
+        ++computed_;
+        lock.unlock();
+        try {
+            promise.set_value(pointer(make()));
+        } catch (...) {
+            promise.set_exception(std::current_exception());
+        }
+        return value.get();
+    }
+
+    void release(const Key& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if (it != entries.end() && --it->second.uses <= 0)
+            entries.erase(it);
+    }
+
+    /// How many values were made
+    unsigned computed() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return computed_;
+    }
+
+private:
+
+    struct Entry {
+        std::shared_future<pointer> value;
+        int uses = 0;
+    };
+
+    mutable std::mutex mutex;
+    std::map<Key, Entry> entries;
+    unsigned computed_ = 0;
+
+};
+
+struct DSO {
+    std::string name; ///< as in the manifest
+    std::string path;
+    std::string title;
+    bool reentrant;
+    std::mutex mutex; ///< held while a non-reentrant DSO runs
+};
+
+struct File {
+    std::string name; ///< as in the manifest
+    std::string path;
+};
+
+/// One cell of the matrix; runs the selected modes of one DSO
+struct Job {
+    size_t dso, input, rir;
+    int noise;
+    unsigned seed;
+};
+
+struct Manifest {
+    std::vector<std::unique_ptr<DSO>> dsos;
+    std::vector<File> inputs;
+    std::vector<File> rirs;
+    std::vector<int> noises;
+    std::vector<unsigned> seeds;
+    std::vector<int> modes;
+    double target = Timing::Harness::DEFAULT_TARGET;
+    double target_erle = EchoQuality<float>::DEFAULT_TARGET_ERLE;
+    bool isolated = false;
+};
+
+/// `name` relative to the manifest's directory, unless it's absolute
+std::string resolve(const std::string& manifest, const std::string& name) {
+    auto slash = manifest.rfind('/');
+    if (name.empty() || name[0] == '/' || slash == std::string::npos)
+        return name;
+    return manifest.substr(0, slash + 1) + name;
+}
+
+std::vector<File> read_files(const std::string& manifest,
+                             const QJsonObject& obj, const char *key,
+                             bool required) {
+    std::vector<File> files;
+    if (!obj.contains(key)) {
+        if (required)
+            throw ManifestError(std::string("\"") + key + "\" is missing.");
+        files.push_back(File{"", ""});
+        return files;
+    }
+    for (const auto& v : obj.value(key).toArray()) {
+        if (!v.isString())
+            throw ManifestError(std::string("\"") + key +
+                                "\" must be a list of strings.");
+        std::string name = v.toString().toStdString();
+        files.push_back(File{name, resolve(manifest, name)});
+    }
+    if (files.empty())
+        throw ManifestError(std::string("\"") + key + "\" is empty.");
+    return files;
+}
+
+template <typename T>
+std::vector<T> read_numbers(const QJsonObject& obj, const char *key,
+                            double min, double max, T dflt) {
+    if (!obj.contains(key))
+        return { dflt };
+    std::vector<T> xs;
+    for (const auto& v : obj.value(key).toArray()) {
+        double x = v.toDouble(min - 1);
+        if (!v.isDouble() || x < min || x > max || x != std::floor(x))
+            throw ManifestError(std::string("\"") + key +
+                                "\" has an invalid value.");
+        xs.push_back(static_cast<T>(x));
+    }
+    if (xs.empty())
+        throw ManifestError(std::string("\"") + key + "\" is empty.");
+    return xs;
+}
+
+/// Reads the manifest, and loads each DSO once, to check it and to know
+/// whether it is reentrant
+void read_manifest(const std::string& filename, Manifest& m) {
+    QJsonObject obj = read_json_file(QString::fromStdString(filename));
+    m.isolated = obj.value("isolated").toBool(false);
+    m.target = obj.value("target").toDouble(m.target);
+    m.target_erle = obj.value("target_erle").toDouble(m.target_erle);
+    if (m.target <= 0)
+        throw ManifestError("\"target\" must be positive.");
+    m.inputs = read_files(filename, obj, "inputs", true);
+    m.rirs = read_files(filename, obj, "rirs", false);
+    m.noises = read_numbers<int>(obj, "noise_db", NOISE_MIN, NOISE_MAX,
+                                 NOISE_MIN);
+    m.seeds = read_numbers<unsigned>(obj, "seeds", 0, 4294967295.0,
+                                     benchmarker_t::DEFAULT_SEED);
+    m.modes = read_numbers<int>(obj, "modes", 0, 2, 0);
+    if (!obj.contains("modes"))
+        m.modes = { 0, 1, 2 };
+    for (const auto& f : read_files(filename, obj, "dsos", true)) {
+        std::unique_ptr<DSO> dso(new DSO);
+        dso->name = f.name;
+        dso->path = f.path;
+        AdaptiveFilter<float> af(f.path, m.isolated);
+        dso->title = af.get_title();
+        dso->reentrant = af.is_reentrant();
+        m.dsos.push_back(std::move(dso));
+    }
+}
+
+/// The quality figures, as CSV columns; NaN if not measured
+const char *QUALITY_KEYS[5] = {
+    "erle_db", "steady_erle_db", "steady_error_db", "misalignment_db",
+    "convergence_s"
+};
+
+std::vector<double> quality_figures(const benchmarker_t::Quality& q) {
+    return { q.erle_db, q.steady_erle_db, q.steady_error_db,
+             q.misalignment_db, q.convergence_time };
+}
+
+/// Quotes a CSV field, if needed
+std::string csv(const std::string& field) {
+    if (field.find_first_of(",\"\n") == std::string::npos)
+        return field;
+    std::string quoted = "\"";
+    for (char ch : field) {
+        if (ch == '"')
+            quoted += '"';
+        quoted += ch;
+    }
+    return quoted + '"';
+}
+
+/// Writes the rows of the finished jobs, in the order they finish
+class Table
+{
+public:
+
+    Table(std::ostream& os, size_t total) : os(os), total(total), done(0) {
+        os << "dso,title,input,rir,noise_db,seed,learn,mode,samples,"
+              "repetitions,median_ns,ci_low_ns,ci_high_ns,mad_ns,min_ns,"
+              "mean_ns,update_fraction";
+        for (auto key : QUALITY_KEYS)
+            os << ',' << key;
+        os << ",error" << std::endl;
+    }
+
+    /// Writes the rows of one job; `error` is empty if it went well, in
+    /// which case there is a result for each of `modes`
+    void write(const Manifest& m, const Job& job,
+               const std::vector<benchmarker_t::Result>& results, int N,
+               const std::string& error) {
+        std::ostringstream rows;
+        std::string key = csv(m.dsos[job.dso]->name) + ',' +
+                          csv(m.dsos[job.dso]->title) + ',' +
+                          csv(m.inputs[job.input].name) + ',' +
+                          csv(m.rirs[job.rir].name) + ',' +
+                          std::to_string(job.noise) + ',' +
+                          std::to_string(job.seed) + ',';
+        if (!error.empty()) {
+            rows << key << ",,,,,,,,,," << std::string(5, ',') << ','
+                 << csv(error) << '\n';
+        }
+        else for (size_t k = 0; k != results.size(); ++k) {
+            const auto& r = results[k];
+            const Timing::Stats& t = r.time_per_sample;
+            rows << key << m.modes[k] << ',' << MODE_NAMES[m.modes[k]] << ','
+                 << N << ',' << t.repetitions;
+            for (auto s : { t.median, t.ci_low, t.ci_high, t.mad, t.min,
+                            t.mean })
+                rows << ',' << s.count() * 1e9;
+            rows << ',' << (N ? double(r.updates) / N : 0);
+            // the figures that couldn't be measured are left empty
+            for (double x : quality_figures(r.quality)) {
+                rows << ',';
+                if (!std::isnan(x))
+                    rows << x;
+            }
+            rows << ",\n";
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        os << rows.str() << std::flush;
+        ++done;
+        std::cerr << "[Batch] " << done << '/' << total << " done"
+                  << (error.empty() ? "" : " (failed)") << std::endl;
+    }
+
+private:
+    std::ostream& os;
+    size_t total, done;
+    std::mutex mutex;
+};
+
+typedef std::tuple<size_t, size_t, int, unsigned> EchoKey;
+
+/// The decoded inputs, RIRs and echoes, shared by the jobs
+struct Caches {
+    SharedCache<size_t, Signal> inputs;
+    SharedCache<size_t, Signal> rirs;
+    SharedCache<EchoKey, Signal> echoes;
+};
+
+/// Runs one job; returns false if it failed
+bool run_job(const Manifest& m, const Job& job, Caches& caches,
+             Table& table) {
+
+    std::vector<benchmarker_t::Result> results;
+    int N = 0;
+    std::string error;
+    EchoKey echo_key{job.input, job.rir, job.noise, job.seed};
+
+    try {
+
+        auto input = caches.inputs.get(job.input, [&]() {
+            return new Signal{m.inputs[job.input].path};
+        });
+        auto rir = caches.rirs.get(job.rir, [&]() {
+            return new Signal{load_rir_file(m.rirs[job.rir].path)};
+        });
+        auto echo = caches.echoes.get(echo_key, [&]() {
+            return new Signal{benchmarker_t::make_echo(*input, *rir,
+                                                       job.noise, job.seed)};
+        });
+        N = static_cast<int>(input->samples());
+
+        // the DSO's own test, in the constructor, must be serialized too
+        DSO& dso = *m.dsos[job.dso];
+        std::unique_lock<std::mutex> lock(dso.mutex, std::defer_lock);
+        if (!dso.reentrant)
+            lock.lock();
+
+        AdaptiveFilter<float> adapf(dso.path, m.isolated);
+        benchmarker_t bm{adapf, input, echo, *rir};
+        bm.set_harness(Timing::Harness{m.target});
+        bm.set_target_erle(m.target_erle);
+        for (int learn : m.modes) {
+            switch (learn) {
+            case 0:
+                results.push_back(bm.benchmark<0>());
+                break;
+            case 1:
+                results.push_back(bm.benchmark<1>());
+                break;
+            default:
+                results.push_back(bm.benchmark<2>());
+            }
+        }
+
+    } catch (const std::exception& e) {
+        error = e.what();
+    }
+
+    caches.inputs.release(job.input);
+    caches.rirs.release(job.rir);
+    caches.echoes.release(echo_key);
+    table.write(m, job, results, N, error);
+    return error.empty();
+
+}
+
+}
+
+/**
+  * Usage: `atfa-batch [options] <manifest.json>`; run it with `--help` for
+  * the format of the manifest.
+  */
+int main(int argc, char *argv[]) {
+
+    Options opts;
+    try {
+        opts = parse_args(argc, argv);
+    } catch (const UsageError& e) {
+        std::cerr << "[Batch] " << e.what() << std::endl << std::endl;
+        print_usage(argv[0]);
+        return 2;
+    }
+    if (opts.help) {
+        print_usage(argv[0]);
+        return 0;
+    }
+
+    try {
+
+        Manifest m;
+        read_manifest(opts.manifest, m);
+
+        // the DSOs vary fastest, so that each echo is needed by consecutive
+        // jobs, and dropped soon after being made
+        std::vector<Job> jobs;
+        Caches caches;
+        for (size_t in = 0; in != m.inputs.size(); ++in)
+            for (size_t r = 0; r != m.rirs.size(); ++r)
+                for (int noise : m.noises)
+                    for (unsigned seed : m.seeds)
+                        for (size_t d = 0; d != m.dsos.size(); ++d) {
+                            jobs.push_back(Job{d, in, r, noise, seed});
+                            caches.inputs.expect(in);
+                            caches.rirs.expect(r);
+                            caches.echoes.expect(
+                                        EchoKey{in, r, noise, seed});
+                        }
+
+        std::ofstream file;
+        if (!opts.output.empty()) {
+            file.open(opts.output);
+            if (!file)
+                throw FileError(opts.output);
+        }
+        Table table(opts.output.empty() ? std::cout : file, jobs.size());
+
+        unsigned nthreads = opts.jobs ? opts.jobs :
+                            std::max(1u, std::thread::hardware_concurrency());
+        if (nthreads > jobs.size())
+            nthreads = static_cast<unsigned>(jobs.size());
+        std::atomic<size_t> next{0};
+        std::atomic<bool> failed{false};
+        std::vector<std::thread> pool;
+        for (unsigned t = 0; t != nthreads; ++t)
+            pool.emplace_back([&]() {
+                for (size_t j; (j = next++) < jobs.size(); )
+                    if (!run_job(m, jobs[j], caches, table))
+                        failed = true;
+            });
+        for (auto& t : pool)
+            t.join();
+
+        std::cerr << "[Batch] " << jobs.size() << " jobs on " << nthreads
+                  << " threads; decoded " << caches.inputs.computed()
+                  << " inputs and " << caches.rirs.computed()
+                  << " RIRs, and made " << caches.echoes.computed()
+                  << " echoes." << std::endl;
+
+        return failed ? 1 : 0;
+
+    } catch (const std::exception& e) {
+        std::cerr << "[Batch] Error: " << e.what() << std::endl;
+        return 3;
+    }
+
+}
@@ -0,0 +1,466 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file bench.cpp
+ *
+ * Holds the `main` function of `atfa-bench`, which benchmarks an adaptive
+ * filter DSO from the command line, without the GUI.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#include <cmath>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <QtCore>
+
+#include "AdapfBenchmarker.h"
+#include "AdaptiveFilter.h"
+#include "AllocTrace.h"
+#include "EchoQuality.h"
+#include "PerfCounters.h"
+#include "RIR.h"
+#include "Signal.h"
+#include "SignalSource.h"
+#include "utils.h"
+
+namespace {
+
+const char *MODE_NAMES[3] = { "never", "normal", "always" };
+
+constexpr int NOISE_MIN = -180; // dB, the same range as in the scenarios
+constexpr int NOISE_MAX = -20;
+constexpr double DEFAULT_TOLERANCE = 10; // percent
+
+struct Options {
+    std::string dso;
+    std::string input;
+    std::string rir;
+    std::string state;
+    std::string output;
+    std::string baseline;
+    int noise = NOISE_MIN;
+    bool isolated = false;
+    bool counters = false;
+    bool csv = false;
+    double target = Timing::Harness::DEFAULT_TARGET;
+    double tolerance = DEFAULT_TOLERANCE;
+    double target_erle = EchoQuality<float>::DEFAULT_TARGET_ERLE;
+    double max_seconds = -1; // negative means the whole input
+};
+
+class UsageError : public std::runtime_error {
+public:
+    UsageError(const std::string& desc) : runtime_error(desc) {}
+};
+
+void print_usage(const char *argv0) {
+    std::cerr
+        << "Usage: " << argv0 << " [options] <dso> <input.wav>\n"
+        << "\n"
+        << "Benchmarks the adaptive filter DSO with the given input, in the"
+           " three\nlearning modes (never, normally, and always update).\n"
+        << "\n"
+        << "Options:\n"
+        << "  --rir FILE           room impulse response, *.wav or *.m"
+           " (default: none)\n"
+        << "  --noise DB           noise level, from " << NOISE_MIN << " to "
+        << NOISE_MAX << " dB (default: " << NOISE_MIN << ")\n"
+        << "  --state FILE         start from a saved filter state\n"
+        << "  --isolated           run the DSO in a helper process\n"
+        << "  --target SECONDS     wall time spent on each mode (default: "
+        << Timing::Harness::DEFAULT_TARGET << ")\n"
+        << "  --counters           also count hardware events\n"
+        << "  --target-erle DB     ERLE at which the filter has converged"
+           " (default: " << EchoQuality<float>::DEFAULT_TARGET_ERLE << ")\n"
+        << "  --max-seconds S      use only the first S seconds of the"
+           " input; the rest\n                       of the file is never"
+           " read\n"
+        << "  --format json|csv    output format (default: json)\n"
+        << "  --output FILE        write to FILE instead of stdout\n"
+        << "  --compare FILE       compare with a baseline written by "
+        << argv0 << " in JSON\n"
+        << "  --tolerance PERCENT  slowdown allowed by --compare (default: "
+        << DEFAULT_TOLERANCE << ")\n"
+        << "\n"
+        << "Exit status: 0 if all went well, 1 if --compare found a"
+           " regression,\n2 on bad usage, and 3 on any other error.\n";
+}
+
+double to_number(const std::string& opt, const std::string& value) {
+    std::istringstream iss(value);
+    double x;
+    if (!(iss >> x) || !iss.eof())
+        throw UsageError(opt + " expects a number, got `" + value + "'.");
+    return x;
+}
+
+Options parse_args(int argc, char *argv[]) {
+    Options opts;
+    int positional = 0;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 2, "--") != 0) {
+            if (positional == 0)
+                opts.dso = arg;
+            else if (positional == 1)
+                opts.input = arg;
+            else
+                throw UsageError("Too many arguments.");
+            ++positional;
+            continue;
+        }
+        if (arg == "--isolated") {
+            opts.isolated = true;
+            continue;
+        }
+        if (arg == "--counters") {
+            opts.counters = true;
+            continue;
+        }
+        if (i + 1 == argc)
+            throw UsageError(arg + " expects a value.");
+        std::string value = argv[++i];
+        if (arg == "--rir")
+            opts.rir = value;
+        else if (arg == "--noise") {
+            double noise = to_number(arg, value);
+            if (noise < NOISE_MIN || noise > NOISE_MAX)
+                throw UsageError("--noise is out of range.");
+            opts.noise = static_cast<int>(noise);
+        }
+        else if (arg == "--state")
+            opts.state = value;
+        else if (arg == "--target")
+            opts.target = to_number(arg, value);
+        else if (arg == "--format") {
+            if (value != "json" && value != "csv")
+                throw UsageError("--format must be json or csv.");
+            opts.csv = value == "csv";
+        }
+        else if (arg == "--output")
+            opts.output = value;
+        else if (arg == "--compare")
+            opts.baseline = value;
+        else if (arg == "--tolerance")
+            opts.tolerance = to_number(arg, value);
+        else if (arg == "--target-erle")
+            opts.target_erle = to_number(arg, value);
+        else if (arg == "--max-seconds") {
+            opts.max_seconds = to_number(arg, value);
+            if (opts.max_seconds <= 0)
+                throw UsageError("--max-seconds must be positive.");
+        }
+        else
+            throw UsageError("Unknown option " + arg + ".");
+    }
+    if (positional != 2)
+        throw UsageError("The DSO and the input file are required.");
+    return opts;
+}
+
+/// The counter names, as JSON keys and CSV columns
+QString counter_key(PerfCounters::Event e) {
+    return QString(PerfCounters::name(e)).toLower().replace(' ', '_');
+}
+
+/// The quality figures, as JSON keys and CSV columns; NaN if not measured
+const char *QUALITY_KEYS[5] = {
+    "erle_db", "steady_erle_db", "steady_error_db", "misalignment_db",
+    "convergence_s"
+};
+
+std::vector<double> quality_figures(
+        const AdapfBenchmarker<float>::Quality& q) {
+    return { q.erle_db, q.steady_erle_db, q.steady_error_db,
+             q.misalignment_db, q.convergence_time };
+}
+
+/// The allocation counts, as JSON keys and CSV columns
+QString alloc_key(AllocTrace::Kind k) {
+    return QString(AllocTrace::name(k)).toLower();
+}
+
+struct ModeResult {
+    AdapfBenchmarker<float>::Result result;
+    double baseline_median_ns; // negative if there's no baseline
+    bool regression;
+};
+
+QJsonObject mode_json(int learn, const ModeResult& m, int N) {
+    const Timing::Stats& t = m.result.time_per_sample;
+    auto ns = [](Timing::seconds_t s) { return s.count() * 1e9; };
+    QJsonObject obj;
+    obj["learn"] = learn;
+    obj["mode"] = MODE_NAMES[learn];
+    obj["repetitions"] = int(t.repetitions);
+    obj["median_ns"] = ns(t.median);
+    obj["ci_low_ns"] = ns(t.ci_low);
+    obj["ci_high_ns"] = ns(t.ci_high);
+    obj["mad_ns"] = ns(t.mad);
+    obj["p10_ns"] = ns(t.p10);
+    obj["p90_ns"] = ns(t.p90);
+    obj["min_ns"] = ns(t.min);
+    obj["max_ns"] = ns(t.max);
+    obj["mean_ns"] = ns(t.mean);
+    obj["outliers"] = int(t.outliers);
+    if (Timing::have_tsc())
+        obj["tsc_cycles"] = t.cycles;
+    obj["update_fraction"] = N ? double(m.result.updates) / N : 0;
+    const PerfCounters::Counts& c = m.result.counters_per_sample;
+    QJsonObject counters;
+    for (int e = 0; e != PerfCounters::NUM_EVENTS; ++e)
+        if (c.has(PerfCounters::Event(e)))
+            counters[counter_key(PerfCounters::Event(e))] =
+                    c[PerfCounters::Event(e)];
+    if (c.ipc() >= 0)
+        counters["ipc"] = c.ipc();
+    if (!counters.isEmpty())
+        obj["counters"] = counters;
+    if (!m.result.counters_error.empty())
+        obj["counters_error"] = QString::fromStdString(
+                    m.result.counters_error);
+    const auto& q = m.result.quality;
+    QJsonObject quality;
+    auto figures = quality_figures(q);
+    for (size_t k = 0; k != figures.size(); ++k)
+        if (!std::isnan(figures[k]))
+            quality[QUALITY_KEYS[k]] = figures[k];
+    quality["target_erle_db"] = q.target_erle_db;
+    QJsonArray curve;
+    for (const auto& p : q.curve) {
+        QJsonObject point;
+        point["time_s"] = p.time;
+        if (p.active)
+            point["erle_db"] = p.erle_db;
+        if (!std::isnan(p.misalignment_db))
+            point["misalignment_db"] = p.misalignment_db;
+        curve.append(point);
+    }
+    quality["curve"] = curve;
+    obj["quality"] = quality;
+    const AllocTrace::Report& a = m.result.allocations;
+    if (a.available) {
+        QJsonObject allocations;
+        for (int k = 0; k != AllocTrace::NUM_KINDS; ++k)
+            allocations[alloc_key(AllocTrace::Kind(k))] =
+                    double(a.count[k]);
+        allocations["peak_bytes"] = double(a.peak_bytes);
+        allocations["realtime_safe"] = a.realtime_safe();
+        QJsonArray events;
+        for (const auto& e : a.events) {
+            QJsonObject event;
+            event["kind"] = alloc_key(e.kind);
+            event["time_s"] = e.time;
+            event["bytes"] = double(e.bytes);
+            events.append(event);
+        }
+        allocations["events"] = events;
+        obj["allocations"] = allocations;
+    }
+    if (m.baseline_median_ns >= 0) {
+        obj["baseline_median_ns"] = m.baseline_median_ns;
+        obj["regression"] = m.regression;
+    }
+    return obj;
+}
+
+void write_csv(std::ostream& os, const ModeResult modes[3], int N) {
+    os << "learn,mode,samples,repetitions,median_ns,ci_low_ns,ci_high_ns,"
+          "mad_ns,p10_ns,p90_ns,min_ns,max_ns,mean_ns,outliers,tsc_cycles,"
+          "update_fraction";
+    for (int e = 0; e != PerfCounters::NUM_EVENTS; ++e)
+        os << ',' << counter_key(PerfCounters::Event(e)).toStdString();
+    os << ",ipc";
+    for (auto key : QUALITY_KEYS)
+        os << ',' << key;
+    for (int k = 0; k != AllocTrace::NUM_KINDS; ++k)
+        os << ',' << alloc_key(AllocTrace::Kind(k)).toStdString();
+    os << ",peak_bytes,baseline_median_ns,regression\n";
+    for (int learn = 0; learn != 3; ++learn) {
+        const Timing::Stats& t = modes[learn].result.time_per_sample;
+        const PerfCounters::Counts& c = modes[learn].result.counters_per_sample;
+        os << learn << ',' << MODE_NAMES[learn] << ',' << N << ','
+           << t.repetitions;
+        for (auto s : { t.median, t.ci_low, t.ci_high, t.mad, t.p10, t.p90,
+                        t.min, t.max, t.mean })
+            os << ',' << s.count() * 1e9;
+        os << ',' << t.outliers << ',';
+        if (Timing::have_tsc())
+            os << t.cycles;
+        os << ',' << (N ? double(modes[learn].result.updates) / N : 0);
+        // unavailable counters are left empty
+        for (int e = 0; e != PerfCounters::NUM_EVENTS; ++e) {
+            os << ',';
+            if (c.has(PerfCounters::Event(e)))
+                os << c[PerfCounters::Event(e)];
+        }
+        os << ',';
+        if (c.ipc() >= 0)
+            os << c.ipc();
+        // so are the quality figures that couldn't be measured
+        for (double x : quality_figures(modes[learn].result.quality)) {
+            os << ',';
+            if (!std::isnan(x))
+                os << x;
+        }
+        // and the allocations, if they couldn't be traced
+        const AllocTrace::Report& a = modes[learn].result.allocations;
+        for (int k = 0; k != AllocTrace::NUM_KINDS; ++k) {
+            os << ',';
+            if (a.available)
+                os << a.count[k];
+        }
+        os << ',';
+        if (a.available)
+            os << a.peak_bytes;
+        os << ',';
+        if (modes[learn].baseline_median_ns >= 0)
+            os << modes[learn].baseline_median_ns << ','
+               << (modes[learn].regression ? 1 : 0);
+        else
+            os << ',';
+        os << '\n';
+    }
+}
+
+/// Compares with the JSON written by a previous run; returns true if any
+/// mode regressed
+/**
+  * A mode regressed if its median is more than `tolerance` percent above
+  * the baseline median, and the confidence intervals of the two medians
+  * don't overlap (so that noise alone doesn't fail a release).
+  */
+bool compare(const std::string& filename, double tolerance,
+             ModeResult modes[3]) {
+    QJsonObject baseline = read_json_file(QString::fromStdString(filename));
+    QJsonArray base_modes = baseline.value("modes").toArray();
+    bool any = false;
+    for (int learn = 0; learn != 3; ++learn) {
+        ModeResult& m = modes[learn];
+        m.baseline_median_ns = -1;
+        m.regression = false;
+        for (const auto& v : base_modes) {
+            QJsonObject b = v.toObject();
+            if (b.value("learn").toInt(-1) != learn)
+                continue;
+            const Timing::Stats& t = m.result.time_per_sample;
+            double median = t.median.count() * 1e9;
+            double ci_low = t.ci_low.count() * 1e9;
+            m.baseline_median_ns = b.value("median_ns").toDouble();
+            m.regression =
+                    median > m.baseline_median_ns * (1 + tolerance/100) &&
+                    ci_low > b.value("ci_high_ns").toDouble();
+            if (m.regression)
+                std::cerr << "[Bench] Regression in mode \""
+                          << MODE_NAMES[learn] << "\": " << median
+                          << " ns per call, against " << m.baseline_median_ns
+                          << " ns in the baseline." << std::endl;
+            any = any || m.regression;
+        }
+        if (m.baseline_median_ns < 0)
+            std::cerr << "[Bench] Warning: the baseline has no mode \""
+                      << MODE_NAMES[learn] << "\"." << std::endl;
+    }
+    return any;
+}
+
+}
+
+/**
+  * Usage: `atfa-bench [options] <dso> <input.wav>`; run it without arguments
+  * for the list of options.
+  */
+int main(int argc, char *argv[]) {
+
+    Options opts;
+    try {
+        opts = parse_args(argc, argv);
+    } catch (const UsageError& e) {
+        std::cerr << "[Bench] " << e.what() << std::endl << std::endl;
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    try {
+
+        AdaptiveFilter<float> adapf(opts.dso, opts.isolated);
+        SndFileSource source{opts.input};
+        Signal input{source, opts.max_seconds < 0 ?
+                        std::numeric_limits<Signal::index_t>::max() :
+                        static_cast<Signal::index_t>(
+                            opts.max_seconds * source.samplerate())};
+        int N = static_cast<int>(input.samples());
+
+        Signal rir = load_rir_file(opts.rir);
+        Signal echo = AdapfBenchmarker<float>::make_echo(input, rir,
+                                                         opts.noise);
+        AdapfBenchmarker<float> bm{adapf, std::move(input), std::move(echo),
+                                   rir};
+        bm.set_harness(Timing::Harness{opts.target});
+        bm.set_counters(opts.counters);
+        bm.set_target_erle(opts.target_erle);
+        if (!opts.state.empty())
+            bm.set_initial_state(adapf.read_state_file(opts.state));
+
+        ModeResult modes[3];
+        modes[0].result = bm.benchmark<0>();
+        modes[1].result = bm.benchmark<1>();
+        modes[2].result = bm.benchmark<2>();
+        for (auto& m : modes) {
+            m.baseline_median_ns = -1;
+            m.regression = false;
+        }
+
+        bool regression = !opts.baseline.empty() &&
+                          compare(opts.baseline, opts.tolerance, modes);
+
+        std::ofstream file;
+        if (!opts.output.empty()) {
+            file.open(opts.output);
+            if (!file)
+                throw FileError(opts.output);
+        }
+        std::ostream& os = opts.output.empty() ? std::cout : file;
+
+        if (opts.csv)
+            write_csv(os, modes, N);
+        else {
+            QJsonObject obj;
+            obj["dso"] = QString::fromStdString(opts.dso);
+            obj["title"] = adapf.get_title();
+            obj["input"] = QString::fromStdString(opts.input);
+            obj["samples"] = N;
+            obj["rir"] = QString::fromStdString(opts.rir);
+            obj["noise_db"] = opts.noise;
+            obj["isolated"] = opts.isolated;
+            QJsonArray arr;
+            for (int learn = 0; learn != 3; ++learn)
+                arr.append(mode_json(learn, modes[learn], N));
+            obj["modes"] = arr;
+            os << QJsonDocument(obj).toJson().constData();
+        }
+
+        return regression ? 1 : 0;
+
+    } catch (const std::exception& e) {
+        std::cerr << "[Bench] Error: " << e.what() << std::endl;
+        return 3;
+    }
+
+}
@@ -0,0 +1,180 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file calibrate.cpp
+ *
+ * Holds the `main` function of `atfa-calibrate`, which measures the
+ * round-trip latency of the sound card (or of a simulated loopback, to check
+ * the measurement itself) from the command line.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#include <cmath>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "AudioDevice.h"
+#include "LatencyCalibrator.h"
+#include "Stream.h"
+
+namespace {
+
+/// The device runs at four times the stream rate (see `Stream::process()`)
+constexpr int DEVICE_RATE = 4 * Stream::samplerate;
+
+struct Options {
+    LatencyCalibrator::Probe probe = LatencyCalibrator::MLS;
+    double level = LatencyCalibrator::DEFAULT_LEVEL;
+    double loopback = -1; // ms; negative means the sound card
+    double noise = -200;  // dBFS, in the loopback
+    bool help = false;
+};
+
+class UsageError : public std::runtime_error {
+public:
+    UsageError(const std::string& desc) : runtime_error(desc) {}
+};
+
+void print_usage(const char *argv0) {
+    std::cerr
+        << "Usage: " << argv0 << " [options]\n"
+        << "\n"
+        << "Measures the round-trip latency of the default sound card, by"
+           " playing a\nprobe signal and finding it in what the microphone"
+           " (or a loopback cable)\nrecords. This is the system latency of"
+           " the ATFA scenarios.\n"
+        << "\n"
+        << "Options:\n"
+        << "  --probe mls|chirp  probe signal (default: mls)\n"
+        << "  --level L          peak amplitude of the probe (default: "
+        << LatencyCalibrator::DEFAULT_LEVEL << ")\n"
+        << "  --loopback MS      instead of the sound card, use a simulated"
+           " loopback\n                     with a latency of MS"
+           " milliseconds, and check the result\n"
+        << "  --noise DB         noise in the simulated loopback (default:"
+           " none)\n"
+        << "\n"
+        << "Exit status: 0 if all went well, 1 if the latency measured on"
+           " the\nsimulated loopback is wrong, 2 on bad usage, and 3 on any"
+           " other error.\n";
+}
+
+double to_number(const std::string& opt, const std::string& value) {
+    std::istringstream iss(value);
+    double x;
+    if (!(iss >> x) || !iss.eof())
+        throw UsageError(opt + " expects a number, got `" + value + "'.");
+    return x;
+}
+
+Options parse_args(int argc, char *argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help") {
+            opts.help = true;
+            continue;
+        }
+        if (arg.compare(0, 2, "--") != 0)
+            throw UsageError("Unexpected argument `" + arg + "'.");
+        if (i + 1 == argc)
+            throw UsageError(arg + " expects a value.");
+        std::string value = argv[++i];
+        if (arg == "--probe") {
+            if (value != "mls" && value != "chirp")
+                throw UsageError("--probe must be mls or chirp.");
+            opts.probe = value == "mls" ? LatencyCalibrator::MLS
+                                        : LatencyCalibrator::Chirp;
+        }
+        else if (arg == "--level") {
+            opts.level = to_number(arg, value);
+            if (opts.level <= 0 || opts.level > 1)
+                throw UsageError("--level must be in ]0, 1].");
+        }
+        else if (arg == "--loopback") {
+            opts.loopback = to_number(arg, value);
+            if (opts.loopback < 0 ||
+                    opts.loopback > 1000 * LatencyCalibrator::max_latency())
+                throw UsageError("--loopback is out of range.");
+        }
+        else if (arg == "--noise")
+            opts.noise = to_number(arg, value);
+        else
+            throw UsageError("Unknown option " + arg + ".");
+    }
+    return opts;
+}
+
+}
+
+/**
+  * Usage: `atfa-calibrate [options]`; run it with `--help` for the list of
+  * options.
+  */
+int main(int argc, char *argv[]) {
+
+    Options opts;
+    try {
+        opts = parse_args(argc, argv);
+    } catch (const UsageError& e) {
+        std::cerr << "[Calibrate] " << e.what() << std::endl << std::endl;
+        print_usage(argv[0]);
+        return 2;
+    }
+    if (opts.help) {
+        print_usage(argv[0]);
+        return 0;
+    }
+
+    try {
+
+        std::unique_ptr<AudioDevice> dev;
+        if (opts.loopback >= 0)
+            dev.reset(new LoopbackDevice(
+                          DEVICE_RATE,
+                          static_cast<unsigned long>(std::lround(
+                              opts.loopback * DEVICE_RATE / 1000)),
+                          1, opts.noise));
+        else
+            dev.reset(new PortAudioDevice(DEVICE_RATE));
+
+        LatencyCalibrator cal{opts.probe, opts.level};
+        LatencyCalibrator::Result r = cal.measure(*dev);
+
+        std::cout << "Latency: " << 1000 * r.latency << " ms ("
+                  << r.lag << " samples at " << Stream::samplerate
+                  << " Hz); correlation peak " << r.peak_db << " dB above"
+                  << " its RMS." << std::endl;
+
+        if (opts.loopback >= 0) {
+            // the loopback delay is a whole number of device samples
+            double expected = double(static_cast<LoopbackDevice&>(*dev).delay())
+                              / DEVICE_RATE;
+            double error = r.latency - expected;
+            std::cout << "Expected: " << 1000 * expected << " ms; error: "
+                      << 1000 * error << " ms." << std::endl;
+            // one sample at the stream's rate
+            if (std::abs(error) * Stream::samplerate > 1)
+                return 1;
+        }
+
+        return 0;
+
+    } catch (const std::exception& e) {
+        std::cerr << "[Calibrate] Error: " << e.what() << std::endl;
+        return 3;
+    }
+
+}
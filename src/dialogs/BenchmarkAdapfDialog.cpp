@@ -7,8 +7,12 @@
  * Orientador: Markus Lima
  */
 
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <utility>
+
 #include "BenchmarkAdapfDialog.h"
-#include "../AdapfBenchmarker.h"
 
 /* TODO: devemos mostrar como "taxa máxima" a taxa atingida quando o período
  *       é o *dobro* da duração da DSO. Fala que "assuming 50% of CPU
@@ -39,11 +43,20 @@ BenchmarkAdapfDialog::BenchmarkAdapfDialog(ATFA *parent)
         run_button = new QPushButton("Run", this);
         run_button->setMaximumWidth(100);
         connect(run_button, &QPushButton::clicked,
-                this, &BenchmarkAdapfDialog::run_and_show);
+                this, &BenchmarkAdapfDialog::run_clicked);
         run_layout->addWidget(run_button);
 
     layout->addLayout(run_layout);
 
+    progress_label = new QLabel(this);
+    progress_label->hide();
+    layout->addWidget(progress_label);
+
+    progress_bar = new QProgressBar(this);
+    progress_bar->setRange(0, 1000);
+    progress_bar->hide();
+    layout->addWidget(progress_bar);
+
     result_label = new QLabel(this);
     result_label->setWordWrap(true);
     result_label->hide();
@@ -55,45 +68,263 @@ BenchmarkAdapfDialog::BenchmarkAdapfDialog(ATFA *parent)
     layout->addWidget(button_box);
 
     setLayout(layout);
-    setWindowTitle("Benchmark adaptive filter DSO");
+    setWindowTitle("Benchmark adaptive filter and VAD");
 
     setMinimumWidth(600);
 
+    poll_timer = new QTimer(this);
+    connect(poll_timer, SIGNAL(timeout()), this, SLOT(poll_worker()));
+
 }
 
-void BenchmarkAdapfDialog::run_and_show() {
+BenchmarkAdapfDialog::~BenchmarkAdapfDialog() {
+    cancel_benchmark();
+}
 
-    result_label->setDisabled(true);
-    run_button->setDisabled(true);
-    file_select->setDisabled(true);
+void BenchmarkAdapfDialog::reject() {
+    cancel_benchmark();
+    QDialog::reject();
+}
 
-    button_box->buttons()[0]->clearFocus();
+void BenchmarkAdapfDialog::run_clicked() {
+    if (worker.joinable()) {
+        // poll_worker() will join it, once it notices the cancellation
+        for (auto& p : job->progress)
+            p.cancel();
+        run_button->setDisabled(true);
+        return;
+    }
+    start_benchmark();
+}
+
+void BenchmarkAdapfDialog::start_benchmark() {
 
-    repaint();
+    button_box->buttons()[0]->clearFocus();
 
     Signal input_signal{file_select->text().toUtf8().constData()};
-    int N = input_signal.samples();
-
-    // TODO: o benchmark deveria ser feito num thread separado, pra manter a
-    //       interface responsiva
-    //       Idéia: criar uma função AdapfBenchmarker::estimate_time que rode
-    //       o adapf poucas vezes (quantas? vai rodando e vendo quantas vezes
-    //       vale a pena rodar, à la python's timeit) e retorne uma estimação
-    //       do tempo total que vai levar o benchmark de verdade; usar o
-    //       resultado dessa estimação pra decidir se vale a pena botar o
-    //       bagulho num thread separado.
-    AdapfBenchmarker<Stream::sample_t> bm{
+
+    job.reset(new Job);
+    job->N = input_signal.samples();
+    job->bm.reset(new benchmarker_t{
         *atfa->stream.adapf, input_signal, Signal{atfa->stream.scene.imp_resp},
-        atfa->stream.scene.noise_vol};
-    auto pair = bm.benchmark<0>();
-    double duration_us_0 = pair.first.count() * 1e6;
-    int nup_0 = pair.second;
-    pair = bm.benchmark<1>();
-    double duration_us_1 = pair.first.count() * 1e6;
-    int nup_1 = pair.second;
-    pair = bm.benchmark<2>();
-    double duration_us_2 = pair.first.count() * 1e6;
-    int nup_2 = pair.second;
+        atfa->stream.scene.noise_vol});
+    // benchmark the converged filter, if the scenario has one
+    const QString& state_file = atfa->stream.scene.adapf_state_file;
+    if (!state_file.isEmpty() && atfa->stream.adapf->has_state_io()) {
+        try {
+            job->bm->set_initial_state(atfa->stream.adapf->read_state_file(
+                                           state_file.toUtf8().constData()));
+        } catch (const AdapfException& e) {
+            std::cerr << "[Benchmark] Warning: the adaptive filter will start"
+                      << " from scratch." << std::endl
+                      << "[Benchmark] " << e.what() << std::endl;
+        }
+    }
+    job->bm->set_counters(true);
+    job->vad_input.reset(new Signal{std::move(input_signal)});
+    job->vad_input->set_samplerate(Stream::samplerate);
+    job->concurrent = atfa->stream.adapf->is_reentrant();
+
+    set_running(true);
+    start_time = std::chrono::steady_clock::now();
+    worker = std::thread(&BenchmarkAdapfDialog::run_job, this);
+    poll_worker();
+    poll_timer->start(100);
+
+}
+
+void BenchmarkAdapfDialog::cancel_benchmark() {
+    if (!worker.joinable())
+        return;
+    for (auto& p : job->progress)
+        p.cancel();
+    worker.join();
+    poll_timer->stop();
+    job.reset();
+    set_running(false);
+}
+
+/**
+  * Runs in `worker`. The main window's stream is idle while this dialog is
+  * open, so its adaptive filter and VAD can be used here.
+  */
+void BenchmarkAdapfDialog::run_job() {
+
+    Job& j = *job;
+    Stream& stream = atfa->stream;
+
+    auto run_mode = [&j](int learn, adapf_t& af) {
+        try {
+            switch (learn) {
+            case 0:
+                j.results[0] = j.bm->benchmark<0>(af, &j.progress[0]);
+                break;
+            case 1:
+                j.results[1] = j.bm->benchmark<1>(af, &j.progress[1]);
+                break;
+            default:
+                j.results[2] = j.bm->benchmark<2>(af, &j.progress[2]);
+            }
+        } catch (...) {
+            for (auto& p : j.progress) // no point in going on
+                p.cancel();
+            throw;
+        }
+    };
+
+    try {
+
+        // the estimates run the filter too, and a slow one (or a slow
+        // initialization) would freeze the GUI if they were made there
+        double estimates[3] = {
+            j.bm->estimate_time<0>(*stream.adapf),
+            j.bm->estimate_time<1>(*stream.adapf),
+            j.bm->estimate_time<2>(*stream.adapf)
+        };
+        j.estimated_time.store(j.concurrent ?
+                    *std::max_element(estimates, estimates + 3) :
+                    estimates[0] + estimates[1] + estimates[2],
+                    std::memory_order_relaxed);
+
+        if (j.concurrent) {
+            std::unique_ptr<adapf_t> filters[3];
+            for (auto& f : filters)
+                f.reset(new adapf_t(stream.adapf->get_path(),
+                                    stream.adapf->is_isolated()));
+            std::exception_ptr errors[3];
+            std::thread threads[3];
+            for (int m = 0; m != 3; ++m)
+                threads[m] = std::thread([&, m]() {
+                    try {
+                        run_mode(m, *filters[m]);
+                    } catch (...) {
+                        errors[m] = std::current_exception();
+                    }
+                });
+            for (auto& t : threads)
+                t.join();
+            // report the error that caused the cancellations, if there is one
+            std::exception_ptr cancelled;
+            for (auto& e : errors) {
+                if (!e)
+                    continue;
+                try {
+                    std::rethrow_exception(e);
+                } catch (const Timing::Cancelled&) {
+                    cancelled = e;
+                }
+            }
+            if (cancelled)
+                std::rethrow_exception(cancelled);
+        }
+        else {
+            for (int m = 0; m != 3; ++m)
+                run_mode(m, *stream.adapf);
+        }
+
+        // the VAD that is selected in the main window
+        VADBenchmarker vad_bm{*j.vad_input, stream.scene.noise_vol,
+                              Stream::blk_size, Stream::fft_size};
+        try {
+            stream.start_vad();
+            j.vad_result = vad_bm.benchmark(
+                [&stream](Stream::container_t::const_iterator first,
+                          const Stream::container_t& re,
+                          const Stream::container_t& im) {
+                    return stream.detect_voice(first, re, im);
+                }, &j.progress[0]);
+            stream.stop_vad();
+        } catch (const VADPluginException& e) {
+            stream.stop_vad();
+            std::cerr << "[Benchmark] Warning: " << e.what() << std::endl;
+            j.vad_result = VADBenchmarker::Result{};
+        } catch (...) {
+            stream.stop_vad();
+            throw;
+        }
+
+    } catch (...) {
+        j.error = std::current_exception();
+    }
+
+    j.done.store(true, std::memory_order_release);
+
+}
+
+void BenchmarkAdapfDialog::poll_worker() {
+
+    if (!job)
+        return;
+
+    if (!job->done.load(std::memory_order_acquire)) {
+        double estimated_time =
+                job->estimated_time.load(std::memory_order_relaxed);
+        if (estimated_time == 0) {
+            progress_label->setText("Estimating the running time...");
+            return;
+        }
+        std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - start_time;
+        float fraction = 0;
+        for (const auto& p : job->progress)
+            fraction += p.fraction() / 3;
+        // the harness only reports between passes, so also trust the clock
+        double f = std::max(double(fraction),
+                            elapsed.count() / std::max(estimated_time, 1e-3));
+        progress_bar->setValue(static_cast<int>(std::min(f, .999) * 1000));
+        double left = estimated_time - elapsed.count();
+        progress_label->setText(
+                    QString("Running the benchmark (estimated time: ") +
+                    QString::number(estimated_time, 'f', 1) + " s; " +
+                    (left > 0 ? "about " + QString::number(left, 'f', 0) +
+                                " s left)"
+                              : QString("finishing)")));
+        return;
+    }
+
+    poll_timer->stop();
+    worker.join();
+    set_running(false);
+
+    try {
+        if (job->error)
+            std::rethrow_exception(job->error);
+        progress_label->setText("Benchmark finished.");
+        show_results();
+    } catch (const Timing::Cancelled&) {
+        progress_label->setText("Benchmark cancelled.");
+    } catch (const std::exception& e) {
+        progress_label->setText("Benchmark failed.");
+        std::cerr << "[Benchmark] Error: " << e.what() << std::endl;
+        QMessageBox msg_box(this);
+        msg_box.setText(QString("The benchmark failed: ") + e.what());
+        msg_box.setWindowTitle("ATFA [error]");
+        msg_box.setIcon(QMessageBox::Warning);
+        msg_box.exec();
+    }
+    job.reset();
+
+    run_button->setFocus();
+    adjustSize();
+
+}
+
+void BenchmarkAdapfDialog::set_running(bool running) {
+    run_button->setText(running ? "Cancel" : "Run");
+    run_button->setDisabled(false);
+    file_select->setDisabled(running);
+    result_label->setDisabled(running);
+    progress_label->show();
+    progress_bar->setVisible(running);
+    progress_bar->setValue(0);
+}
+
+void BenchmarkAdapfDialog::show_results() {
+
+    const Job& j = *job;
+    int N = j.N;
+    double vad_us = j.vad_result.time_per_block.count() * 1e6;
+    double block_us = 1e6 * Stream::blk_size / Stream::samplerate;
 
     QString dso_filename = atfa->stream.adapf->get_path().c_str();
     if (dso_filename == "")
@@ -103,70 +334,141 @@ void BenchmarkAdapfDialog::run_and_show() {
     if (dso_title == "")
         dso_title = "(None)";
 
+    const QString us = " " + QString(QChar(0x03BC)) + "s";
+    auto timing_items =
+            [N, &us](const AdapfBenchmarker<Stream::sample_t>::Result& r) {
+        const Timing::Stats& t = r.time_per_sample;
+        double median_us = t.median.count() * 1e6;
+        QString cycles;
+        if (Timing::have_tsc())
+            cycles = " (<b>" + QString::number(t.cycles, 'f', 1) +
+                     "</b> TSC cycles)";
+        const PerfCounters::Counts& c = r.counters_per_sample;
+        QString counters;
+        for (int e = 0; e != PerfCounters::NUM_EVENTS; ++e) {
+            auto ev = PerfCounters::Event(e);
+            if (!c.has(ev))
+                continue;
+            counters += (counters.isEmpty() ? "" : ", ") + QString("<b>") +
+                        QString::number(c[ev], 'f', 2) + "</b> " +
+                        PerfCounters::name(ev);
+            if (ev == PerfCounters::Instructions && c.ipc() >= 0)
+                counters += " (IPC <b>" + QString::number(c.ipc(), 'f', 2) +
+                            "</b>)";
+        }
+        if (counters.isEmpty())
+            counters = "unavailable (" +
+                       QString::fromStdString(r.counters_error) + ")";
+        else
+            counters = "per call: " + counters;
+        // NaN means that the figure couldn't be measured
+        auto figure = [](double x, const char *unit) {
+            return std::isnan(x) ? QString("n/a") :
+                                   QString::number(x, 'f', 1) + unit;
+        };
+        const AllocTrace::Report& a = r.allocations;
+        QString allocations;
+        if (!a.available)
+            allocations = "not traced";
+        else if (a.realtime_safe())
+            allocations = "<b>safe</b>: no allocations, frees nor locks in " +
+                          qt_html_tt("adapf_run");
+        else
+            allocations = "<b>NOT safe</b>: " + qt_html_tt("adapf_run") +
+                          " made <b>" +
+                          QString::number(a.count[AllocTrace::Alloc]) +
+                          "</b> allocations, <b>" +
+                          QString::number(a.count[AllocTrace::Free]) +
+                          "</b> frees and <b>" +
+                          QString::number(a.count[AllocTrace::Lock]) +
+                          "</b> locks per pass";
+        if (a.available)
+            allocations += "; filter heap peaked at <b>" +
+                           QString::number(a.peak_bytes / 1024.0, 'f', 1) +
+                           " KiB</b>";
+        const auto& q = r.quality;
+        QString convergence = std::isnan(q.convergence_time) ?
+                    QString("did not reach") :
+                    "reached <b>" + figure(q.convergence_time, " s") +
+                    "</b> into the input, and stayed above,";
+        return QString{} +
+            "<li>" + qt_html_tt("adapf_run") + " function called <b>" +
+                QString::number(N) + "</b> times per pass, over <b>" +
+                QString::number(t.repetitions) + "</b> passes, with median\
+                call duration of <b>" +
+                QString::number(median_us, 'f', 3) + us + "</b>" + cycles +
+                "</li>\
+            <li>95% confidence interval of the median: <b>" +
+                QString::number(t.ci_low.count() * 1e6, 'f', 3) + "</b> to\
+                <b>" + QString::number(t.ci_high.count() * 1e6, 'f', 3) +
+                us + "</b>; median absolute deviation: <b>" +
+                QString::number(t.mad.count() * 1e6, 'f', 3) + us +
+                "</b>; 10th to 90th percentile: <b>" +
+                QString::number(t.p10.count() * 1e6, 'f', 3) + "</b> to\
+                <b>" + QString::number(t.p90.count() * 1e6, 'f', 3) + us +
+                "</b>; <b>" + QString::number(t.outliers) + "</b> outlier\
+                passes</li>\
+            <li>Hardware counters: " + counters + "</li>\
+            <li>Echo cancellation: ERLE of <b>" +
+                figure(q.erle_db, " dB") + "</b> (<b>" +
+                figure(q.steady_erle_db, " dB") + "</b> in the steady\
+                state, with the error at <b>" +
+                figure(q.steady_error_db, " dBFS") + "</b>); final\
+                misalignment of <b>" + figure(q.misalignment_db, " dB") +
+                "</b>; the ERLE " + convergence + " the target of <b>" +
+                figure(q.target_erle_db, " dB") + "</b></li>\
+            <li>Real-time safety: " + allocations + "</li>\
+            <li>Disregarding any overhead, this algorithm could\
+                run at <b>" + QString::number(1e3/median_us, 'f', 3) +
+                " kHz</b></li>\
+            <li>The " + qt_html_tt("adapf_run") + " function\
+                performed an update <b>" + QString::number(
+                static_cast<double>(r.updates)/N*100, 'f', 1) +
+                "%</b> of the time<br /></li>";
+    };
+
     result_label->setText(QString{} +
                 "<br /><ul>\
                     <li>DSO: <b>" + qt_html_tt(dso_filename) +"</b></li>\
-                    <li>Algorithm: <b>" + dso_title + "</b><br /></li>\
+                    <li>Algorithm: <b>" + dso_title + "</b></li>\
+                    <li>The three learning modes were benchmarked <b>" +
+                        (j.concurrent ? "concurrently" : "one after the other")
+                        + "</b><br /></li>\
                     <li>When the DSO is asked to <b>never update</b> the\
                         coefficient vector:<br />\
-                        <ul>\
-                            <li>" + qt_html_tt("adapf_run") + " function called\
-                                <b>" + QString::number(N) + "</b> times, with\
-                                mean call duration of <b>" +
-                                QString::number(duration_us_0, 'f', 3) +
-                                " " + QString(QChar(0x03BC)) + "s</b></li>\
-                            <li>Disregarding any overhead, this algorithm could\
-                                run at <b>" +
-                                QString::number(1e3/duration_us_0, 'f', 3) +
-                                " kHz</b><br /></li>\
-                            <li>The " + qt_html_tt("adapf_run") + " function\
-                                performed an update <b>" + QString::number(
-                                static_cast<double>(nup_0)/N*100, 'f', 1) +
-                                "%</b> of the time<br /></li>\
-                        </ul></li>\
+                        <ul>" + timing_items(j.results[0]) + "</ul></li>\
                     <li>When the DSO is asked to <b>update normally</b> the\
                         coefficient vector:<br />\
-                        <ul>\
-                            <li>" + qt_html_tt("adapf_run") + " function called\
-                                <b>" + QString::number(N) + "</b> times, with\
-                                mean call duration of <b>" +
-                                QString::number(duration_us_1, 'f', 3) +
-                                " " + QString(QChar(0x03BC)) + "s</b></li>\
-                            <li>Disregarding any overhead, this algorithm could\
-                                run at <b>" +
-                                QString::number(1e3/duration_us_1, 'f', 3) +
-                                " kHz</b><br /></li>\
-                            <li>The " + qt_html_tt("adapf_run") + " function\
-                                performed an update <b>" + QString::number(
-                                static_cast<double>(nup_1)/N*100, 'f', 1) +
-                                "%</b> of the time<br /></li>\
-                        </ul></li>\
+                        <ul>" + timing_items(j.results[1]) + "</ul></li>\
                     <li>When the DSO is asked to <b>always update</b> the\
                         coefficient vector:\
+                        <ul>" + timing_items(j.results[2]) + "</ul></li>\
+                    <li>VAD: <b>" +
+                        atfa->vad_algorithm_combo->currentText() + "</b>\
                         <ul>\
-                            <li>" + qt_html_tt("adapf_run") + " function called\
-                                <b>" + QString::number(N) + "</b> times, with\
-                                mean call duration of <b>" +
-                                QString::number(duration_us_2, 'f', 3) +
-                                " " + QString(QChar(0x03BC)) + "s</b></li>\
-                            <li>Disregarding any overhead, this algorithm could\
-                                run at <b>" +
-                                QString::number(1e3/duration_us_2, 'f', 3) +
-                                " kHz</b></li>\
-                            <li>The " + qt_html_tt("adapf_run") + " function\
-                                performed an update <b>" + QString::number(
-                                static_cast<double>(nup_2)/N*100, 'f', 1) +
-                                "%</b> of the time<br /></li>\
+                            <li>Called on <b>" +
+                                QString::number(j.vad_result.blocks) + "</b>\
+                                blocks of <b>" +
+                                QString::number(Stream::blk_size) + "</b>\
+                                samples, with mean call duration of <b>" +
+                                QString::number(vad_us, 'f', 3) + " " +
+                                QString(QChar(0x03BC)) + "s</b> (<b>" +
+                                QString::number(vad_us/block_us*100, 'f', 3) +
+                                "%</b> of the block duration)</li>\
+                            <li>Detected <b>" + QString::number(
+                                j.vad_result.hit_rate*100, 'f', 1) +
+                                "%</b> of the <b>" +
+                                QString::number(j.vad_result.voice_blocks) +
+                                "</b> blocks that have voice, and wrongly\
+                                detected voice in <b>" + QString::number(
+                                j.vad_result.false_alarm_rate*100, 'f', 1) +
+                                "%</b> of the others (blocks less than " +
+                                QString::number(-VADBenchmarker::REFERENCE_DB)
+                                + " dB below the loudest one count as voice,\
+                                and noise is added at the level of the\
+                                scenario)</li>\
                         </ul></li>\
                 </ul>");
     result_label->show();
 
-    result_label->setDisabled(false);
-    run_button->setDisabled(false);
-    file_select->setDisabled(false);
-
-    run_button->setFocus();
-
-    adjustSize();
-
 }
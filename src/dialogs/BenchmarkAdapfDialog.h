@@ -10,10 +10,25 @@
 #ifndef BENCHMARKADAPFDIALOG_H
 #define BENCHMARKADAPFDIALOG_H
 
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <thread>
+
 #include <QtGui>
 
 #include "../ATFA.h"
+#include "../AdapfBenchmarker.h"
+#include "../VADBenchmarker.h"
 
+/// Benchmarks the adaptive filter and the VAD of the main window
+/**
+  * The benchmarks run in a worker thread, while a timer polls it for
+  * progress, so the dialog stays responsive and can cancel them. If the DSO
+  * is reentrant, the three learning modes run at the same time, each on its
+  * own `AdaptiveFilter` (and thus its own `AdapfData`).
+  */
 class BenchmarkAdapfDialog : public QDialog
 {
     Q_OBJECT
@@ -23,6 +38,10 @@ public:
     constexpr static int MCLOOP_DEFAULT = MCLOOP_MAXIMUM/100;
 
     explicit BenchmarkAdapfDialog(ATFA *);
+    ~BenchmarkAdapfDialog();
+
+    /// Cancels a running benchmark before closing
+    void reject() Q_DECL_OVERRIDE;
 
 private:
     ATFA *atfa;
@@ -30,12 +49,46 @@ private:
     QLabel *choosefile_label;
     FileSelectWidget *file_select;
     QPushButton *run_button;
+    QLabel *progress_label;
+    QProgressBar *progress_bar;
     QLabel *result_label;
 
     QDialogButtonBox *button_box;
 
+    QTimer *poll_timer;
+
+    typedef AdapfBenchmarker<Stream::sample_t> benchmarker_t;
+    typedef AdaptiveFilter<Stream::sample_t> adapf_t;
+
+    /// Everything the worker thread touches, except `atfa->stream`
+    struct Job {
+        std::unique_ptr<benchmarker_t> bm;
+        std::unique_ptr<Signal> vad_input;
+        int N;
+        bool concurrent; // the three learning modes at the same time
+        Timing::Progress progress[3]; // one per learning mode
+        benchmarker_t::Result results[3];
+        VADBenchmarker::Result vad_result;
+        std::exception_ptr error;
+        std::atomic<double> estimated_time; // seconds; zero until estimated
+        std::atomic<bool> done;
+        Job() : N(0), concurrent(false), vad_result{}, estimated_time(0),
+                done(false) {}
+    };
+    std::unique_ptr<Job> job;
+    std::thread worker;
+
+    std::chrono::steady_clock::time_point start_time;
+
+    void start_benchmark();
+    void cancel_benchmark();
+    void run_job(); // the body of `worker`
+    void show_results();
+    void set_running(bool running);
+
 private slots:
-    void run_and_show();
+    void run_clicked();
+    void poll_worker();
 
 };
 
@@ -43,6 +43,12 @@ ChangeAlgorithmDialog::ChangeAlgorithmDialog(ATFA *parent) :
 
     layout->addLayout(file_choose_layout);
 
+    isolated_check = new QCheckBox(
+                "Run the DSO in a separate process (a crash in the DSO"
+                " will not bring ATFA down)", this);
+    isolated_check->setChecked(atfa->stream.scene.adapf_isolated);
+    layout->addWidget(isolated_check);
+
     button_box = new QDialogButtonBox(
         QDialogButtonBox::Ok |
         QDialogButtonBox::Cancel |
@@ -87,6 +93,8 @@ bool ChangeAlgorithmDialog::run() {
 
         atfa->stream.setAdapfAlgorithm(new AdaptiveFilter<Stream::sample_t>());
         atfa->stream.scene.adapf_file = "";
+        atfa->stream.scene.adapf_isolated = false;
+        atfa->stream.scene.adapf_state_file = "";
 
     }
     else {
@@ -98,11 +106,15 @@ bool ChangeAlgorithmDialog::run() {
             return false;
         }
 
+        bool isolated = isolated_check->isChecked();
         atfa->stream.setAdapfAlgorithm(
-            new AdaptiveFilter<Stream::sample_t>(filename.toUtf8().constData())
+            new AdaptiveFilter<Stream::sample_t>(filename.toUtf8().constData(),
+                                                 isolated)
         );
 
         atfa->stream.scene.adapf_file = filename.toUtf8().constData();
+        atfa->stream.scene.adapf_isolated = isolated;
+        atfa->stream.scene.adapf_state_file = "";
 
     }
 
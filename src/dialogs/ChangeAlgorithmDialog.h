@@ -36,6 +36,8 @@ private:
     QLabel *file_label;
     FileSelectWidget *file_select;
 
+    QCheckBox *isolated_check;
+
     QDialogButtonBox *button_box;
 
     void err_dialog(const QString &err_msg);
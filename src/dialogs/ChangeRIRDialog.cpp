@@ -8,7 +8,6 @@
  */
 
 #include <vector>
-#include <sstream>
 #include <algorithm>
 
 #include <QDir>
@@ -128,17 +127,6 @@ void ChangeRIRDialog::err_dialog(const QString& err_msg, QWidget *p) {
     msg_box.exec();
 }
 
-Stream::container_t ChangeRIRDialog::parse_txt(const QString& txt) {
-    FloatStream fs = new std::istringstream(txt.toUtf8().constData());
-    Stream::container_t h;
-    while (fs.err_flag == 0)
-        h.push_back(fs.get());
-    if (fs.err_flag == 1)
-        throw RIRParseException("Non-conforming input data.");
-    h.pop_back(); // remove trailing zero
-    return h;
-}
-
 bool ChangeRIRDialog::run() {
     if (exec() == QDialog::Rejected)
         return false;
@@ -178,71 +166,6 @@ void ChangeRIRDialog::set_rir_source(int n) {
     adjustSize();
 }
 
-double FloatStream::get(bool neg) {
-    char ch = 0;
-    do { // skip whitespace
-        if (!ip->get(ch)) {
-            err_flag = -1;
-            pos = end;
-            return 0;
-        }
-    } while (isspace(ch));
-    if (pos == end) {
-        err_flag = -1;
-        return 0;
-    }
-    switch (ch) {
-    case ',':
-        pos = open;
-        return get();
-    case '[':
-        if (pos == open) {
-            err_flag = 1;
-            return 0;
-        }
-        pos = open;
-        return get();
-    case '=':
-        if (pos == open || pos == equals) {
-            err_flag = 1;
-            return 0;
-        }
-        pos = equals;
-        return get();
-    case ']':
-        err_flag = -1;
-        pos = end;
-        return 0;
-    case '1': case '2': case '3': case '4': case '5': case '6':
-    case '7': case '8': case '9': case '0': case '.':
-        ip->putback(ch);
-        *ip >> curr;
-        curr *= (neg ? -1 : 1);
-        pos = open;
-        return curr;
-    case '-':
-        if (neg) {
-            err_flag = 1;
-            return 0;
-        }
-        pos = open;
-        return get(true);
-    default:
-        if (isalpha(ch)) {
-            if (pos != start) {
-                err_flag = 1;
-                return 0;
-            }
-            while (ip->get(ch) && (isalnum(ch) || ch=='_')) /* pass */;
-            ip->putback(ch);
-            pos = name;
-            return get();
-        }
-        err_flag = 1;
-        return 0;
-    }
-}
-
 bool ChangeRIRDialog::validate_everything() {
     /// TODO: usar funcionalidades de "validate" do Qt
     switch (choose_combo->currentIndex()) {
@@ -252,11 +175,13 @@ bool ChangeRIRDialog::validate_everything() {
         return true;
     case 2: // Literal
     {
-        FloatStream fs = new std::istringstream(
-            literal_edit->toPlainText().toUtf8().constData());
-        while (fs.err_flag == 0)
-            fs.get();
-        return (fs.err_flag != 1);
+        QByteArray txt = literal_edit->toPlainText().toUtf8();
+        try {
+            parse_rir_text(txt.constData(), txt.constData() + txt.size());
+        } catch (const RIRParseException&) {
+            return false;
+        }
+        return true;
     }
     case 3: // file
         return !file_select->text().isEmpty();
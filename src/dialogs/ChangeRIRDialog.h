@@ -19,6 +19,7 @@
 #include "../ATFA.h"
 #include "../widgets/FileSelectWidget.h"
 #include "../Signal.h"
+#include "../RIR.h"
 
 class ChangeRIRDialog : public QDialog
 {
@@ -30,8 +31,6 @@ public:
 
     bool validate_everything();
 
-    static Stream::container_t parse_txt(const QString &txt);
-
     static void err_dialog(const QString &err_msg, QWidget *p = 0);
 
     Scene::RIR_source_t get_source() { return final_source; }
@@ -63,18 +62,4 @@ private slots:
 
 };
 
-class FloatStream {
-public:
-    FloatStream(std::istream *p) : err_flag(0), pos(start), ip(p), curr(0) {}
-    ~FloatStream() { delete ip; }
-    double get(bool neg = false);
-    double& current();
-    int err_flag;
-private:
-    enum State {start, name, equals, open, end};
-    State pos;
-    std::istream *ip;
-    double curr;
-};
-
 #endif // CHANGERIRDIALOG_H
@@ -0,0 +1,206 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file dso_runner.cpp
+ *
+ * Holds the `main` function of the `atfa-dso-runner` helper, which loads an
+ * adaptive filter DSO and runs it on behalf of an `IsolatedRunner`.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "AdaptiveFilter.h"
+#include "IsolatedRunner.h"
+
+namespace {
+
+void copy_text(char *dest, size_t size, const std::string& src) {
+    size_t n = std::min(size - 1, src.size());
+    std::memcpy(dest, src.data(), n);
+    dest[n] = '\0';
+}
+
+void notify(int fd) {
+    uint64_t one = 1;
+    if (write(fd, &one, sizeof one) < 0) {}
+}
+
+}
+
+/**
+  * Usage: `atfa-dso-runner <dso> <shm fd> <request fd> <response fd>`. The
+  * descriptors are inherited from ATFA, which spawns this process; it is not
+  * meant to be run by hand.
+  */
+int main(int argc, char *argv[]) {
+
+    using namespace RunnerShm;
+
+    if (argc != 5) {
+        std::cerr << "Usage: " << argv[0]
+                  << " <dso> <shm fd> <request fd> <response fd>" << std::endl
+                  << "This program is started by atfa; it is not meant to be"
+                  << " run by hand." << std::endl;
+        return 2;
+    }
+    int shm_fd = std::atoi(argv[2]);
+    int req_fd = std::atoi(argv[3]);
+    int resp_fd = std::atoi(argv[4]);
+
+    void *mem = mmap(nullptr, sizeof(Region), PROT_READ | PROT_WRITE,
+                     MAP_SHARED, shm_fd, 0);
+    if (mem == MAP_FAILED) {
+        std::cerr << "[DSO runner] Error: could not map shared memory."
+                  << std::endl;
+        return 3;
+    }
+    Region *region = static_cast<Region *>(mem);
+    if (region->magic != MAGIC) {
+        std::cerr << "[DSO runner] Error: bad shared memory." << std::endl;
+        return 3;
+    }
+
+    AdaptiveFilter<float> *adapf;
+    try {
+        adapf = new AdaptiveFilter<float>(argv[1]); // loads and tests the DSO
+    } catch (const std::exception& e) {
+        copy_text(region->error, sizeof region->error, e.what());
+        region->state.store(FAILED, std::memory_order_release);
+        notify(resp_fd);
+        return 1;
+    }
+    copy_text(region->title, sizeof region->title, adapf->get_title());
+    copy_text(region->listing, sizeof region->listing, adapf->get_listing());
+    region->has_state_io = adapf->has_state_io();
+    region->state.store(READY, std::memory_order_release);
+    notify(resp_fd);
+
+    bool initialized = false;
+    bool quit = false;
+    int learn[MAX_BLOCK];
+
+    while (!quit) {
+
+        uint64_t v;
+        if (read(req_fd, &v, sizeof v) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        uint32_t head = region->head.load(std::memory_order_acquire);
+        uint32_t done = region->done.load(std::memory_order_relaxed);
+
+        while (done != head && !quit) {
+            Slot& s = region->ring[done % SLOTS];
+            s.status = 0;
+            switch (s.op) {
+            case OP_RUN: {
+                unsigned n = std::min(s.n, MAX_BLOCK);
+                if (!initialized) {
+                    std::copy(s.y, s.y + n, s.e);
+                    s.updates = 0;
+                    break;
+                }
+                std::copy(s.learn, s.learn + n, learn);
+                adapf->reset_nup();
+                adapf->run_block(s.x, s.y, learn, s.e, n);
+                s.updates = static_cast<uint32_t>(adapf->number_of_updates());
+                const float *w;
+                unsigned w_n;
+                adapf->get_impresp(&w, &w_n);
+                w_n = std::min(w_n, MAX_TAPS);
+                std::memcpy(region->w, w, w_n * sizeof(float));
+                region->w_n = w_n;
+                break;
+            }
+            case OP_INIT:
+                try {
+                    if (initialized)
+                        adapf->destroy_data_structures();
+                    adapf->initialize_data_structures();
+                    initialized = true;
+                } catch (const std::exception& e) {
+                    copy_text(region->error, sizeof region->error, e.what());
+                    s.status = 1;
+                    initialized = false;
+                }
+                break;
+            case OP_CLOSE:
+                if (initialized)
+                    adapf->destroy_data_structures();
+                initialized = false;
+                break;
+            case OP_RESTART:
+                if (initialized)
+                    adapf->reset_state();
+                break;
+            case OP_SAVE_STATE:
+                try {
+                    AdaptiveFilter<float>::state_t state = adapf->save_state();
+                    if (state.size() > MAX_STATE) {
+                        copy_text(region->error, sizeof region->error,
+                                  "filter state too large.");
+                        s.status = 1;
+                        break;
+                    }
+                    std::copy(state.begin(), state.end(),
+                              region->state_data);
+                    region->state_size = state.size();
+                } catch (const std::exception& e) {
+                    copy_text(region->error, sizeof region->error, e.what());
+                    s.status = 1;
+                }
+                break;
+            case OP_LOAD_STATE:
+                try {
+                    size_t n = std::min<size_t>(region->state_size,
+                                                MAX_STATE);
+                    const char *st = region->state_data;
+                    adapf->load_state(
+                        AdaptiveFilter<float>::state_t(st, st + n));
+                } catch (const std::exception& e) {
+                    copy_text(region->error, sizeof region->error, e.what());
+                    s.status = 1;
+                }
+                break;
+            case OP_QUIT:
+                quit = true;
+                break;
+            default:
+                s.status = 1;
+            }
+            ++done;
+            region->done.store(done, std::memory_order_release);
+        }
+
+        notify(resp_fd);
+
+    }
+
+    if (initialized)
+        adapf->destroy_data_structures();
+    delete adapf;
+    return 0;
+
+}
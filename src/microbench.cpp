@@ -0,0 +1,528 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file microbench.cpp
+ *
+ * Holds the `main` function of `atfa-microbench`, which times the DSP
+ * building blocks of ATFA (the FFT, the VADs, one step of each of the
+ * `Stream` threads, ...) one at a time, across realistic sizes.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <QtCore>
+
+#include "Signal.h"
+#include "Stream.h"
+#include "Timing.h"
+#include "VAD.h"
+#include "utils.h"
+
+/// Drives the private parts of a `Stream` without PortAudio
+/**
+  * Prepares a session the way `Stream::echo()` does, but doesn't start the
+  * `rir_fft` thread, so that `process_block()` and `read_write()` can be
+  * called directly by the benchmarks.
+  */
+class StreamBenchmark
+{
+
+public:
+
+    typedef Stream::container_t container_t;
+
+    /// `adapf`, if given, is owned by the stream
+    StreamBenchmark(const Stream::Scenario& scene,
+                    AdaptiveFilter<Stream::sample_t> *adapf = nullptr)
+        : stream(scene)
+    {
+        if (adapf)
+            stream.setAdapfAlgorithm(adapf);
+        stream.adapf->initialize_data_structures();
+        stream.watchdog.configure(scene.watchdog_action,
+                                  scene.watchdog_energy_ratio_db,
+                                  scene.watchdog_max_coef_norm,
+                                  Stream::samplerate / 2);
+        stream.watchdog.start();
+        stream.dtd.configure(scene.dtd_geigel_db, scene.dtd_ncc_percent);
+        stream.dtd.start();
+        stream.start_vad();
+        stream.reset_buffers();
+    }
+
+    ~StreamBenchmark() {
+        stream.adapf->destroy_data_structures();
+        stream.stop_vad();
+    }
+
+    /// Fills the far-end buffer, as if it had been recorded
+    void set_far_end(const container_t& x) {
+        std::copy_n(x.begin(), std::min(x.size(), stream.data_in.size()),
+                    stream.data_in.begin());
+    }
+
+    void process_block() { stream.process_block(); }
+
+    template<class InputIt, class OutputIt>
+    bool read_write(InputIt in_buf, OutputIt out_buf, pa_fperbuf_t frames) {
+        return stream.read_write(in_buf, out_buf, frames);
+    }
+
+private:
+    Stream stream;
+
+};
+
+namespace {
+
+typedef Signal::container_t container_t;
+
+/// What one iteration of a fixture does, as the fixture tells the runner
+struct State {
+    long arg;       ///< the size being benchmarked
+    double samples; ///< audio samples processed by one iteration
+    double flops;   ///< floating-point operations in one iteration; 0 if the
+                    ///< count isn't known
+};
+
+/// A benchmark, in the layout of Google Benchmark's fixtures
+/**
+  * `set_up()` is called once per argument, and fills in the `State`; then
+  * `run()`, which is one iteration, is timed as many times as the
+  * `Timing::Harness` wants; then `tear_down()`.
+  */
+class Fixture {
+public:
+    virtual ~Fixture() {}
+    virtual void set_up(State& st) = 0;
+    virtual void run(State& st) = 0;
+    virtual void tear_down(State&) {}
+};
+
+/// A fixture, and the sizes it is run with
+struct Benchmark {
+    std::string name;
+    std::vector<long> args;
+    std::function<std::unique_ptr<Fixture>()> make;
+};
+
+volatile double sink;
+
+/// Keeps the compiler from optimizing away a result
+void keep(double x) {
+    sink = x;
+}
+
+/// Gaussian noise, 20 dB below full scale
+container_t noise(size_t n, unsigned seed = 1) {
+    std::mt19937 rng{seed};
+    std::normal_distribution<float> gauss{0, .1f};
+    container_t x(n);
+    for (auto& s : x)
+        s = gauss(rng);
+    return x;
+}
+
+double fft_flops(double n) {
+    return 5 * n * std::log2(n);
+}
+
+/// A forward and an inverse transform, as in `Signal::filter`
+class DFTFixture : public Fixture {
+    container_t re, im;
+public:
+    void set_up(State& st) override {
+        auto n = static_cast<size_t>(st.arg);
+        re = noise(n, 1);
+        im = noise(n, 2);
+        st.samples = double(n);
+        st.flops = 2 * fft_flops(double(n));
+    }
+    void run(State&) override {
+        Signal::dft(re, im);
+        Signal::dft(re, im, DefaultDFT::INVERSE);
+    }
+    void tear_down(State&) override { keep(re[0]); }
+};
+
+/// Convolves `arg` samples with a 2048-tap RIR
+class FilterFixture : public Fixture {
+    std::unique_ptr<Signal> x, h;
+public:
+    constexpr static size_t RIR_TAPS = 2048;
+    void set_up(State& st) override {
+        x.reset(new Signal{noise(static_cast<size_t>(st.arg), 1)});
+        h.reset(new Signal{noise(RIR_TAPS, 2)});
+        x->set_samplerate(Stream::samplerate);
+        h->set_samplerate(Stream::samplerate);
+        st.samples = double(st.arg);
+        st.flops = 0;
+    }
+    void run(State&) override {
+        Signal y = *x;
+        y.filter(*h);
+        keep(y[0]);
+    }
+};
+
+/// Resamples `arg` samples at 44.1 kHz to the stream rate, as when a WAV
+/// file is loaded
+class ResampleFixture : public Fixture {
+    std::unique_ptr<Signal> x;
+public:
+    constexpr static int FILE_SAMPLERATE = 44100;
+    void set_up(State& st) override {
+        x.reset(new Signal{noise(static_cast<size_t>(st.arg))});
+        x->set_samplerate(FILE_SAMPLERATE);
+        st.samples = double(st.arg);
+        st.flops = 0;
+    }
+    void run(State&) override {
+        Signal y = *x;
+        y.set_samplerate(Stream::samplerate);
+        keep(y[0]);
+    }
+};
+
+/// Runs a time-domain VAD on a block of `arg` samples
+class VADFixture : public Fixture {
+    Stream::vad_algorithm_t vad;
+    container_t x;
+    unsigned detections;
+public:
+    explicit VADFixture(Stream::vad_algorithm_t v) : vad(v), detections(0) {}
+    void set_up(State& st) override {
+        x = noise(static_cast<size_t>(st.arg));
+        st.samples = double(st.arg);
+        st.flops = 0;
+    }
+    void run(State&) override { detections += (*vad)(x.begin(), x.end()); }
+    void tear_down(State&) override { keep(detections); }
+};
+
+/// One iteration of the `rir_fft` thread; `arg` enables the double-talk
+/// detector
+/**
+  * The FLOP count is only that of the two FFTs, the spectral product and the
+  * overlap-and-add; the VAD and the detector aren't counted.
+  */
+class RIRBlockFixture : public Fixture {
+    std::unique_ptr<StreamBenchmark> sb;
+public:
+    void set_up(State& st) override {
+        Stream::Scenario scene;
+        scene.dtd_enabled = st.arg != 0;
+        sb.reset(new StreamBenchmark(scene));
+        sb->set_far_end(noise(Stream::buf_size));
+        st.samples = Stream::blk_size;
+        st.flops = 2 * fft_flops(Stream::fft_size) + 6 * Stream::fft_size +
+                   Stream::fft_size;
+    }
+    void run(State&) override { sb->process_block(); }
+    void tear_down(State&) override { sb.reset(); }
+};
+
+/// One audio callback of `arg` frames, with the dummy filter or the DSO
+class ReadWriteFixture : public Fixture {
+    std::string dso;
+    bool isolated;
+    std::unique_ptr<StreamBenchmark> sb;
+    container_t in, out;
+    unsigned aborted;
+public:
+    ReadWriteFixture(const std::string& dso_path, bool iso)
+        : dso(dso_path), isolated(iso), aborted(0) {}
+    void set_up(State& st) override {
+        auto adapf = dso.empty() ? nullptr :
+                new AdaptiveFilter<Stream::sample_t>(dso, isolated);
+        sb.reset(new StreamBenchmark(Stream::Scenario(), adapf));
+        in = noise(static_cast<size_t>(st.arg));
+        out.assign(in.size(), 0);
+        st.samples = double(st.arg);
+        st.flops = 0;
+    }
+    void run(State& st) override {
+        aborted += !sb->read_write(in.data(), out.data(),
+                                   static_cast<pa_fperbuf_t>(st.arg));
+    }
+    void tear_down(State&) override {
+        keep(out[0] + aborted);
+        sb.reset();
+    }
+};
+
+template<class F, class... Args>
+std::function<std::unique_ptr<Fixture>()> factory(Args... args) {
+    return [=]() { return std::unique_ptr<Fixture>(new F(args...)); };
+}
+
+std::vector<Benchmark> all_benchmarks(const std::string& dso, bool isolated) {
+    return {
+        { "DefaultDFT", { 128, 1024, 8192, long(DefaultDFT::tblsize) },
+          factory<DFTFixture>() },
+        { "Signal::filter", { 1024, 11025, 110250 },
+          factory<FilterFixture>() },
+        { "Signal::set_samplerate", { 4410, 44100, 441000 },
+          factory<ResampleFixture>() },
+        { "vad_hard", { 128, 1024 },
+          factory<VADFixture>(&vad_hard) },
+        { "vad_soft", { 128, 1024 },
+          factory<VADFixture>(&vad_soft) },
+        { "Stream::process_block", { 0, 1 },
+          factory<RIRBlockFixture>() },
+        { "Stream::read_write", { 64, 128, 256, 512, 1024 },
+          factory<ReadWriteFixture>(dso, isolated) },
+    };
+}
+
+struct Result {
+    std::string name;
+    Timing::Stats time_per_sample;
+    double flops_per_sample;
+    double gflops() const {
+        double ns = time_per_sample.median.count() * 1e9;
+        return flops_per_sample > 0 && ns > 0 ? flops_per_sample / ns : 0;
+    }
+};
+
+constexpr double DEFAULT_TARGET = .5; // seconds per benchmark
+constexpr double REPETITION_TIME = .01; // seconds
+constexpr unsigned long MAX_ITERATIONS = 1ul << 24;
+
+Result run_benchmark(Fixture& f, long arg, const Timing::Harness& harness) {
+    State st{arg, 0, 0};
+    f.set_up(st);
+    // as many iterations per repetition as take REPETITION_TIME
+    unsigned long iterations = 1;
+    for (;;) {
+        Timing::Stopwatch sw;
+        sw.start();
+        for (unsigned long i = 0; i != iterations; ++i)
+            f.run(st);
+        sw.stop();
+        if (sw.elapsed().count() >= REPETITION_TIME ||
+                iterations >= MAX_ITERATIONS)
+            break;
+        iterations *= 2;
+    }
+    auto rep = [&f, &st, iterations](Timing::Stopwatch& sw) {
+        sw.start();
+        for (unsigned long i = 0; i != iterations; ++i)
+            f.run(st);
+        sw.stop();
+    };
+    Result r;
+    r.time_per_sample = harness.run(rep, double(iterations) * st.samples);
+    r.flops_per_sample = st.samples > 0 ? st.flops / st.samples : 0;
+    f.tear_down(st);
+    return r;
+}
+
+struct Options {
+    std::string filter;
+    std::string dso;
+    std::string output;
+    bool isolated = false;
+    bool json = false;
+    bool list = false;
+    bool help = false;
+    double target = DEFAULT_TARGET;
+};
+
+class UsageError : public std::runtime_error {
+public:
+    UsageError(const std::string& desc) : runtime_error(desc) {}
+};
+
+void print_usage(const char *argv0) {
+    std::cerr
+        << "Usage: " << argv0 << " [options]\n"
+        << "\n"
+        << "Times the DSP building blocks of ATFA, reporting the median time"
+           " per\naudio sample and, where the operation count is known,"
+           " GFLOP/s.\n"
+        << "\n"
+        << "Options:\n"
+        << "  --filter TEXT        only run benchmarks whose name contains"
+           " TEXT\n"
+        << "  --list               list the benchmarks and exit\n"
+        << "  --dso FILE           adaptive filter used by Stream::read_write"
+           " (default:\n                       the dummy filter)\n"
+        << "  --isolated           run that DSO in a helper process\n"
+        << "  --target SECONDS     wall time spent on each benchmark"
+           " (default: " << DEFAULT_TARGET << ")\n"
+        << "  --format table|json  output format (default: table)\n"
+        << "  --output FILE        write to FILE instead of stdout\n";
+}
+
+Options parse_args(int argc, char *argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--isolated") {
+            opts.isolated = true;
+            continue;
+        }
+        if (arg == "--help") {
+            opts.help = true;
+            continue;
+        }
+        if (arg == "--list") {
+            opts.list = true;
+            continue;
+        }
+        if (arg.compare(0, 2, "--") != 0)
+            throw UsageError("Unexpected argument `" + arg + "'.");
+        if (i + 1 == argc)
+            throw UsageError(arg + " expects a value.");
+        std::string value = argv[++i];
+        if (arg == "--filter")
+            opts.filter = value;
+        else if (arg == "--dso")
+            opts.dso = value;
+        else if (arg == "--target") {
+            std::istringstream iss(value);
+            if (!(iss >> opts.target) || !iss.eof() || opts.target <= 0)
+                throw UsageError("--target expects a positive number.");
+        }
+        else if (arg == "--format") {
+            if (value != "table" && value != "json")
+                throw UsageError("--format must be table or json.");
+            opts.json = value == "json";
+        }
+        else if (arg == "--output")
+            opts.output = value;
+        else
+            throw UsageError("Unknown option " + arg + ".");
+    }
+    return opts;
+}
+
+void print_header(std::ostream& os) {
+    os << std::left << std::setw(32) << "Benchmark" << std::right
+       << std::setw(14) << "ns/sample" << std::setw(12) << "MAD (ns)"
+       << std::setw(10) << "GFLOP/s" << std::setw(8) << "reps" << '\n'
+       << std::string(76, '-') << '\n';
+}
+
+void print_row(std::ostream& os, const Result& r) {
+    const Timing::Stats& t = r.time_per_sample;
+    os << std::left << std::setw(32) << r.name << std::right << std::fixed
+       << std::setprecision(3)
+       << std::setw(14) << t.median.count() * 1e9
+       << std::setw(12) << t.mad.count() * 1e9
+       << std::setw(10);
+    if (r.gflops() > 0)
+        os << r.gflops();
+    else
+        os << "-";
+    os << std::setw(8) << t.repetitions << '\n' << std::flush;
+}
+
+QJsonObject result_json(const Result& r) {
+    const Timing::Stats& t = r.time_per_sample;
+    auto ns = [](Timing::seconds_t s) { return s.count() * 1e9; };
+    QJsonObject obj;
+    obj["name"] = QString::fromStdString(r.name);
+    obj["repetitions"] = int(t.repetitions);
+    obj["median_ns_per_sample"] = ns(t.median);
+    obj["ci_low_ns"] = ns(t.ci_low);
+    obj["ci_high_ns"] = ns(t.ci_high);
+    obj["mad_ns"] = ns(t.mad);
+    obj["min_ns"] = ns(t.min);
+    obj["max_ns"] = ns(t.max);
+    obj["outliers"] = int(t.outliers);
+    if (r.gflops() > 0)
+        obj["gflops"] = r.gflops();
+    return obj;
+}
+
+}
+
+/**
+  * Usage: `atfa-microbench [options]`; run it with `--help` for the list of
+  * options.
+  */
+int main(int argc, char *argv[]) {
+
+    Options opts;
+    try {
+        opts = parse_args(argc, argv);
+    } catch (const UsageError& e) {
+        std::cerr << "[Microbench] " << e.what() << std::endl << std::endl;
+        print_usage(argv[0]);
+        return 2;
+    }
+    if (opts.help) {
+        print_usage(argv[0]);
+        return 0;
+    }
+
+    try {
+
+        std::ofstream file;
+        if (!opts.output.empty()) {
+            file.open(opts.output);
+            if (!file)
+                throw FileError(opts.output);
+        }
+        std::ostream& os = opts.output.empty() ? std::cout : file;
+
+        Timing::Harness harness{opts.target};
+        QJsonArray results;
+        if (!opts.json && !opts.list)
+            print_header(os);
+        for (const auto& b : all_benchmarks(opts.dso, opts.isolated)) {
+            for (long arg : b.args) {
+                std::string name = b.name + "/" + std::to_string(arg);
+                if (name.find(opts.filter) == std::string::npos)
+                    continue;
+                if (opts.list) {
+                    os << name << '\n';
+                    continue;
+                }
+                auto fixture = b.make();
+                Result r = run_benchmark(*fixture, arg, harness);
+                r.name = name;
+                if (opts.json)
+                    results.append(result_json(r));
+                else
+                    print_row(os, r);
+            }
+        }
+        if (opts.json) {
+            QJsonObject obj;
+            obj["target_seconds"] = opts.target;
+            obj["benchmarks"] = results;
+            os << QJsonDocument(obj).toJson().constData();
+        }
+
+        return 0;
+
+    } catch (const std::exception& e) {
+        std::cerr << "[Microbench] Error: " << e.what() << std::endl;
+        return 3;
+    }
+
+}
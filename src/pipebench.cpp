@@ -0,0 +1,549 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file pipebench.cpp
+ *
+ * Holds the `main` function of `atfa-pipebench`, which runs whole `Stream`
+ * pipelines offline, with synthetic audio callbacks, to find how many echo
+ * cancelled channels one CPU core can sustain.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+extern "C" {
+#   include <sched.h>
+}
+#endif
+
+#include <QtCore>
+
+#include "AdaptiveFilter.h"
+#include "SignalSource.h"
+#include "Stream.h"
+#include "utils.h"
+
+namespace {
+
+typedef std::chrono::steady_clock clock_type;
+typedef std::chrono::duration<double> seconds_t;
+
+/// The audio device runs at four times the stream rate (see
+/// `Stream::process()`)
+constexpr unsigned DEVICE_RATE = 4 * Stream::samplerate;
+
+constexpr unsigned long DEFAULT_FRAMES = 512; // device frames per callback
+constexpr double DEFAULT_SECONDS = 10; // of audio, per channel
+constexpr size_t RIR_TAPS = 2048;
+
+struct Options {
+    std::vector<int> channels{1, 2, 4, 8};
+    unsigned long frames = DEFAULT_FRAMES;
+    double seconds = DEFAULT_SECONDS;
+    std::string dso;
+    std::string input; // empty: synthetic
+    bool isolated = false;
+    int cpu = -2; // -2: the first allowed CPU; -1: no pinning
+    bool realtime = false;
+    bool json = false;
+    bool help = false;
+    std::string output;
+};
+
+class UsageError : public std::runtime_error {
+public:
+    UsageError(const std::string& desc) : runtime_error(desc) {}
+};
+
+void print_usage(const char *argv0) {
+    std::cerr
+        << "Usage: " << argv0 << " [options]\n"
+        << "\n"
+        << "Runs many Stream pipelines (resampling, adaptive filter, VAD and"
+           " RIR\nconvolution) offline, on one CPU core, with synthetic audio"
+           " callbacks,\nand reports the real-time factor, the worst block"
+           " latency, and how\nmany channels the core can sustain.\n"
+        << "\n"
+        << "Options:\n"
+        << "  --channels LIST      comma-separated numbers of streams"
+           " (default: 1,2,4,8)\n"
+        << "  --frames N           device frames per callback, at "
+        << DEVICE_RATE << " Hz\n                       (default: "
+        << DEFAULT_FRAMES << ")\n"
+        << "  --seconds S          audio per channel (default: "
+        << DEFAULT_SECONDS << ")\n"
+        << "  --input FILE         far-end audio, at " << DEVICE_RATE << " or "
+        << Stream::samplerate << " Hz, read\n                       as it"
+           " is needed (default: synthetic noise bursts)\n"
+        << "  --dso FILE           adaptive filter of every channel"
+           " (default: the\n                       dummy filter)\n"
+        << "  --isolated           run the DSO in helper processes\n"
+        << "  --cpu N              pin the pipelines to CPU N (default: the"
+           " first\n                       allowed CPU; -1: don't pin)\n"
+        << "  --realtime           make the callbacks at the device rate,"
+           " instead of\n                       as fast as possible\n"
+        << "  --format table|json  output format (default: table)\n"
+        << "  --output FILE        write to FILE instead of stdout\n";
+}
+
+long to_integer(const std::string& opt, const std::string& value) {
+    std::istringstream iss(value);
+    long x;
+    if (!(iss >> x) || !iss.eof())
+        throw UsageError(opt + " expects an integer, got `" + value + "'.");
+    return x;
+}
+
+Options parse_args(int argc, char *argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help") {
+            opts.help = true;
+            continue;
+        }
+        if (arg == "--isolated") {
+            opts.isolated = true;
+            continue;
+        }
+        if (arg == "--realtime") {
+            opts.realtime = true;
+            continue;
+        }
+        if (arg.compare(0, 2, "--") != 0)
+            throw UsageError("Unexpected argument `" + arg + "'.");
+        if (i + 1 == argc)
+            throw UsageError(arg + " expects a value.");
+        std::string value = argv[++i];
+        if (arg == "--channels") {
+            opts.channels.clear();
+            std::istringstream iss(value);
+            std::string item;
+            while (std::getline(iss, item, ',')) {
+                long c = to_integer(arg, item);
+                if (c < 1)
+                    throw UsageError("--channels must be positive.");
+                opts.channels.push_back(static_cast<int>(c));
+            }
+            if (opts.channels.empty())
+                throw UsageError("--channels expects a list.");
+        }
+        else if (arg == "--frames") {
+            long f = to_integer(arg, value);
+            if (f < 4)
+                throw UsageError("--frames must be at least 4.");
+            opts.frames = static_cast<unsigned long>(f);
+        }
+        else if (arg == "--seconds") {
+            std::istringstream iss(value);
+            if (!(iss >> opts.seconds) || !iss.eof() || opts.seconds <= 0)
+                throw UsageError("--seconds expects a positive number.");
+        }
+        else if (arg == "--dso")
+            opts.dso = value;
+        else if (arg == "--input")
+            opts.input = value;
+        else if (arg == "--cpu")
+            opts.cpu = static_cast<int>(to_integer(arg, value));
+        else if (arg == "--format") {
+            if (value != "table" && value != "json")
+                throw UsageError("--format must be table or json.");
+            opts.json = value == "json";
+        }
+        else if (arg == "--output")
+            opts.output = value;
+        else
+            throw UsageError("Unknown option " + arg + ".");
+    }
+    return opts;
+}
+
+/// Pins the calling thread, and the threads it creates from then on, to one
+/// CPU; restores the previous affinity when destroyed
+class CPUPin {
+public:
+    /// `cpu` as in `Options::cpu`
+    explicit CPUPin(int cpu) : pinned_(-1) {
+#ifdef __linux__
+        if (cpu == -1 || sched_getaffinity(0, sizeof(old), &old) != 0)
+            return;
+        size_t target = 0;
+        if (cpu >= 0)
+            target = static_cast<size_t>(cpu);
+        else
+            while (target != CPU_SETSIZE && !CPU_ISSET(target, &old))
+                ++target;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(target, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) == 0)
+            pinned_ = static_cast<int>(target);
+        else
+            std::cerr << "[Pipebench] Warning: could not pin to CPU "
+                      << target << "; the results are not per core."
+                      << std::endl;
+#else
+        (void)cpu;
+        std::cerr << "[Pipebench] Warning: pinning is only supported on"
+                     " Linux; the results are not per core." << std::endl;
+#endif
+    }
+    ~CPUPin() {
+#ifdef __linux__
+        if (pinned_ >= 0)
+            sched_setaffinity(0, sizeof(old), &old);
+#endif
+    }
+    CPUPin(const CPUPin&) = delete;
+    CPUPin& operator=(const CPUPin&) = delete;
+    int pinned() const { return pinned_; }
+private:
+    int pinned_;
+#ifdef __linux__
+    cpu_set_t old;
+#endif
+};
+
+/// Noise bursts, like speech with pauses, at the device rate
+std::vector<float> synthetic_input(size_t n) {
+    std::mt19937 rng;
+    std::normal_distribution<float> gauss{0, .1f};
+    const size_t on = DEVICE_RATE / 2, period = 3 * DEVICE_RATE / 4;
+    std::vector<float> x(n);
+    for (size_t i = 0; i != n; ++i)
+        x[i] = i % period < on ? gauss(rng) : 0;
+    return x;
+}
+
+/// The far-end audio of the pipelines, a callback at a time
+/**
+  * Either the synthetic bursts, cycled through, or an audio file, read
+  * through a `SndFileSource` as the callbacks need it (and from the start
+  * again when it ends), so that recordings of any length can be used without
+  * holding them in memory. Files at the stream rate have each sample
+  * repeated up to the device rate.
+  */
+class Feed {
+public:
+    /// `filename` as in `Options::input`
+    Feed(const std::string& filename, unsigned long frames)
+        : frames_(frames), buf(), source(), hold(1), chunk(), pos(0)
+    {
+        if (filename.empty()) {
+            // a few seconds, cycled through
+            buf = synthetic_input(8 * DEVICE_RATE + frames);
+            return;
+        }
+        source.reset(new SndFileSource(filename));
+        if (source->samplerate() == int(Stream::samplerate))
+            hold = 4;
+        else if (source->samplerate() != int(DEVICE_RATE))
+            throw std::runtime_error(
+                    "The input must be at " + std::to_string(DEVICE_RATE) +
+                    " or " + std::to_string(Stream::samplerate) + " Hz.");
+        if (frames % hold != 0)
+            throw std::runtime_error("For input at the stream rate, the"
+                                     " frames must be a multiple of 4.");
+        if (source->frames() == 0)
+            throw std::runtime_error("The input is empty.");
+        buf.resize(frames);
+        chunk.resize(frames / hold);
+    }
+
+    /// The next `frames` device samples
+    const float *next() {
+        if (!source) {
+            if (pos + frames_ > buf.size())
+                pos = 0;
+            const float *p = &buf[pos];
+            pos += frames_;
+            return p;
+        }
+        for (unsigned long done = 0; done != chunk.size(); ) {
+            unsigned long got = source->read(&chunk[done],
+                                             chunk.size() - done);
+            if (got == 0)
+                source->rewind();
+            done += got;
+        }
+        for (size_t i = 0; i != buf.size(); ++i)
+            buf[i] = chunk[i / hold];
+        return buf.data();
+    }
+
+    /// Back to the start of the input
+    void rewind() {
+        pos = 0;
+        if (source)
+            source->rewind();
+    }
+
+private:
+    unsigned long frames_;
+    std::vector<float> buf;
+    std::unique_ptr<SndFileSource> source; // null: synthetic
+    unsigned long hold; // device samples per sample of the file
+    std::vector<float> chunk;
+    size_t pos; // in `buf`, for the synthetic input
+};
+
+/// An exponentially decaying RIR
+Stream::container_t synthetic_rir() {
+    std::mt19937 rng{2};
+    std::normal_distribution<float> gauss{0, .3f};
+    Stream::container_t h(RIR_TAPS);
+    for (size_t i = 0; i != h.size(); ++i)
+        h[i] = gauss(rng) * std::exp(-6.9f * float(i) / float(h.size()));
+    return h;
+}
+
+struct RunResult {
+    int channels;
+    double audio_seconds; ///< per channel
+    double busy_seconds;  ///< wall time if flat out, else CPU time
+    double worst_callback; ///< seconds, over all channels
+    double worst_latency;  ///< seconds, over all channels
+    double deadline;       ///< the latency a block can afford
+    bool aborted;          ///< the watchdog aborted some channel
+    double rtf() const { return busy_seconds / audio_seconds; }
+    bool sustainable() const {
+        return rtf() < 1 && worst_latency < deadline && !aborted;
+    }
+    /// Channels the core could run, extrapolating linearly from this run
+    int channels_per_core() const {
+        return rtf() > 0 ? static_cast<int>(channels / rtf()) : 0;
+    }
+};
+
+/// Runs `channels` pipelines over the same input
+/**
+  * Flat out, each round of callbacks waits for the `rir_fft` threads to
+  * process all the blocks it made, so that the wall time includes the whole
+  * pipeline; the busy time is then the wall time. In real time, the rounds
+  * are paced at the device rate, and the busy time is the CPU time of the
+  * process, which (pinned) is that of the core. Either way, the time spent
+  * reading the input is left out.
+  */
+RunResult run_pipelines(int channels, const Options& opts, Feed& input) {
+
+    Stream::Scenario scene;
+    scene.imp_resp = synthetic_rir();
+
+    std::vector<std::unique_ptr<Stream>> streams;
+    for (int c = 0; c != channels; ++c) {
+        streams.emplace_back(new Stream(scene));
+        if (!opts.dso.empty())
+            streams.back()->setAdapfAlgorithm(
+                    new AdaptiveFilter<Stream::sample_t>(opts.dso,
+                                                         opts.isolated));
+    }
+
+    const unsigned long frames = opts.frames;
+    const auto callbacks = static_cast<unsigned long>(
+                std::ceil(opts.seconds * DEVICE_RATE / double(frames)));
+    const seconds_t period{double(frames) / DEVICE_RATE};
+    std::vector<float> out(frames);
+
+    RunResult r{};
+    r.channels = channels;
+    r.audio_seconds = double(callbacks * frames) / DEVICE_RATE;
+    r.deadline = (scene.delay - scene.system_latency) / 1000.0 -
+                 double(Stream::blk_size) / Stream::samplerate;
+
+    for (auto& s : streams)
+        s->start_session();
+
+    unsigned long samples = 0; // given to each stream, at the stream rate
+    seconds_t reading{0};
+    std::clock_t reading_cpu = 0;
+    input.rewind();
+    std::clock_t cpu_start = std::clock();
+    auto start = clock_type::now();
+    try {
+        for (unsigned long k = 0; k != callbacks; ++k) {
+            auto t_read = clock_type::now();
+            std::clock_t c_read = std::clock();
+            const float *in = input.next();
+            reading_cpu += std::clock() - c_read;
+            reading += clock_type::now() - t_read;
+            if (opts.realtime)
+                std::this_thread::sleep_until(
+                            start + std::chrono::duration_cast<
+                                clock_type::duration>(period * double(k)));
+            for (auto& s : streams) {
+                auto t0 = clock_type::now();
+                r.aborted = !s->process(in, out.data(), frames) ||
+                            r.aborted;
+                seconds_t t = clock_type::now() - t0;
+                r.worst_callback = std::max(r.worst_callback, t.count());
+            }
+            samples += frames / 4;
+            if (opts.realtime)
+                continue;
+            unsigned long blocks = samples / Stream::blk_size;
+            for (auto& s : streams)
+                while (s->status().blocks < blocks)
+                    std::this_thread::yield();
+        }
+    } catch (...) {
+        for (auto& s : streams)
+            s->end_session();
+        throw;
+    }
+    seconds_t wall = clock_type::now() - start - reading;
+    double cpu = double(std::clock() - cpu_start - reading_cpu) /
+                 CLOCKS_PER_SEC;
+
+    for (auto& s : streams) {
+        r.worst_latency = std::max(r.worst_latency,
+                                   double(s->status().max_block_latency));
+        s->end_session();
+    }
+    r.busy_seconds = opts.realtime ? cpu : wall.count();
+
+    return r;
+
+}
+
+void print_header(std::ostream& os) {
+    os << std::right << std::setw(8) << "channels" << std::setw(10) << "RTF"
+       << std::setw(14) << "RTF/channel" << std::setw(16) << "callback (ms)"
+       << std::setw(15) << "latency (ms)" << std::setw(14) << "sustainable"
+       << std::setw(12) << "per core" << '\n'
+       << std::string(89, '-') << '\n';
+}
+
+void print_row(std::ostream& os, const RunResult& r) {
+    os << std::right << std::fixed << std::setw(8) << r.channels
+       << std::setprecision(4) << std::setw(10) << r.rtf()
+       << std::setw(14) << r.rtf() / r.channels
+       << std::setprecision(3) << std::setw(16) << 1e3 * r.worst_callback
+       << std::setw(15) << 1e3 * r.worst_latency
+       << std::setw(14) << (r.aborted ? "aborted" :
+                            r.sustainable() ? "yes" : "no")
+       << std::setw(12) << r.channels_per_core() << '\n' << std::flush;
+}
+
+QJsonObject run_json(const RunResult& r) {
+    QJsonObject obj;
+    obj["channels"] = r.channels;
+    obj["audio_seconds"] = r.audio_seconds;
+    obj["busy_seconds"] = r.busy_seconds;
+    obj["rtf"] = r.rtf();
+    obj["rtf_per_channel"] = r.rtf() / r.channels;
+    obj["worst_callback_ms"] = 1e3 * r.worst_callback;
+    obj["worst_block_latency_ms"] = 1e3 * r.worst_latency;
+    obj["deadline_ms"] = 1e3 * r.deadline;
+    obj["aborted"] = r.aborted;
+    obj["sustainable"] = r.sustainable();
+    obj["channels_per_core"] = r.channels_per_core();
+    return obj;
+}
+
+}
+
+/**
+  * Usage: `atfa-pipebench [options]`; run it with `--help` for the list of
+  * options.
+  */
+int main(int argc, char *argv[]) {
+
+    Options opts;
+    try {
+        opts = parse_args(argc, argv);
+    } catch (const UsageError& e) {
+        std::cerr << "[Pipebench] " << e.what() << std::endl << std::endl;
+        print_usage(argv[0]);
+        return 2;
+    }
+    if (opts.help) {
+        print_usage(argv[0]);
+        return 0;
+    }
+
+    try {
+
+        int max_channels = *std::max_element(opts.channels.begin(),
+                                             opts.channels.end());
+        if (!opts.dso.empty() && !opts.isolated && max_channels > 1 &&
+                !AdaptiveFilter<Stream::sample_t>(opts.dso).is_reentrant())
+            throw std::runtime_error("The DSO is not reentrant, so only one"
+                                     " channel can use it; try --isolated.");
+
+        std::ofstream file;
+        if (!opts.output.empty()) {
+            file.open(opts.output);
+            if (!file)
+                throw FileError(opts.output);
+        }
+        std::ostream& os = opts.output.empty() ? std::cout : file;
+
+        Feed input{opts.input, opts.frames};
+
+        CPUPin pin{opts.cpu};
+        if (!opts.json) {
+            os << (opts.realtime ? "Real time" : "Flat out") << ", "
+               << opts.frames << " frames per callback, "
+               << (pin.pinned() >= 0 ? "pinned to CPU " +
+                                       std::to_string(pin.pinned())
+                                     : std::string("not pinned"))
+               << "\n\n";
+            print_header(os);
+        }
+        QJsonArray runs;
+        int best = 0;
+        for (int c : opts.channels) {
+            RunResult r = run_pipelines(c, opts, input);
+            if (r.sustainable())
+                best = std::max(best, c);
+            if (opts.json)
+                runs.append(run_json(r));
+            else
+                print_row(os, r);
+        }
+
+        if (opts.json) {
+            QJsonObject obj;
+            obj["realtime"] = opts.realtime;
+            obj["frames"] = int(opts.frames);
+            obj["cpu"] = pin.pinned();
+            obj["dso"] = QString::fromStdString(opts.dso);
+            obj["input"] = QString::fromStdString(opts.input);
+            obj["runs"] = runs;
+            obj["max_sustainable_channels"] = best;
+            os << QJsonDocument(obj).toJson().constData();
+        }
+        else
+            os << "\nMost channels sustained: " << best << '\n';
+
+        return 0;
+
+    } catch (const std::exception& e) {
+        std::cerr << "[Pipebench] Error: " << e.what() << std::endl;
+        return 3;
+    }
+
+}
@@ -0,0 +1,95 @@
+/*
+ * Universidade Federal do Rio de Janeiro
+ * Escola Politécnica
+ * Projeto Final de Graduação
+ * Ambiente de Teste para Filtros Adaptativos
+ * Pedro Angelo Medeiros Fonini
+ * Orientador: Markus Lima
+ */
+
+/**
+ *
+ * \file simd.h
+ *
+ * Holds small reduction kernels written so that the compiler vectorizes them.
+ *
+ * \author Pedro Angelo Medeiros Fonini
+ */
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cstddef>
+
+/// Reductions that GCC auto-vectorizes at -O3, without -ffast-math
+/**
+  * A plain `for` loop summing into a single accumulator cannot be vectorized
+  * without reassociating floating-point additions, which the compiler is not
+  * allowed to do. These kernels keep `LANES` independent partial sums instead
+  * (one per SIMD lane), which produces the same vector code -ffast-math would,
+  * but with a deterministic result.
+  */
+namespace SIMD {
+
+/// Number of independent accumulators (8 floats fill an AVX register)
+constexpr unsigned LANES = 8;
+
+/// Returns the sum of `x[i]*x[i]` for `i` in `[0, n)`.
+template <typename T>
+inline T sum_squares(const T *x, size_t n) {
+    T acc[LANES] = {};
+    const T *end = x + n / LANES * LANES;
+    for (; x != end; x += LANES)
+        for (unsigned k = 0; k != LANES; ++k)
+            acc[k] += x[k] * x[k];
+    for (unsigned k = 0; k != n % LANES; ++k)
+        acc[k] += x[k] * x[k];
+    T sum = 0;
+    for (unsigned k = 0; k != LANES; ++k)
+        sum += acc[k];
+    return sum;
+}
+
+/// Returns the sum of `x[i]*y[i]` for `i` in `[0, n)`.
+template <typename T>
+inline T dot(const T *x, const T *y, size_t n) {
+    T acc[LANES] = {};
+    const T *end = x + n / LANES * LANES;
+    for (; x != end; x += LANES, y += LANES)
+        for (unsigned k = 0; k != LANES; ++k)
+            acc[k] += x[k] * y[k];
+    for (unsigned k = 0; k != n % LANES; ++k)
+        acc[k] += x[k] * y[k];
+    T sum = 0;
+    for (unsigned k = 0; k != LANES; ++k)
+        sum += acc[k];
+    return sum;
+}
+
+/// Returns the largest `|x[i]|` for `i` in `[0, n)`, or zero if `n == 0`.
+/**
+  * NaNs are ignored (the comparison is written so that it maps to the
+  * vector max instruction).
+  */
+template <typename T>
+inline T max_abs(const T *x, size_t n) {
+    T acc[LANES] = {};
+    const T *end = x + n / LANES * LANES;
+    for (; x != end; x += LANES)
+        for (unsigned k = 0; k != LANES; ++k) {
+            T a = x[k] < 0 ? -x[k] : x[k];
+            acc[k] = a > acc[k] ? a : acc[k];
+        }
+    for (unsigned k = 0; k != n % LANES; ++k) {
+        T a = x[k] < 0 ? -x[k] : x[k];
+        acc[k] = a > acc[k] ? a : acc[k];
+    }
+    T m = 0;
+    for (unsigned k = 0; k != LANES; ++k)
+        m = acc[k] > m ? acc[k] : m;
+    return m;
+}
+
+}
+
+#endif // SIMD_H
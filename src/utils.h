@@ -19,8 +19,12 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <cstdint>
+
+#include <atomic>
 #include <sstream>
 #include <stdexcept>
+#include <vector>
 
 #include <QtCore>
 
@@ -139,6 +143,45 @@ inline constexpr T pow(const T base, unsigned const exponent) {
 }
 }
 
+/// Fixed-size packed bitset that can be shared between two threads
+/**
+  * Each bit may be written by one thread while another thread tests it,
+  * without locks. Bits are set with release semantics and tested with acquire
+  * semantics, so whatever the writer did before setting a bit is visible to
+  * a reader that sees it.
+  */
+class AtomicBitset
+{
+public:
+    explicit AtomicBitset(size_t n) : bits(n), words((n + 63) / 64) {
+        reset();
+    }
+
+    size_t size() const { return bits; }
+
+    void set(size_t i, bool value) {
+        std::uint64_t mask = std::uint64_t(1) << (i % 64);
+        if (value)
+            words[i / 64].fetch_or(mask, std::memory_order_release);
+        else
+            words[i / 64].fetch_and(~mask, std::memory_order_release);
+    }
+
+    bool test(size_t i) const {
+        return (words[i / 64].load(std::memory_order_acquire) >> (i % 64)) & 1;
+    }
+
+    /// Clears all bits. Not atomic as a whole.
+    void reset() {
+        for (auto& w : words)
+            w.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    size_t bits;
+    std::vector<std::atomic<std::uint64_t>> words;
+};
+
 QJsonObject read_json_file(const QString& filename);
 
 #endif // UTILS_H